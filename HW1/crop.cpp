@@ -3,94 +3,86 @@
 #include <cstdint>
 #include <cstring>
 
-// Ensure no padding in structs
-#pragma pack(push, 1)
-struct BMPHeader {
-    uint16_t file_type;   // File type (must be 'BM') -> 2 bytes
-    uint32_t file_size;   // Size of the file (in bytes) -> 4 bytes
-    uint16_t reserved1;   // Reserved, always 0 -> 2 bytes
-    uint16_t reserved2;   // Reserved, always 0 -> 2 bytes
-    uint32_t offset_data; // Start position of pixel data -> 4 bytes
-};
-
-struct DIBHeader {
-    uint32_t size;            // Size of this header (in bytes)
-    int32_t width;            // Width of the image (in pixels)
-    int32_t height;           // Height of the image (in pixels)
-    uint16_t planes;          // Number of color planes (must be 1)
-    uint16_t bit_count;       // Bits per pixel (24 for RGB)
-    uint32_t compression;     // Compression type (0 = uncompressed)
-    uint32_t image_size;      // Size of the raw bitmap data (0 if no compression)
-    int32_t x_pixels_per_meter;
-    int32_t y_pixels_per_meter;
-    uint32_t colors_used;     // Number of colors in the palette
-    uint32_t important_colors;
-};
-#pragma pack(pop)
+#include "../common/bmp_io.h"
+#include "../common/batch_runner.h"
 
 // Function to crop the image
-void cropImage(uint8_t* data, int original_width, int original_height, int bytes_per_pixel, int x, int y, int w, int h, uint8_t* cropped_data) {
+void cropImage(const ConstImageView& src, int x, int y, int w, int h, const ImageView& cropped) {
+    int bytes_per_pixel = src.channels;
     for (int row = 0; row < h; ++row) {
         // Calculate the source and destination row positions
-        uint8_t* src_row = data + (y + row) * original_width * bytes_per_pixel;
-        uint8_t* dest_row = cropped_data + row * w * bytes_per_pixel;
+        const uint8_t* src_row = src.row(y + row);
+        uint8_t* dest_row = cropped.row(row);
 
         // Copy the row within the cropping region
         std::memcpy(dest_row, src_row + x * bytes_per_pixel, w * bytes_per_pixel);
     }
 }
 
-int main(int argc, char* argv[]) {
-    // Check if the input and output file paths are provided
-    if (argc != 3) {
-        std::cerr << "Usage: " << argv[0] << " <input BMP file> <output BMP file>" << std::endl;
-        return 1;
+// Batch mode asks for the cropping region once and cuts it from every image;
+// images it does not fit in are reported and skipped.
+int cropBatch(int argc, char* argv[]) {
+    BatchOptions options;
+    int threads = 0;
+    for (int i = 4; i < argc; i++) {
+        if (std::string(argv[i]) == "--in-flight" && i + 1 < argc) {
+            options.memoryBudget = static_cast<size_t>(std::stod(argv[i + 1]) * (1 << 20));
+            i++;
+        } else if (std::string(argv[i]) == "--threads" && i + 1 < argc) {
+            threads = std::stoi(argv[i + 1]);
+            i++;
+        }
     }
 
-    const char* input_file = argv[1];
-    const char* output_file = argv[2];
-
-    // Open the input BMP file as binary
-    std::ifstream input(input_file, std::ios::binary);
-    if (!input) {
-        std::cerr << "Error opening input file!" << std::endl;
+    int x, y, w, h;
+    std::cout << "Enter x, y, width, and height for cropping (e.g., 10 10 100 100): ";
+    if (!(std::cin >> x >> y >> w >> h) || x < 0 || y < 0 || w <= 0 || h <= 0) {
+        std::cerr << "Invalid cropping coordinates." << std::endl;
         return 1;
     }
 
-    BMPHeader bmp_header;
-    DIBHeader dib_header;
+    ThreadPool pool(threads);
+    bool ok = runBatchTool(argv[2], argv[3], pool, options, [&](BMPImage& image, const BatchJob& job, std::string&) {
+        if (x + w > image.width || y + h > image.height) {
+            std::cerr << "Error: The cropping region does not fit in '" << job.input << "' (" << image.width << "x"
+                      << image.height << ")." << std::endl;
+            return false;
+        }
+        BMPImage cropped = image;
+        resizeBMP(cropped, w, h);
+        cropImage(image.view(), x, y, w, h, cropped.view());
+        image = std::move(cropped);
+        return true;
+    });
+    return ok ? 0 : 1;
+}
 
-    // Read BMP header
-    input.read(reinterpret_cast<char*>(&bmp_header), sizeof(bmp_header));
-    if (bmp_header.file_type != 0x4D42) {  // 'BM' in hex
-        std::cerr << "Not a BMP file!" << std::endl;
+int main(int argc, char* argv[]) {
+    // Check if the input and output file paths are provided
+    bool batch = argc >= 2 && std::string(argv[1]) == "--batch";
+    if ((!batch && argc != 3) || (batch && argc < 4)) {
+        std::cerr << "Usage: " << argv[0] << " <input BMP file> <output BMP file>" << std::endl;
+        std::cerr << "       " << argv[0] << " --batch <input dir|manifest> <output dir> [--in-flight <MB>] [--threads N]" << std::endl;
         return 1;
     }
+    if (batch) {
+        return cropBatch(argc, argv);
+    }
 
-    // Read DIB header
-    input.read(reinterpret_cast<char*>(&dib_header), sizeof(dib_header));
+    const char* input_file = argv[1];
+    const char* output_file = argv[2];
 
-    if (dib_header.bit_count != 8 && dib_header.bit_count != 16 && dib_header.bit_count != 24 && dib_header.bit_count != 32) {
-        std::cerr << "Unsupported bit depth: " << dib_header.bit_count << std::endl;
+    BMPImage image;
+    if (!readBMP(input_file, image)) {
         return 1;
     }
 
-    int width = dib_header.width;
-    int height = dib_header.height;
-    int bytes_per_pixel = dib_header.bit_count / 8;
+    int width = image.width;
+    int height = image.height;
 
     // Show image dimensions
     std::cout << "Image dimensions: " << width << "x" << height << std::endl;
 
-    // Move the file pointer to the pixel data
-    input.seekg(bmp_header.offset_data, std::ios::beg);
-
-    // Read pixel data
-    int bytes_per_row = (width * bytes_per_pixel + 3) & ~3;  // Row size must be a multiple of 4 bytes
-    int data_size = bytes_per_row * height;
-    uint8_t* data = new uint8_t[data_size];
-    input.read(reinterpret_cast<char*>(data), data_size);
-
     int x, y, w, h;
     bool valid_input = false;
 
@@ -107,39 +99,18 @@ int main(int argc, char* argv[]) {
         }
     }
 
-    // Allocate memory for the cropped image
-    int cropped_bytes_per_row = (w * bytes_per_pixel + 3) & ~3;  // Row size for cropped image
-    int cropped_data_size = cropped_bytes_per_row * h;
-    uint8_t* cropped_data = new uint8_t[cropped_data_size];
+    // Same format as the input, resized to the cropping region
+    BMPImage cropped = image;
+    resizeBMP(cropped, w, h);
 
     // Crop the image
-    cropImage(data, width, height, bytes_per_pixel, x, y, w, h, cropped_data);
-
-    // Update BMP and DIB headers for the cropped image
-    bmp_header.file_size = sizeof(BMPHeader) + sizeof(DIBHeader) + cropped_data_size;
-    dib_header.width = w;
-    dib_header.height = h;
-    dib_header.image_size = cropped_data_size;
+    cropImage(image.view(), x, y, w, h, cropped.view());
 
     // Write the cropped image to the output file
-    std::ofstream output(output_file, std::ios::binary);
-    if (!output) {
-        std::cerr << "Error opening output file!" << std::endl;
-        delete[] data;
-        delete[] cropped_data;
+    if (!writeBMP(output_file, cropped)) {
         return 1;
     }
 
-    output.write(reinterpret_cast<char*>(&bmp_header), sizeof(bmp_header));
-    output.write(reinterpret_cast<char*>(&dib_header), sizeof(dib_header));
-    output.write(reinterpret_cast<char*>(cropped_data), cropped_data_size);
-
-    // Clean up
-    delete[] data;
-    delete[] cropped_data;
-    input.close();
-    output.close();
-
     std::cout << "Cropped image saved as " << output_file << std::endl;
 
     return 0;
@@ -6,105 +6,112 @@
 #include <cstdint>
 #include <cmath>
 #include <iomanip>
+#include <functional>
 
-#pragma pack(push, 1)
-struct BMPHeader {
-    uint16_t fileType;
-    uint32_t fileSize;
-    uint16_t reserved1;
-    uint16_t reserved2;
-    uint32_t offsetData;
-};
-
-struct BMPInfoHeader {
-    uint32_t size;
-    int32_t width;
-    int32_t height;
-    uint16_t planes;
-    uint16_t bitCount;
-    uint32_t compression;
-    uint32_t imageSize;
-    int32_t xPixelsPerMeter;
-    int32_t yPixelsPerMeter;
-    uint32_t colorsUsed;
-    uint32_t colorsImportant;
-};
-#pragma pack(pop)
+#include "../common/bmp_io.h"
+#include "../common/bilateral.h"
+#include "../common/tile_scheduler.h"
+#include "../common/padded_plane.h"
 
 int clamp(int value, int min, int max) {
     return std::max(min, std::min(value, max));
 }
 
-void readBMP(const std::string& filename, BMPHeader& header, BMPInfoHeader& infoHeader,
-             std::vector<std::vector<uint8_t>>& red,
-             std::vector<std::vector<uint8_t>>& green,
-             std::vector<std::vector<uint8_t>>& blue) {
-    std::ifstream inFile(filename, std::ios::binary);
-    if (!inFile) {
-        std::cerr << "Error: Could not open input file." << std::endl;
-        exit(1);
-    }
+// Runs a filter written against planes on one channel of a view, the plane
+// padded by `radius` replicated pixels so the filter needs no edge checks.
+void applyOnPlane(const ConstImageView& src, const ImageView& dst, int channel, int radius,
+                  const std::function<void(const PaddedPlane&, PaddedPlane&)>& filter) {
+    thread_local PaddedPlane plane, filtered;
+    plane.load(src, channel, radius, BorderMode::Replicate);
+    filtered.resize(src.width, src.height, 0);
+    filter(plane, filtered);
+    filtered.store(dst, channel);
+}
 
-    inFile.read(reinterpret_cast<char*>(&header), sizeof(header));
-    inFile.read(reinterpret_cast<char*>(&infoHeader), sizeof(infoHeader));
+void applyBilateralFilter(const PaddedPlane& channel,
+                          PaddedPlane& output,
+                          int kernelSize,
+                          float sigmaSpatial,
+                          float sigmaRange) {
+    int halfKernel = kernelSize / 2;
 
-    if (header.fileType != 0x4D42 || infoHeader.bitCount != 24) {
-        std::cerr << "Error: Only 24-bit BMP format is supported." << std::endl;
-        exit(1);
-    }
+    for (int y = 0; y < channel.height; ++y) {
+        for (int x = 0; x < channel.width; ++x) {
+            float sum = 0.0f;
+            float normFactor = 0.0f;
+            float centerIntensity = static_cast<float>(channel.row(y)[x]);
+
+            for (int ky = -halfKernel; ky <= halfKernel; ++ky) {
+                const uint8_t* row = channel.row(y + ky) + x;
+                for (int kx = -halfKernel; kx <= halfKernel; ++kx) {
+                    float neighborIntensity = static_cast<float>(row[kx]);
+
+                    float spatialDistance = kx * kx + ky * ky;
+                    float spatialWeight = std::exp(-spatialDistance / (2 * sigmaSpatial * sigmaSpatial));
 
-    int width = infoHeader.width;
-    int height = infoHeader.height;
-    int padding = (4 - (width * 3) % 4) % 4;
-
-    red.resize(height, std::vector<uint8_t>(width));
-    green.resize(height, std::vector<uint8_t>(width));
-    blue.resize(height, std::vector<uint8_t>(width));
-
-    inFile.seekg(header.offsetData, std::ios::beg);
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            uint8_t pixel[3];
-            inFile.read(reinterpret_cast<char*>(pixel), 3);
-            blue[y][x] = pixel[0];
-            green[y][x] = pixel[1];
-            red[y][x] = pixel[2];
+                    float intensityDifference = neighborIntensity - centerIntensity;
+                    float rangeWeight = std::exp(-(intensityDifference * intensityDifference) / (2 * sigmaRange * sigmaRange));
+
+                    float weight = spatialWeight * rangeWeight;
+
+                    sum += neighborIntensity * weight;
+                    normFactor += weight;
+                }
+            }
+
+            output.row(y)[x] = static_cast<uint8_t>(clamp(static_cast<int>(sum / normFactor + 0.5f), 0, 255));
         }
-        inFile.ignore(padding);
     }
-    inFile.close();
 }
 
-void writeBMP(const std::string& filename, const BMPHeader& header, const BMPInfoHeader& infoHeader,
-              const std::vector<std::vector<uint8_t>>& red,
-              const std::vector<std::vector<uint8_t>>& green,
-              const std::vector<std::vector<uint8_t>>& blue) {
-    std::ofstream outFile(filename, std::ios::binary);
-    if (!outFile) {
-        std::cerr << "Error: Could not open output file." << std::endl;
-        exit(1);
-    }
-
-    outFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
-    outFile.write(reinterpret_cast<const char*>(&infoHeader), sizeof(infoHeader));
+// Same result as applyBilateralFilter with the exponentials precomputed.
+void applyBilateralFilterLUT(const ConstImageView& src, const ImageView& dst, int channel,
+                             int kernelSize, float sigmaSpatial, float sigmaRange) {
+    bilateralFilterLUT(src.data + channel, src.stride, dst.data + channel, dst.stride, src.width, src.height,
+                       kernelSize, sigmaSpatial, sigmaRange, src.channels, dst.channels);
+}
 
-    int width = infoHeader.width;
-    int height = infoHeader.height;
-    int padding = (4 - (width * 3) % 4) % 4;
+// Bilateral grid approximation; the cost does not depend on the kernel size.
+void applyBilateralFilterGrid(const ConstImageView& src, const ImageView& dst, int channel,
+                              float sigmaSpatial, float sigmaRange) {
+    bilateralFilterGrid(src.data + channel, src.stride, dst.data + channel, dst.stride, src.width, src.height,
+                        sigmaSpatial, sigmaRange, src.channels, dst.channels);
+}
 
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            uint8_t pixel[3] = {blue[y][x], green[y][x], red[y][x]};
-            outFile.write(reinterpret_cast<char*>(pixel), 3);
+struct FilterError {
+    long long count = 0;
+    double sumSquared = 0;
+    double sumAbsolute = 0;
+    int maxAbsolute = 0;
+
+    void add(const ConstImageView& approx, const ConstImageView& exact) {
+        for (int y = 0; y < exact.height; ++y) {
+            for (int x = 0; x < exact.width; ++x) {
+                for (int c = 0; c < 3; ++c) {
+                    int d = std::abs(approx.pixel(x, y)[c] - exact.pixel(x, y)[c]);
+                    sumSquared += d * d;
+                    sumAbsolute += d;
+                    maxAbsolute = std::max(maxAbsolute, d);
+                    ++count;
+                }
+            }
         }
-        outFile.write("\0\0\0", padding);
     }
-    outFile.close();
-}
+
+    void print(const std::string& label) const {
+        double mse = sumSquared / count;
+        std::cout << label << " vs exact: max abs " << maxAbsolute << ", mean abs " << std::fixed << std::setprecision(4)
+                  << sumAbsolute / count << ", PSNR ";
+        if (mse == 0) std::cout << "inf";
+        else std::cout << std::setprecision(2) << 10 * std::log10(255.0 * 255.0 / mse) << " dB";
+        std::cout << std::endl;
+        std::cout.unsetf(std::ios::fixed);
+    }
+};
 
 int main(int argc, char* argv[]) {
     if (argc < 6) {
-        std::cerr << "Usage: " << argv[0] << " <input.bmp> <output.bmp> <sigmaSpatial> <sigmaRange> <kernelSize>" << std::endl;
+        std::cerr << "Usage: " << argv[0] << " <input.bmp> <output.bmp> <sigmaSpatial> <sigmaRange> <kernelSize> [--bilateral exact|lut|grid] [--report-error] [--threads N]" << std::endl;
         return 1;
     }
 
@@ -119,25 +126,75 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
-    BMPHeader header;
-    BMPInfoHeader infoHeader;
-    std::vector<std::vector<uint8_t>> red, green, blue;
-
-    readBMP(inputFileName, header, infoHeader, red, green, blue);
+    std::string engine = "lut";
+    bool reportError = false;
+    int threads = 0;
+    for (int i = 6; i < argc; i++) {
+        if (std::string(argv[i]) == "--bilateral" && i + 1 < argc) {
+            engine = argv[i + 1];
+            i++;
+        } else if (std::string(argv[i]) == "--report-error") {
+            reportError = true;
+        } else if (std::string(argv[i]) == "--threads" && i + 1 < argc) {
+            threads = std::stoi(argv[i + 1]);
+            i++;
+        }
+    }
+    if (engine != "exact" && engine != "lut" && engine != "grid") {
+        std::cerr << "Error: Bilateral engine must be 'exact', 'lut' or 'grid'." << std::endl;
+        return 1;
+    }
 
-    int width = infoHeader.width;
-    int height = infoHeader.height;
+    ThreadPool pool(threads);
 
-    // Apply bilateral filter on RGB channels
-    std::vector<std::vector<uint8_t>> redFiltered(height, std::vector<uint8_t>(width));
-    std::vector<std::vector<uint8_t>> greenFiltered(height, std::vector<uint8_t>(width));
-    std::vector<std::vector<uint8_t>> blueFiltered(height, std::vector<uint8_t>(width));
+    MappedBMP input;
+    if (!mapBMP(inputFileName, input)) {
+        return 1;
+    }
+    BMPImage image = copyBMP(input);
+
+    // Filter the RGB channels tile by tile.
+    int halo = kernelSize / 2;
+    auto exactFilter = [&](const ConstImageView& src, const ImageView& dst, int channel) {
+        applyOnPlane(src, dst, channel, halo, [&](const PaddedPlane& plane, PaddedPlane& out) {
+            applyBilateralFilter(plane, out, kernelSize, sigmaSpatial, sigmaRange);
+        });
+    };
+    if (engine == "grid") {
+        // The grid's result reaches about 5 * sigmaSpatial. Tiles have to start
+        // on a cell boundary of the whole image, i.e. a whole number of cells of
+        // sigmaSpatial pixels from it; the output then matches the untiled grid
+        // (up to rounding of the cell coordinates when 1 / sigmaSpatial is
+        // inexact). Without a small such step the image is one tile.
+        int cell = 0;
+        for (int step = 1; step <= 64 && !cell; ++step) {
+            float cells = step / sigmaSpatial;
+            if (std::fabs(cells - std::round(cells)) < 1e-4f) cell = step;
+        }
+        int gridHalo = cell ? static_cast<int>(std::ceil(5 * sigmaSpatial)) : std::max(image.width, image.height);
+        filterTiles(pool, input.view(), image.view(), 3, gridHalo,
+                    [&](const ConstImageView& src, const ImageView& dst, int channel) {
+                        applyBilateralFilterGrid(src, dst, channel, sigmaSpatial, sigmaRange);
+                    }, std::max(cell, 1));
+    } else if (engine == "lut") {
+        filterTiles(pool, input.view(), image.view(), 3, halo, [&](const ConstImageView& src, const ImageView& dst, int channel) {
+            applyBilateralFilterLUT(src, dst, channel, kernelSize, sigmaSpatial, sigmaRange);
+        });
+    } else {
+        filterTiles(pool, input.view(), image.view(), 3, halo, exactFilter);
+    }
 
-    applyBilateralFilter(red, redFiltered, width, height, kernelSize, sigmaSpatial, sigmaRange);
-    applyBilateralFilter(green, greenFiltered, width, height, kernelSize, sigmaSpatial, sigmaRange);
-    applyBilateralFilter(blue, blueFiltered, width, height, kernelSize, sigmaSpatial, sigmaRange);
+    if (reportError && engine != "exact") {
+        BMPImage exact = image;
+        filterTiles(pool, input.view(), exact.view(), 3, halo, exactFilter);
+        FilterError error;
+        error.add(image.view(), exact.view());
+        error.print(engine);
+    }
 
-    writeBMP(outputFileName, header, infoHeader, redFiltered, greenFiltered, blueFiltered);
+    if (!writeBMP(outputFileName, image)) {
+        return 1;
+    }
 
     std::cout << "Bilateral filter applied to RGB channels. Output saved as '" << outputFileName << "'." << std::endl;
     return 0;
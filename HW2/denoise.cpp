@@ -6,80 +6,97 @@
 #include <cstdint>
 #include <cmath>
 #include <iomanip>
+#include <functional>
+#include <sstream>
+#include <type_traits>
 
-using namespace std;
-#pragma pack(push, 1) // Ensure no padding for BMP header
-struct BMPHeader {
-    uint16_t fileType;
-    uint32_t fileSize;
-    uint16_t reserved1;
-    uint16_t reserved2;
-    uint32_t offsetData;
-};
-
-struct BMPInfoHeader {
-    uint32_t size;
-    int32_t width;
-    int32_t height;
-    uint16_t planes;
-    uint16_t bitCount;
-    uint32_t compression;
-    uint32_t imageSize;
-    int32_t xPixelsPerMeter;
-    int32_t yPixelsPerMeter;
-    uint32_t colorsUsed;
-    uint32_t colorsImportant;
-};
-#pragma pack(pop)
+#include "../common/bmp_io.h"
+#include "../common/band_stream.h"
+#include "../common/tile_scheduler.h"
+#include "../common/median_histogram.h"
+#include "../common/median_network.h"
+#include "../common/morphology.h"
+#include "../common/gaussian.h"
+#include "../common/bilateral.h"
+#include "../common/padded_plane.h"
+#include "../common/noise_estimate.h"
+#include "../common/image_quality.h"
+#include "../common/batch_runner.h"
 
+using namespace std;
 int clamp(int value, int min, int max) {
     return std::max(min, std::min(value, max));
 }
 
-void applyMedianFilter(const vector<vector<uint8_t>>& channel, vector<vector<uint8_t>>& output, int width, int height, int kernelSize) {
+// channel carries an apron of at least kernelSize / 2 pixels.
+void applyMedianFilter(const PaddedPlane& channel, PaddedPlane& output, int kernelSize) {
     int halfKernel = kernelSize / 2;
     vector<uint8_t> window;
 
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
+    for (int y = 0; y < channel.height; ++y) {
+        for (int x = 0; x < channel.width; ++x) {
             window.clear();
 
             // Collect pixels within the kernel
             for (int ky = -halfKernel; ky <= halfKernel; ++ky) {
+                const uint8_t* row = channel.row(y + ky) + x;
                 for (int kx = -halfKernel; kx <= halfKernel; ++kx) {
-                    int nx = clamp(x + kx, 0, width - 1);
-                    int ny = clamp(y + ky, 0, height - 1);
-                    window.push_back(channel[ny][nx]);
+                    window.push_back(row[kx]);
                 }
             }
 
             // Sort and pick the median value
             sort(window.begin(), window.end());
-            output[y][x] = window[window.size() / 2];
+            output.row(y)[x] = window[window.size() / 2];
         }
     }
 }
 
-void applyBilateralFilter(const std::vector<std::vector<uint8_t>>& channel,
-                          std::vector<std::vector<uint8_t>>& output,
-                          int width, int height,
+// Runs a filter written against planes on one channel of a view. The plane
+// gets an apron of `radius` replicated pixels: the view is either clipped at
+// the image edge (replicate border) or already holds the border pixels the
+// kept part of the result needs.
+void applyOnPlane(const ConstImageView& src, const ImageView& dst, int channel, int radius,
+                  const function<void(const PaddedPlane&, PaddedPlane&)>& filter) {
+    thread_local PaddedPlane plane, filtered;
+    plane.load(src, channel, radius, BorderMode::Replicate);
+    filtered.resize(src.width, src.height, 0);
+    filter(plane, filtered);
+    filtered.store(dst, channel);
+}
+
+// Same result as applyMedianFilter, but O(1) per pixel regardless of kernel
+// size. Works on one channel (0 = blue, 1 = green, 2 = red) of an interleaved
+// image, so the mapped input is read as is instead of being split into planes.
+void applyMedianFilterHistogram(const ConstImageView& src, const ImageView& dst, int channel, int kernelSize) {
+    medianFilterHistogram(src.data + channel, src.stride, dst.data + channel, dst.stride,
+                          src.width, src.height, kernelSize / 2, src.channels, dst.channels);
+}
+
+// Same result again, from sorting networks over blocks of pixels; 3x3 and
+// 5x5 only.
+void applyMedianFilterNetwork(const ConstImageView& src, const ImageView& dst, int channel, int kernelSize) {
+    medianFilterSmall(src.data + channel, src.stride, dst.data + channel, dst.stride,
+                      src.width, src.height, kernelSize / 2, src.channels, dst.channels);
+}
+
+void applyBilateralFilter(const PaddedPlane& channel,
+                          PaddedPlane& output,
                           int kernelSize,
                           float sigmaSpatial = 4,
                           float sigmaRange = 100) {
     int halfKernel = kernelSize / 2;
 
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
+    for (int y = 0; y < channel.height; ++y) {
+        for (int x = 0; x < channel.width; ++x) {
             float sum = 0.0f;
             float normFactor = 0.0f;
-            float centerIntensity = static_cast<float>(channel[y][x]);
+            float centerIntensity = static_cast<float>(channel.row(y)[x]);
 
             for (int ky = -halfKernel; ky <= halfKernel; ++ky) {
+                const uint8_t* row = channel.row(y + ky) + x;
                 for (int kx = -halfKernel; kx <= halfKernel; ++kx) {
-                    int nx = clamp(x + kx, 0, width - 1);
-                    int ny = clamp(y + ky, 0, height - 1);
-
-                    float neighborIntensity = static_cast<float>(channel[ny][nx]);
+                    float neighborIntensity = static_cast<float>(row[kx]);
 
                     float spatialDistance = kx * kx + ky * ky;
                     float spatialWeight = std::exp(-spatialDistance / (2 * sigmaSpatial * sigmaSpatial));
@@ -94,85 +111,107 @@ void applyBilateralFilter(const std::vector<std::vector<uint8_t>>& channel,
                 }
             }
 
-            output[y][x] = static_cast<uint8_t>(clamp(static_cast<int>(sum / normFactor + 0.5f), 0, 255));
+            output.row(y)[x] = static_cast<uint8_t>(clamp(static_cast<int>(sum / normFactor + 0.5f), 0, 255));
         }
     }
 }
 
-void applyGaussianFilter(const std::vector<std::vector<uint8_t>>& channel,
-                         std::vector<std::vector<uint8_t>>& output,
-                         int width, int height,
-                         const std::vector<std::vector<float>>& kernel) {
-    int kernelSize = kernel.size();
-    int halfKernel = kernelSize / 2;
+// Same result as applyBilateralFilter with the exponentials precomputed.
+void applyBilateralFilterLUT(const ConstImageView& src, const ImageView& dst, int channel,
+                             int kernelSize, float sigmaSpatial = 4, float sigmaRange = 100) {
+    bilateralFilterLUT(src.data + channel, src.stride, dst.data + channel, dst.stride, src.width, src.height,
+                       kernelSize, sigmaSpatial, sigmaRange, src.channels, dst.channels);
+}
 
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            float sum = 0.0f;
+// Bilateral grid approximation; the cost does not depend on the kernel size.
+void applyBilateralFilterGrid(const ConstImageView& src, const ImageView& dst, int channel,
+                              float sigmaSpatial = 4, float sigmaRange = 100) {
+    bilateralFilterGrid(src.data + channel, src.stride, dst.data + channel, dst.stride, src.width, src.height,
+                        sigmaSpatial, sigmaRange, src.channels, dst.channels);
+}
 
-            for (int ky = -halfKernel; ky <= halfKernel; ++ky) {
-                for (int kx = -halfKernel; kx <= halfKernel; ++kx) {
-                    int nx = clamp(x + kx, 0, width - 1);
-                    int ny = clamp(y + ky, 0, height - 1);
-                    float weight = kernel[ky + halfKernel][kx + halfKernel];
-                    sum += channel[ny][nx] * weight;
+struct FilterError {
+    long long count = 0;
+    double sumSquared = 0;
+    double sumAbsolute = 0;
+    int maxAbsolute = 0;
+
+    void add(const ConstImageView& approx, const ConstImageView& exact) {
+        for (int y = 0; y < exact.height; ++y) {
+            for (int x = 0; x < exact.width; ++x) {
+                for (int c = 0; c < 3; ++c) {
+                    int d = abs(approx.pixel(x, y)[c] - exact.pixel(x, y)[c]);
+                    sumSquared += d * d;
+                    sumAbsolute += d;
+                    maxAbsolute = max(maxAbsolute, d);
+                    ++count;
                 }
             }
-
-            output[y][x] = static_cast<uint8_t>(clamp(static_cast<int>(sum + 0.5f), 0, 255));
         }
     }
-}
 
-void applyMaxFilter(const vector<vector<uint8_t>>& channel, vector<vector<uint8_t>>& output, int width, int height, int kernelSize) {
+    void print(const string& label) const {
+        double mse = sumSquared / count;
+        cout << label << " vs exact: max abs " << maxAbsolute << ", mean abs " << fixed << setprecision(4)
+             << sumAbsolute / count << ", PSNR ";
+        if (mse == 0) cout << "inf";
+        else cout << setprecision(2) << 10 * log10(255.0 * 255.0 / mse) << " dB";
+        cout << endl;
+        cout.unsetf(ios::fixed);
+    }
+};
+
+void applyGaussianFilter2D(const PaddedPlane& channel,
+                           PaddedPlane& output,
+                           const std::vector<std::vector<float>>& kernel) {
+    int kernelSize = kernel.size();
     int halfKernel = kernelSize / 2;
-    vector<uint8_t> window;
 
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            window.clear();
+    for (int y = 0; y < channel.height; ++y) {
+        for (int x = 0; x < channel.width; ++x) {
+            float sum = 0.0f;
 
-            // Collect pixels within the kernel
             for (int ky = -halfKernel; ky <= halfKernel; ++ky) {
+                const uint8_t* row = channel.row(y + ky) + x;
+                const std::vector<float>& weights = kernel[ky + halfKernel];
                 for (int kx = -halfKernel; kx <= halfKernel; ++kx) {
-                    int nx = clamp(x + kx, 0, width - 1);
-                    int ny = clamp(y + ky, 0, height - 1);
-                    window.push_back(channel[ny][nx]);
+                    sum += row[kx] * weights[kx + halfKernel];
                 }
             }
 
-            // Sort and pick the median value
-            sort(window.begin(), window.end());
-            output[y][x] = window[window.size() - 1];
+            output.row(y)[x] = static_cast<uint8_t>(clamp(static_cast<int>(sum + 0.5f), 0, 255));
         }
     }
 }
 
-void applyMidpointFilter(const std::vector<std::vector<uint8_t>>& channel,
-                         std::vector<std::vector<uint8_t>>& output,
-                         int width, int height, int kernelSize) {
-    int halfKernel = kernelSize / 2;
+// Isotropic kernels are rank one, so they run as two 1D passes (O(2k) per
+// pixel) straight over one channel of the interleaved input. Returns false
+// for kernels that do not factor; callers then use applyGaussianFilter2D.
+bool applyGaussianFilter(const ConstImageView& src, const ImageView& dst, int channel,
+                         const std::vector<std::vector<float>>& kernel) {
+    std::vector<float> kernelX, kernelY;
+    if (!factorSeparable(kernel, kernelX, kernelY)) {
+        return false;
+    }
+    convolveSeparable(src.data + channel, src.stride, dst.data + channel, dst.stride, src.width, src.height,
+                      kernelX, kernelY, Rounding::Nearest, src.channels, dst.channels);
+    return true;
+}
 
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            uint8_t minVal = 255;
-            uint8_t maxVal = 0;
+void applyMaxFilter(const ConstImageView& src, const ImageView& dst, int channel, int kernelSize) {
+    maxFilterVHGW(src.data + channel, src.stride, dst.data + channel, dst.stride, src.width, src.height,
+                  kernelSize / 2, src.channels, dst.channels);
+}
 
-            // Collect pixels within the kernel
-            for (int ky = -halfKernel; ky <= halfKernel; ++ky) {
-                for (int kx = -halfKernel; kx <= halfKernel; ++kx) {
-                    int nx = clamp(x + kx, 0, width - 1);
-                    int ny = clamp(y + ky, 0, height - 1);
-                    uint8_t pixelValue = channel[ny][nx];
-                    minVal = std::min(minVal, pixelValue);
-                    maxVal = std::max(maxVal, pixelValue);
-                }
-            }
+void applyMinFilter(const ConstImageView& src, const ImageView& dst, int channel, int kernelSize) {
+    minFilterVHGW(src.data + channel, src.stride, dst.data + channel, dst.stride, src.width, src.height,
+                  kernelSize / 2, src.channels, dst.channels);
+}
 
-            // Compute the average of min and max values
-            output[y][x] = static_cast<uint8_t>((minVal + maxVal) / 2);
-        }
-    }
+// Min and max are found together in one van Herk / Gil-Werman pass.
+void applyMidpointFilter(const ConstImageView& src, const ImageView& dst, int channel, int kernelSize) {
+    midpointFilterVHGW(src.data + channel, src.stride, dst.data + channel, dst.stride, src.width, src.height,
+                       kernelSize / 2, src.channels, dst.channels);
 }
 
 void generateGaussianKernel(std::vector<std::vector<float>>& kernel, int kernelSize, float sigma) {
@@ -197,140 +236,851 @@ void generateGaussianKernel(std::vector<std::vector<float>>& kernel, int kernelS
     }
 }
 
-void readBMP(const string& filename, BMPHeader& header, BMPInfoHeader& infoHeader, 
-             vector<vector<uint8_t>>& red, 
-             vector<vector<uint8_t>>& green, 
-             vector<vector<uint8_t>>& blue) {
-    ifstream inFile(filename, ios::binary);
-    if (!inFile) {
-        cerr << "Error: Could not open input file." << endl;
-        exit(1);
+struct DenoiseOptions {
+    string mode;
+    int kernelSize = 3;
+    float sigma = 0;         // Gaussian sigma or bilateral sigmaSpatial; 0 for the mode's default
+    float sigmaRange = 100;  // bilateral only
+    string medianEngine = "auto";
+    string bilateralEngine = "lut";
+    bool reportError = false;
+    BorderMode border = BorderMode::Replicate;
+};
+
+float gaussianSigma(const DenoiseOptions& options) {
+    return options.sigma > 0 ? options.sigma : (options.kernelSize - 1) / 6.0f;
+}
+
+float spatialSigma(const DenoiseOptions& options) {
+    return options.sigma > 0 ? options.sigma : 4;
+}
+
+// The bilateral grid bins sigmaSpatial pixels per cell; it must be whole so
+// tiles can start on cell boundaries.
+int gridCell(const DenoiseOptions& options) {
+    return static_cast<int>(spatialSigma(options));
+}
+
+// Rows and columns of context a pixel's result depends on, i.e. the halo of a
+// tile or band.
+int denoiseHalo(const DenoiseOptions& options) {
+    if (options.mode == "bilateral" && options.bilateralEngine == "grid") {
+        // A pixel reads grid cells filled by pixels up to 2 cells of blur plus
+        // 1 of interpolation away, and the replicated pixels splatted at the
+        // edges of a tile reach ceil(2 * sigmaSpatial) further.
+        return 5 * gridCell(options);
+    }
+    return options.kernelSize / 2;
+}
+
+// Checks the options and resolves --median auto for the kernel size; prints
+// what is wrong and returns false otherwise.
+bool validateOptions(DenoiseOptions& options) {
+    const string modes[] = {"medium", "max", "min", "midpoint", "bilateral", "gaussian"};
+    if (find(begin(modes), end(modes), options.mode) == end(modes)) {
+        cerr << "Error: Invalid mode '" << options.mode << "'." << endl;
+        return false;
+    }
+    if (options.kernelSize % 2 == 0 || options.kernelSize < 3) {
+        cerr << "Error: Kernel size must be an odd integer >= 3." << endl;
+        return false;
+    }
+    // Sorting networks exist for 3x3 and 5x5; larger windows take the
+    // histogram filter, whose cost does not grow with the size.
+    bool smallMedian = options.kernelSize <= 5;
+    if (options.medianEngine == "auto") {
+        options.medianEngine = smallMedian ? "network" : "histogram";
+    }
+    if (options.medianEngine != "network" && options.medianEngine != "sort" && options.medianEngine != "histogram") {
+        cerr << "Error: Median engine must be 'auto', 'network', 'histogram' or 'sort'." << endl;
+        return false;
+    }
+    if (options.mode == "medium" && options.medianEngine == "network" && !smallMedian) {
+        cerr << "Error: The network median is only available for kernel sizes 3 and 5." << endl;
+        return false;
+    }
+    if (options.bilateralEngine != "exact" && options.bilateralEngine != "lut" && options.bilateralEngine != "grid") {
+        cerr << "Error: Bilateral engine must be 'exact', 'lut' or 'grid'." << endl;
+        return false;
+    }
+    if (options.mode == "bilateral" && options.bilateralEngine == "grid" &&
+        (spatialSigma(options) < 1 || spatialSigma(options) != gridCell(options))) {
+        cerr << "Error: The bilateral grid needs a whole spatial sigma of at least 1." << endl;
+        return false;
+    }
+    if (options.sigma < 0 || options.sigmaRange <= 0) {
+        cerr << "Error: Sigmas must be positive." << endl;
+        return false;
+    }
+    return true;
+}
+
+// Filters src into dst (same size, distinct buffers). Every mode runs one
+// colour channel at a time over tiles of the interleaved image on the pool;
+// the reference filters (sort median, exact bilateral, non-separable
+// Gaussian) get each tile as a plane. srcMargin as in filterTiles. Returns
+// false for an unknown mode.
+bool applyDenoise(const DenoiseOptions& options, const ConstImageView& src, const ImageView& dst,
+                  ThreadPool& pool, bool announce, int srcMargin = 0) {
+    const string& mode = options.mode;
+    const string& medianEngine = options.medianEngine;
+    const string& bilateralEngine = options.bilateralEngine;
+    int kernelSize = options.kernelSize;
+    int halo = denoiseHalo(options);
+    float sigmaSpatial = spatialSigma(options);
+    float sigmaRange = options.sigmaRange;
+
+    int exactSize = kernelSize;
+    auto exactBilateral = [&](const ConstImageView& s, const ImageView& d, int channel) {
+        applyOnPlane(s, d, channel, exactSize / 2, [&](const PaddedPlane& plane, PaddedPlane& out) {
+            applyBilateralFilter(plane, out, exactSize, sigmaSpatial, sigmaRange);
+        });
+    };
+
+    if (mode == "bilateral") {
+        if (bilateralEngine == "grid") {
+            filterTiles(pool, src, dst, 3, halo, [&](const ConstImageView& s, const ImageView& d, int channel) {
+                applyBilateralFilterGrid(s, d, channel, sigmaSpatial, sigmaRange);
+            }, gridCell(options), options.border, srcMargin);
+        } else if (bilateralEngine == "lut") {
+            filterTiles(pool, src, dst, 3, halo, [&](const ConstImageView& s, const ImageView& d, int channel) {
+                applyBilateralFilterLUT(s, d, channel, kernelSize, sigmaSpatial, sigmaRange);
+            }, 1, options.border, srcMargin);
+        } else {
+            filterTiles(pool, src, dst, 3, halo, exactBilateral, 1, options.border, srcMargin);
+        }
+        if (announce) cout << "Bilateral filter applied (" << bilateralEngine << ")" << endl;
+
+        if (options.reportError && bilateralEngine != "exact") {
+            // The grid has no window: it approximates the filter with an
+            // untruncated spatial Gaussian, so it is measured against the
+            // exact filter over 3 sigma each way rather than kernelSize.
+            string label = bilateralEngine;
+            if (bilateralEngine == "grid") {
+                exactSize = 2 * static_cast<int>(ceil(3 * sigmaSpatial)) + 1;
+                label = "grid (window " + to_string(exactSize) + ")";
+            }
+            vector<uint8_t> buffer(static_cast<size_t>(src.width) * src.height * src.channels);
+            ImageView exact;
+            exact.data = buffer.data();
+            exact.width = src.width;
+            exact.height = src.height;
+            exact.channels = src.channels;
+            exact.stride = static_cast<ptrdiff_t>(src.width) * src.channels;
+            filterTiles(pool, src, exact, 3, exactSize / 2, exactBilateral, 1, options.border, srcMargin);
+
+            FilterError error;
+            error.add(dst, exact);
+            error.print(label);
+        }
+    }
+    else if (mode == "medium") {
+        if (medianEngine == "network") {
+            filterTiles(pool, src, dst, 3, halo, [&](const ConstImageView& s, const ImageView& d, int channel) {
+                applyMedianFilterNetwork(s, d, channel, kernelSize);
+            }, 1, options.border, srcMargin);
+        } else if (medianEngine == "histogram") {
+            filterTiles(pool, src, dst, 3, halo, [&](const ConstImageView& s, const ImageView& d, int channel) {
+                applyMedianFilterHistogram(s, d, channel, kernelSize);
+            }, 1, options.border, srcMargin);
+        } else {
+            filterTiles(pool, src, dst, 3, halo, [&](const ConstImageView& s, const ImageView& d, int channel) {
+                applyOnPlane(s, d, channel, kernelSize / 2, [&](const PaddedPlane& plane, PaddedPlane& out) {
+                    applyMedianFilter(plane, out, kernelSize);
+                });
+            }, 1, options.border, srcMargin);
+        }
+        if (announce) cout << "Medium filter applied (" << medianEngine << ")" << endl;
+    } else if (mode == "max") {
+        filterTiles(pool, src, dst, 3, halo, [&](const ConstImageView& s, const ImageView& d, int channel) {
+            applyMaxFilter(s, d, channel, kernelSize);
+        }, 1, options.border, srcMargin);
+        if (announce) cout << "Max filter applied"<< endl;
+    } else if (mode == "min") {
+        filterTiles(pool, src, dst, 3, halo, [&](const ConstImageView& s, const ImageView& d, int channel) {
+            applyMinFilter(s, d, channel, kernelSize);
+        }, 1, options.border, srcMargin);
+        if (announce) cout << "Min filter applied"<< endl;
+    } else if (mode == "midpoint") {
+        filterTiles(pool, src, dst, 3, halo, [&](const ConstImageView& s, const ImageView& d, int channel) {
+            applyMidpointFilter(s, d, channel, kernelSize);
+        }, 1, options.border, srcMargin);
+        if (announce) cout << "Midpoint filter applied"<< endl;
+    } else if (mode == "gaussian") {
+        float sigma = gaussianSigma(options);
+        vector<vector<float>> kernel;
+        generateGaussianKernel(kernel, kernelSize, sigma);
+        filterTiles(pool, src, dst, 3, halo, [&](const ConstImageView& s, const ImageView& d, int channel) {
+            if (!applyGaussianFilter(s, d, channel, kernel)) {
+                applyOnPlane(s, d, channel, kernelSize / 2, [&](const PaddedPlane& plane, PaddedPlane& out) {
+                    applyGaussianFilter2D(plane, out, kernel);
+                });
+            }
+        }, 1, options.border, srcMargin);
+        if (announce) cout << "Gaussian filter applied"<< endl;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Scratch memory of applyDenoise for the streaming executor. The filters run
+// on tiles, so it does not grow with the image: one grown tile per thread.
+BandCost denoiseCost(const DenoiseOptions& options, const ThreadPool& pool) {
+    // Plane copies of the reference filters / van Herk row buffers by default.
+    size_t bytesPerPixel = 4;
+    size_t bytesPerColumn = 0;
+    BandCost cost;
+    if (options.mode == "medium" && options.medianEngine == "histogram") {
+        bytesPerPixel = 0;
+        bytesPerColumn = (16 + 256) * sizeof(uint16_t);
+    } else if (options.mode == "medium" && options.medianEngine == "network") {
+        bytesPerPixel = 0;
+        bytesPerColumn = options.kernelSize;
+    } else if (options.mode == "gaussian") {
+        bytesPerPixel = 0;
+        bytesPerColumn = (options.kernelSize + 2) * sizeof(float);
+    } else if (options.mode == "bilateral" && options.bilateralEngine == "grid") {
+        // (value, weight) cells of cell^2 pixels, twice for the blur.
+        int cell = gridCell(options);
+        bytesPerPixel = 2 * 2 * sizeof(float) * (static_cast<int>(255 / options.sigmaRange) + 6) / (cell * cell) + 1;
+        cost.rowAlign = cell;
+    }
+    cost.bytesFixed = pool.size() * tileScratchBytes(denoiseHalo(options), 4, bytesPerPixel, bytesPerColumn);
+    return cost;
+}
+
+// Resolves mode auto from a noise estimate of the input. Impulse noise takes
+// the median, larger the more pixels are hit, which the impulse count
+// itself cannot tell beyond a point (impulses next to each other are not
+// counted) but the noise sigma the impulses cause can. Otherwise the
+// bilateral filter
+// with a range sigma of 2 to 3 times the noise sigma, so edges well above the
+// noise survive, and a wider spatial sigma once the noise is strong. The
+// thresholds are the best SSIM against the clean originals of input3, input4
+// and of input4 with synthetic noise added.
+// The choice is described on out.
+void chooseDenoise(const ConstImageView& input, NoiseEstimator estimator, ThreadPool& pool, DenoiseOptions& options,
+                   ostream& out) {
+    NoiseEstimate estimate = estimateNoise(input, estimator, &pool);
+    double sigma = estimate.meanSigma();
+    double impulses = estimate.meanImpulseFraction();
+
+    if (impulses >= 0.01) {
+        options.mode = "medium";
+        options.kernelSize = sigma < 50 ? 3 : (sigma < 85 ? 5 : 7);
+    } else {
+        options.mode = "bilateral";
+        options.sigma = sigma < 7 ? 1 : 2;
+        options.kernelSize = 4 * static_cast<int>(options.sigma) + 1;
+        options.sigmaRange = static_cast<float>(max(sigma, 0.5) * (sigma < 15 ? 2 : 3));
+    }
+    out << "Estimated noise sigma " << fixed << setprecision(2) << sigma << ", impulse pixels "
+        << setprecision(4) << impulses << ": " << options.mode << " " << options.kernelSize;
+    if (options.mode == "bilateral") {
+        out << " (sigma " << setprecision(0) << options.sigma << ", range " << setprecision(1) << options.sigmaRange << ")";
+    }
+    out << defaultfloat << setprecision(6);
+}
+
+bool chooseDenoise(const string& inputFileName, NoiseEstimator estimator, ThreadPool& pool, DenoiseOptions& options) {
+    MappedBMP input;
+    if (!mapBMP(inputFileName, input)) {
+        return false;
+    }
+    chooseDenoise(input.view(), estimator, pool, options, cout);
+    cout << endl;
+    return true;
+}
+
+// One output of multi mode.
+struct DenoiseSpec {
+    DenoiseOptions options;
+    string outputFileName;
+};
+
+// A number filling all of text; stoi and stof alone stop at the first
+// character that does not fit, so "7,2" would read as 7.
+template <typename T>
+bool parseNumber(const string& text, T& value) {
+    size_t used = 0;
+    try {
+        if (is_integral<T>::value) value = static_cast<T>(stoi(text, &used));
+        else value = static_cast<T>(stof(text, &used));
+    } catch (const exception&) {
+        return false;
+    }
+    return used == text.size();
+}
+
+// "<mode>,<kernel_size>[,<sigma>[,<sigma_range>]],<output.bmp>" of multi mode;
+// the options not named in it are taken from defaults.
+bool parseSpec(const string& text, const DenoiseOptions& defaults, DenoiseSpec& spec) {
+    vector<string> fields;
+    size_t start = 0;
+    for (size_t comma; (comma = text.find(',', start)) != string::npos; start = comma + 1) {
+        fields.push_back(text.substr(start, comma - start));
+    }
+    fields.push_back(text.substr(start));
+    if (fields.size() < 3 || fields.size() > 5) {
+        return false;
+    }
+    for (const string& field : fields) {
+        if (field.empty()) return false;
+    }
+    spec.options = defaults;
+    spec.options.mode = fields[0];
+    spec.outputFileName = fields.back();
+    return parseNumber(fields[1], spec.options.kernelSize) &&
+           (fields.size() < 4 || parseNumber(fields[2], spec.options.sigma)) &&
+           (fields.size() < 5 || parseNumber(fields[3], spec.options.sigmaRange));
+}
+
+// Runs every spec over one mapping of the input, writing one file each. The
+// specs run at once on the pool, their tiles interleaved, so a filter that
+// has too few tiles to fill every thread still keeps the pool busy. With a
+// border other than replicate, the input is border-extended once for all of
+// them instead of once per edge tile and spec.
+bool denoiseAll(const string& inputFileName, const vector<DenoiseSpec>& specs, ThreadPool& pool) {
+    MappedBMP input;
+    if (!mapBMP(inputFileName, input)) {
+        return false;
+    }
+
+    ConstImageView src = input.view();
+    BorderedImage bordered;
+    BorderMode border = specs[0].options.border;
+    if (border != BorderMode::Replicate) {
+        int margin = 0;
+        for (const DenoiseSpec& spec : specs) {
+            int align = spec.options.mode == "bilateral" && spec.options.bilateralEngine == "grid" ? gridCell(spec.options) : 1;
+            margin = max(margin, (denoiseHalo(spec.options) + align - 1) / align * align);
+        }
+        borderImage(src, margin, border, bordered);
+        src = bordered.view;
+    }
+
+    vector<char> written(specs.size());
+    pool.parallelFor(static_cast<int>(specs.size()), [&](int i) {
+        BMPImage image = copyBMP(input);
+        applyDenoise(specs[i].options, src, image.view(), pool, false, bordered.margin);
+        written[i] = writeBMP(specs[i].outputFileName, image);
+    });
+
+    bool ok = true;
+    for (size_t i = 0; i < specs.size(); ++i) {
+        const DenoiseOptions& options = specs[i].options;
+        if (!written[i]) {
+            ok = false;
+            continue;
+        }
+        cout << options.mode << " " << options.kernelSize;
+        if (options.mode == "medium") cout << " (" << options.medianEngine << ")";
+        if (options.mode == "bilateral") {
+            cout << " (" << options.bilateralEngine << ", sigma " << spatialSigma(options) << ", range " << options.sigmaRange << ")";
+        }
+        if (options.mode == "gaussian") cout << " (sigma " << gaussianSigma(options) << ")";
+        cout << ": output saved as '" << specs[i].outputFileName << "'." << endl;
+    }
+    return ok;
+}
+
+// What sweep mode tries and where the best result goes.
+struct SweepOptions {
+    vector<string> modes = {"medium", "max", "gaussian"};
+    vector<int> sizes;               // ascending, odd
+    vector<float> sigmas;            // Gaussian / bilateral spatial; empty for the mode's default
+    vector<float> sigmaRanges;       // bilateral; empty for the default
+    string bestFileName;
+};
+
+// The comma-separated fields of text, each a number as parseNumber takes it.
+template <typename T>
+bool parseList(const string& text, vector<T>& values) {
+    values.clear();
+    for (size_t start = 0; start <= text.size();) {
+        size_t comma = min(text.find(',', start), text.size());
+        T value;
+        if (!parseNumber(text.substr(start, comma - start), value)) return false;
+        values.push_back(value);
+        start = comma + 1;
     }
+    return true;
+}
 
-    inFile.read(reinterpret_cast<char*>(&header), sizeof(header));
-    inFile.read(reinterpret_cast<char*>(&infoHeader), sizeof(infoHeader));
+// "3-21" (every odd size in between) or "3,7,11".
+bool parseSizes(const string& text, vector<int>& sizes) {
+    sizes.clear();
+    size_t dash = text.find('-');
+    if (dash != string::npos) {
+        int first, last;
+        if (!parseNumber(text.substr(0, dash), first) || !parseNumber(text.substr(dash + 1), last)) return false;
+        for (int k = first | 1; k <= last; k += 2) sizes.push_back(k);
+    } else if (!parseList(text, sizes)) {
+        return false;
+    }
+    sort(sizes.begin(), sizes.end());
+    sizes.erase(unique(sizes.begin(), sizes.end()), sizes.end());
+    for (int k : sizes) {
+        if (k % 2 == 0 || k < 3) return false;
+    }
+    return !sizes.empty();
+}
 
-    if (header.fileType != 0x4D42 || infoHeader.bitCount != 24) {
-        cerr << "Error: Only 24-bit BMP format is supported." << endl;
-        exit(1);
+bool parseValues(const string& text, vector<float>& values) {
+    if (!parseList(text, values)) return false;
+    for (float v : values) {
+        if (v <= 0) return false;
     }
+    return true;
+}
 
-    int width = infoHeader.width;
-    int height = infoHeader.height;
-    int padding = (4 - (width * 3) % 4) % 4;
+// Scores candidates against the reference as they come and keeps the best.
+class SweepScorer {
+public:
+    SweepScorer(const MappedBMP& input, const MappedBMP& reference, ThreadPool& pool)
+        : pool(pool), candidate(copyBMP(input)) {
+        loadLuma(reference.view(), referenceLuma);
+    }
 
-    red.resize(height, vector<uint8_t>(width));
-    green.resize(height, vector<uint8_t>(width));
-    blue.resize(height, vector<uint8_t>(width));
+    // The candidate image the filters write into before score().
+    ImageView view() { return candidate.view(); }
 
-    inFile.seekg(header.offsetData, ios::beg);
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            uint8_t pixel[3];
-            inFile.read(reinterpret_cast<char*>(pixel), 3);
-            blue[y][x] = pixel[0];
-            green[y][x] = pixel[1];
-            red[y][x] = pixel[2];
+    void score(const string& description) {
+        MetricPlane luma;
+        loadLuma(candidate.view(), luma);
+        QualityScores scores = measureQuality(referenceLuma, luma, MetricSsim | MetricPsnr, SsimOptions(), &pool);
+        cout << left << setw(36) << description << right << fixed << "SSIM " << setprecision(6) << scores.ssim
+             << "  PSNR " << setprecision(3) << scores.psnr << " dB" << defaultfloat << setprecision(6) << endl;
+        if (!(scores.ssim <= bestSsim)) {
+            bestSsim = scores.ssim;
+            bestDescription = description;
+            best = candidate;
         }
-        inFile.ignore(padding);
     }
-    inFile.close();
+
+    double bestSsim = -2;
+    string bestDescription;
+    BMPImage best;
+
+private:
+    ThreadPool& pool;
+    BMPImage candidate;
+    MetricPlane referenceLuma;
+};
+
+string describe(const string& mode, int kernelSize, float sigma = 0, float sigmaRange = 0) {
+    ostringstream text;
+    text << mode << " " << kernelSize;
+    if (mode == "gaussian") text << " (sigma " << setprecision(3) << sigma << ")";
+    if (mode == "bilateral") text << " (sigma " << setprecision(3) << sigma << ", range " << sigmaRange << ")";
+    return text.str();
+}
+
+// Every size as a run of its own, written into the candidate and scored
+// before the next one starts, so only the candidate and the best result are
+// held. Sizes 3 and 5 take the sorting networks and larger ones the
+// histogram filter, whose cost per pixel does not depend on the size, so
+// there is no work to carry from one size to the next.
+void sweepMedian(const ConstImageView& src, const vector<int>& sizes, const DenoiseOptions& defaults,
+                 SweepScorer& scorer, ThreadPool& pool) {
+    for (int k : sizes) {
+        DenoiseOptions options = defaults;
+        options.mode = "medium";
+        options.kernelSize = k;
+        options.medianEngine = k <= 5 ? "network" : "histogram";
+        applyDenoise(options, src, scorer.view(), pool, false);
+        scorer.score(describe("medium", k));
+    }
+}
+
+// max, min and midpoint: the first size by van Herk / Gil-Werman, each next
+// one by growRadius steps from the previous.
+template <typename Op>
+void sweepMorphology(const string& mode, const ConstImageView& src, const vector<int>& sizes, SweepScorer& scorer,
+                     ThreadPool& pool) {
+    using T = typename Op::T;
+    const size_t area = static_cast<size_t>(src.width) * src.height;
+    vector<vector<T>> planes(3, vector<T>(area)), scratch(3, vector<T>(area));
+    for (size_t i = 0; i < sizes.size(); ++i) {
+        ImageView view = scorer.view();
+        pool.parallelFor(3, [&](int channel) {
+            if (i == 0) {
+                vhgw::filter2D<Op>(src.data + channel, src.stride, src.channels, planes[channel].data(), src.width,
+                                   src.height, sizes[0] / 2);
+            } else {
+                for (int radius = sizes[i - 1] / 2; radius < sizes[i] / 2; ++radius) {
+                    vhgw::growRadius<Op>(planes[channel].data(), scratch[channel].data(), src.width, src.height);
+                    swap(planes[channel], scratch[channel]);
+                }
+            }
+            for (int y = 0; y < src.height; ++y) {
+                const T* in = &planes[channel][static_cast<size_t>(y) * src.width];
+                uint8_t* out = view.row(y) + channel;
+                for (int x = 0; x < src.width; ++x) {
+                    if constexpr (is_same<T, uint8_t>::value) out[x * view.channels] = in[x];
+                    else out[x * view.channels] = static_cast<uint8_t>((in[x].lo + in[x].hi) / 2);
+                }
+            }
+        });
+        scorer.score(describe(mode, sizes[i]));
+    }
 }
 
-void writeBMP(const string& filename, const BMPHeader& header, const BMPInfoHeader& infoHeader, 
-              const vector<vector<uint8_t>>& red, 
-              const vector<vector<uint8_t>>& green, 
-              const vector<vector<uint8_t>>& blue) {
-    ofstream outFile(filename, ios::binary);
-    if (!outFile) {
-        cerr << "Error: Could not open output file." << endl;
-        exit(1);
+// Gaussians in ascending sigma, each the previous one blurred by the
+// Gaussian of the sigma missing, in float, with that kernel truncated at
+// 3 sigma like the default (k - 1) / 6. Sampled Gaussians only compose like
+// this once the missing sigma is about 1 or more, so smaller steps (sizes up
+// to 9, going up by 2) are filtered from the input again instead.
+void sweepGaussian(const ConstImageView& src, vector<pair<float, int>> candidates, SweepScorer& scorer,
+                   ThreadPool& pool) {
+    sort(candidates.begin(), candidates.end());
+    const size_t area = static_cast<size_t>(src.width) * src.height;
+    vector<vector<float>> planes(3, vector<float>(area));
+    for (size_t i = 0; i < candidates.size(); ++i) {
+        ImageView view = scorer.view();
+        pool.parallelFor(3, [&](int channel) {
+            vector<float>& plane = planes[channel];
+            vector<float> kernel;
+            float sigma = candidates[i].first;
+            float step = i == 0 ? 0.0f : sqrt(max(0.0f, sigma * sigma - candidates[i - 1].first * candidates[i - 1].first));
+            if (i == 0 || (step > 0 && step < 1)) {
+                for (int y = 0; y < src.height; ++y) {
+                    const uint8_t* in = src.row(y) + channel;
+                    for (int x = 0; x < src.width; ++x) plane[static_cast<size_t>(y) * src.width + x] = in[x * src.channels];
+                }
+                kernel = generateGaussianKernel1D(candidates[i].second, sigma);
+            } else if (step > 0) {
+                kernel = generateGaussianKernel1D(2 * static_cast<int>(ceil(3 * step)) + 1, step);
+            }
+            if (!kernel.empty()) convolveSeparableFloat(plane.data(), plane.data(), src.width, src.height, kernel);
+            for (int y = 0; y < src.height; ++y) {
+                const float* in = &plane[static_cast<size_t>(y) * src.width];
+                uint8_t* out = view.row(y) + channel;
+                for (int x = 0; x < src.width; ++x) out[x * view.channels] = separable::toByte(in[x], Rounding::Nearest);
+            }
+        });
+        scorer.score(describe("gaussian", candidates[i].second, candidates[i].first));
     }
+}
 
-    outFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
-    outFile.write(reinterpret_cast<const char*>(&infoHeader), sizeof(infoHeader));
+// Runs every mode over every size (and sigma) on one mapping of the input,
+// scores each result by SSIM and PSNR of the luma against the reference, and
+// reports (and with bestFileName writes) the best.
+bool runSweep(const string& inputFileName, const string& referenceFileName, const SweepOptions& sweep,
+              const DenoiseOptions& defaults, ThreadPool& pool) {
+    MappedBMP input, reference;
+    if (!mapBMP(inputFileName, input) || !mapBMP(referenceFileName, reference)) {
+        return false;
+    }
+    ConstImageView src = input.view();
+    if (src.width != reference.view().width || src.height != reference.view().height) {
+        cerr << "Error: The input and the reference differ in size." << endl;
+        return false;
+    }
 
-    int width = infoHeader.width;
-    int height = infoHeader.height;
-    int padding = (4 - (width * 3) % 4) % 4;
+    SweepScorer scorer(input, reference, pool);
+    for (const string& mode : sweep.modes) {
+        if (mode == "medium") {
+            sweepMedian(src, sweep.sizes, defaults, scorer, pool);
+        } else if (mode == "max") {
+            sweepMorphology<vhgw::MaxOp>(mode, src, sweep.sizes, scorer, pool);
+        } else if (mode == "min") {
+            sweepMorphology<vhgw::MinOp>(mode, src, sweep.sizes, scorer, pool);
+        } else if (mode == "midpoint") {
+            sweepMorphology<vhgw::MinMaxOp>(mode, src, sweep.sizes, scorer, pool);
+        } else if (mode == "gaussian") {
+            // Each size at its default sigma, or each sigma given at the
+            // size that holds 3 sigma.
+            vector<pair<float, int>> candidates;
+            for (int k : sweep.sizes) {
+                if (sweep.sigmas.empty()) candidates.emplace_back((k - 1) / 6.0f, k);
+            }
+            for (float sigma : sweep.sigmas) candidates.emplace_back(sigma, 2 * static_cast<int>(ceil(3 * sigma)) + 1);
+            sweepGaussian(src, candidates, scorer, pool);
+        } else {
+            // The bilateral filter shares no work between settings; every
+            // candidate is a run of its own.
+            DenoiseOptions options = defaults;
+            options.mode = mode;
+            vector<float> sigmas = sweep.sigmas.empty() ? vector<float>{spatialSigma(options)} : sweep.sigmas;
+            vector<float> ranges = sweep.sigmaRanges.empty() ? vector<float>{options.sigmaRange} : sweep.sigmaRanges;
+            for (int k : sweep.sizes) {
+                for (float sigma : sigmas) {
+                    for (float range : ranges) {
+                        options.kernelSize = k;
+                        options.sigma = sigma;
+                        options.sigmaRange = range;
+                        if (!validateOptions(options)) return false;
+                        applyDenoise(options, src, scorer.view(), pool, false);
+                        scorer.score(describe(mode, k, sigma, range));
+                    }
+                }
+            }
+        }
+    }
 
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            uint8_t pixel[3] = {blue[y][x], green[y][x], red[y][x]};
-            outFile.write(reinterpret_cast<char*>(pixel), 3);
+    cout << "Best: " << scorer.bestDescription << ", SSIM " << fixed << setprecision(6) << scorer.bestSsim << endl;
+    if (!sweep.bestFileName.empty()) {
+        if (!writeBMP(sweep.bestFileName, scorer.best)) {
+            return false;
         }
-        outFile.write("\0\0\0", padding);
+        cout << "Output saved as '" << sweep.bestFileName << "'." << endl;
     }
-    outFile.close();
+    return true;
+}
+
+// Filters every image of a batch with one mode, or with auto the mode chosen
+// for each image from its own noise estimate.
+bool denoiseBatch(const string& source, const string& outputDir, const DenoiseOptions& options, NoiseEstimator estimator,
+                  ThreadPool& pool, const BatchOptions& batchOptions) {
+    return runBatchTool(source, outputDir, pool, batchOptions, [&](BMPImage& image, const BatchJob&, string& note) {
+        DenoiseOptions imageOptions = options;
+        if (options.mode == "auto") {
+            ostringstream choice;
+            chooseDenoise(image.view(), estimator, pool, imageOptions, choice);
+            note = choice.str();
+            if (!validateOptions(imageOptions)) {
+                return false;
+            }
+        }
+        BMPImage output = image;
+        applyDenoise(imageOptions, image.view(), output.view(), pool, false);
+        image = std::move(output);
+        return true;
+    });
 }
 
 int main(int argc, char* argv[]) {
-    if (argc < 5) {
-        cerr << "Usage: " << argv[0] << " <mode> <input.bmp> <output.bmp> <kernel_size>" << endl;
+    // Batch mode takes a source and an output directory in place of the two
+    // file names; with the flag taken out, the rest parses as usual.
+    vector<char*> args(argv, argv + argc);
+    bool batch = argc >= 3 && string(argv[2]) == "--batch";
+    if (batch) {
+        args.erase(args.begin() + 2);
+        argc = static_cast<int>(args.size());
+        argv = args.data();
+    }
+    if (argc < 4 || (string(argv[1]) != "multi" && string(argv[1]) != "auto" && string(argv[1]) != "sweep" && argc < 5)) {
+        cerr << "Usage: " << argv[0] << " <mode> <input.bmp> <output.bmp> <kernel_size> [--median auto|network|histogram|sort] [--bilateral exact|lut|grid] [--report-error] [--border replicate|reflect|constant] [--memory-budget <MB>] [--threads N]" << endl;
+        cerr << "       (--bilateral grid ignores <kernel_size>: it approximates the filter with an untruncated spatial Gaussian.)" << endl;
+        cerr << "       " << argv[0] << " auto <input.bmp> <output.bmp> [--noise wavelet|laplacian] [options]" << endl;
+        cerr << "       " << argv[0] << " sweep <input.bmp> <reference.bmp> [--modes medium,max,gaussian] [--sizes 3-21] [--sigmas <s>,...] [--ranges <r>,...] [--save-best <output.bmp>] [--threads N]" << endl;
+        cerr << "       " << argv[0] << " multi <input.bmp> <mode>,<kernel_size>[,<sigma>[,<sigma_range>]],<output.bmp> ... [--median ...] [--bilateral ...] [--border ...] [--threads N]" << endl;
+        cerr << "       " << argv[0] << " <mode>|auto --batch <input dir|manifest> <output dir> [<kernel_size>] [options] [--in-flight <MB>]" << endl;
+        return 1;
+    }
+    if (batch && (string(argv[1]) == "multi" || string(argv[1]) == "sweep")) {
+        cerr << "Error: --batch takes a single mode or auto." << endl;
         return 1;
     }
 
-    string mode = argv[1];
+    // Multi mode lists its specs up to the first option; otherwise the one
+    // spec is the mode, output and kernel size (none for auto, which picks it),
+    // taken from the arguments as they are.
+    bool multi = string(argv[1]) == "multi";
+    bool sweepMode = string(argv[1]) == "sweep";
     string inputFileName = argv[2];
-    string outputFileName = argv[3];
-    int kernelSize = stoi(argv[4]);
+    vector<string> specTexts;
+    int firstOption = 3;
+    if (multi) {
+        while (firstOption < argc && string(argv[firstOption]).rfind("--", 0) != 0) {
+            specTexts.push_back(argv[firstOption++]);
+        }
+        if (specTexts.empty()) {
+            cerr << "Error: multi needs at least one <mode>,<kernel_size>,<output.bmp> spec." << endl;
+            return 1;
+        }
+    } else if (sweepMode) {
+        firstOption = 4;
+    } else {
+        firstOption = string(argv[1]) == "auto" ? 4 : 5;
+    }
 
-    if (kernelSize % 2 == 0 || kernelSize < 3) {
-        cerr << "Error: Kernel size must be an odd integer >= 3." << endl;
+    DenoiseOptions defaults;
+    double memoryBudgetMB = 0;
+    int threads = 0;
+    string borderName = "replicate";
+    string noiseMethod = "wavelet";
+    SweepOptions sweep;
+    BatchOptions batchOptions;
+    string modeList = "medium,max,gaussian";
+    string sizeList = "3-21";
+    string sigmaList, rangeList;
+    for (int i = firstOption; i < argc; i++) {
+        if (string(argv[i]) == "--median" && i + 1 < argc) {
+            defaults.medianEngine = argv[i + 1];
+            i++;
+        } else if (string(argv[i]) == "--bilateral" && i + 1 < argc) {
+            defaults.bilateralEngine = argv[i + 1];
+            i++;
+        } else if (string(argv[i]) == "--report-error") {
+            defaults.reportError = true;
+        } else if (string(argv[i]) == "--border" && i + 1 < argc) {
+            borderName = argv[i + 1];
+            i++;
+        } else if (string(argv[i]) == "--memory-budget" && i + 1 < argc) {
+            memoryBudgetMB = stod(argv[i + 1]);
+            i++;
+        } else if (string(argv[i]) == "--threads" && i + 1 < argc) {
+            threads = stoi(argv[i + 1]);
+            i++;
+        } else if (string(argv[i]) == "--noise" && i + 1 < argc) {
+            noiseMethod = argv[i + 1];
+            i++;
+        } else if (string(argv[i]) == "--modes" && i + 1 < argc) {
+            modeList = argv[i + 1];
+            i++;
+        } else if (string(argv[i]) == "--sizes" && i + 1 < argc) {
+            sizeList = argv[i + 1];
+            i++;
+        } else if (string(argv[i]) == "--sigmas" && i + 1 < argc) {
+            sigmaList = argv[i + 1];
+            i++;
+        } else if (string(argv[i]) == "--ranges" && i + 1 < argc) {
+            rangeList = argv[i + 1];
+            i++;
+        } else if (string(argv[i]) == "--save-best" && i + 1 < argc) {
+            sweep.bestFileName = argv[i + 1];
+            i++;
+        } else if (string(argv[i]) == "--in-flight" && i + 1 < argc) {
+            batchOptions.memoryBudget = static_cast<size_t>(stod(argv[i + 1]) * (1 << 20));
+            i++;
+        }
+    }
+    if (!parseBorderMode(borderName, defaults.border)) {
+        cerr << "Error: Border mode must be 'replicate', 'reflect' or 'constant'." << endl;
         return 1;
     }
+    if (noiseMethod != "wavelet" && noiseMethod != "laplacian") {
+        cerr << "Error: Noise estimator must be 'wavelet' or 'laplacian'." << endl;
+        return 1;
+    }
+    NoiseEstimator estimator = noiseMethod == "wavelet" ? NoiseEstimator::Wavelet : NoiseEstimator::Laplacian;
+    // 0 (the default) uses every hardware thread.
+    ThreadPool pool(threads);
 
-    BMPHeader header;
-    BMPInfoHeader infoHeader;
-    vector<vector<uint8_t>> red, green, blue;
+    vector<DenoiseSpec> specs(specTexts.size());
+    for (size_t i = 0; i < specTexts.size(); ++i) {
+        if (!parseSpec(specTexts[i], defaults, specs[i])) {
+            cerr << "Error: Cannot parse '" << specTexts[i] << "'; expected <mode>,<kernel_size>[,<sigma>[,<sigma_range>]],<output.bmp>." << endl;
+            return 1;
+        }
+    }
+    if (!multi && !sweepMode) {
+        DenoiseSpec spec;
+        spec.options = defaults;
+        spec.options.mode = argv[1];
+        spec.outputFileName = argv[3];
+        if (spec.options.mode != "auto" && !parseNumber(string(argv[4]), spec.options.kernelSize)) {
+            cerr << "Error: Kernel size must be an odd integer >= 3." << endl;
+            return 1;
+        }
+        specs.push_back(spec);
+    }
+    for (size_t i = 0; i < specs.size(); ++i) {
+        // A batch picks the mode of auto per image.
+        if (batch && specs[i].options.mode == "auto") {
+            continue;
+        }
+        if (!multi && specs[i].options.mode == "auto" &&
+            !chooseDenoise(inputFileName, estimator, pool, specs[i].options)) {
+            return 1;
+        }
+        if (!validateOptions(specs[i].options)) {
+            return 1;
+        }
+    }
+
+    if (sweepMode) {
+        sweep.modes.clear();
+        for (size_t start = 0; start <= modeList.size();) {
+            size_t comma = min(modeList.find(',', start), modeList.size());
+            sweep.modes.push_back(modeList.substr(start, comma - start));
+            start = comma + 1;
+        }
+        const string modes[] = {"medium", "max", "min", "midpoint", "bilateral", "gaussian"};
+        for (const string& mode : sweep.modes) {
+            if (find(begin(modes), end(modes), mode) == end(modes)) {
+                cerr << "Error: Invalid mode '" << mode << "'." << endl;
+                return 1;
+            }
+        }
+        if (!parseSizes(sizeList, sweep.sizes)) {
+            cerr << "Error: Sizes must be odd integers >= 3, as '3-21' or '3,5,9'." << endl;
+            return 1;
+        }
+        if ((!sigmaList.empty() && !parseValues(sigmaList, sweep.sigmas)) ||
+            (!rangeList.empty() && !parseValues(rangeList, sweep.sigmaRanges))) {
+            cerr << "Error: Sigmas must be positive numbers separated by commas." << endl;
+            return 1;
+        }
+        if (defaults.border != BorderMode::Replicate || memoryBudgetMB > 0 || defaults.reportError) {
+            cerr << "Error: sweep takes neither --border, --memory-budget nor --report-error." << endl;
+            return 1;
+        }
+        return runSweep(inputFileName, argv[3], sweep, defaults, pool) ? 0 : 1;
+    }
 
-    readBMP(inputFileName, header, infoHeader, red, green, blue);
+    if (multi) {
+        if (memoryBudgetMB > 0 || defaults.reportError) {
+            cerr << "Error: --memory-budget and --report-error take a single mode." << endl;
+            return 1;
+        }
+        return denoiseAll(inputFileName, specs, pool) ? 0 : 1;
+    }
 
-    int width = infoHeader.width;
-    int height = infoHeader.height;
+    DenoiseOptions& options = specs[0].options;
+    if (batch) {
+        if (memoryBudgetMB > 0 || options.reportError) {
+            cerr << "Error: --batch takes neither --memory-budget nor --report-error; use --in-flight to bound a batch." << endl;
+            return 1;
+        }
+        return denoiseBatch(inputFileName, specs[0].outputFileName, options, estimator, pool, batchOptions) ? 0 : 1;
+    }
 
-    vector<vector<uint8_t>> redFiltered(height, vector<uint8_t>(width));
-    vector<vector<uint8_t>> greenFiltered(height, vector<uint8_t>(width));
-    vector<vector<uint8_t>> blueFiltered(height, vector<uint8_t>(width));
+    if (memoryBudgetMB > 0) {
+        // Out-of-core: filter the file band by band within the budget.
+        if (options.reportError) {
+            cerr << "Error: --report-error is not available with --memory-budget." << endl;
+            return 1;
+        }
+        bool first = true;
+        bool valid = true;
+        int bandRows = 0;
+        bool ok = streamBMP(inputFileName, specs[0].outputFileName, denoiseHalo(options),
+                            static_cast<size_t>(memoryBudgetMB * (1 << 20)), denoiseCost(options, pool),
+                            [&](const ConstImageView& input, const ImageView& output) {
+                                if (valid) valid = applyDenoise(options, input, output, pool, first);
+                                first = false;
+                            }, &bandRows);
+        if (!valid) {
+            cerr << "Error: Invalid mode." << endl;
+            return 1;
+        }
+        if (!ok) {
+            return 1;
+        }
+        cout << "Streamed in bands of " << bandRows << " rows." << endl;
+        cout << "Output saved as '" << specs[0].outputFileName << "'." << endl;
+        return 0;
+    }
 
-    float sigmaSpatial = 200;
-    float sigmaRange = 200;
-    if (mode == "bilateral") {
-        applyBilateralFilter(red, redFiltered, width, height, kernelSize);
-        applyBilateralFilter(green, greenFiltered, width, height, kernelSize);
-        applyBilateralFilter(blue, blueFiltered, width, height, kernelSize);
-        cout << "Bilateral filter applied"<< endl;
+    MappedBMP input;
+    if (!mapBMP(inputFileName, input)) {
+        return 1;
     }
-    else if (mode == "medium") {
-        applyMedianFilter(red, redFiltered, width, height, kernelSize);
-        applyMedianFilter(green, greenFiltered, width, height, kernelSize);
-        applyMedianFilter(blue, blueFiltered, width, height, kernelSize);
-        cout << "Medium filter applied"<< endl;
-    } else if (mode == "max") {
-        applyMaxFilter(red, redFiltered, width, height, kernelSize);
-        applyMaxFilter(green, greenFiltered, width, height, kernelSize);
-        applyMaxFilter(blue, blueFiltered, width, height, kernelSize);
-        cout << "Max filter applied"<< endl;
-    } else if (mode == "midpoint") {
-        applyMidpointFilter(red, redFiltered, width, height, kernelSize);
-        applyMidpointFilter(green, greenFiltered, width, height, kernelSize);
-        applyMidpointFilter(blue, blueFiltered, width, height, kernelSize);
-        cout << "Midpoint filter applied"<< endl;
-    } else if (mode == "gaussian") {
-        float sigma = (kernelSize-1) / 6.;
-        vector<vector<float>> kernel;
-        generateGaussianKernel(kernel, kernelSize, sigma);
-        applyGaussianFilter(red, redFiltered, width, height, kernel);
-        applyGaussianFilter(green, greenFiltered, width, height, kernel);
-        applyGaussianFilter(blue, blueFiltered, width, height, kernel);
-        cout << "Gaussian filter applied"<< endl;
-    } else {
+    BMPImage image = copyBMP(input);
+
+    if (!applyDenoise(options, input.view(), image.view(), pool, true)) {
         cerr << "Error: Invalid mode." << endl;
         return 1;
     }
-    
-    writeBMP(outputFileName, header, infoHeader, redFiltered, greenFiltered, blueFiltered);
 
-    cout << "Output saved as '" << outputFileName << "'." << endl;
+    if (!writeBMP(specs[0].outputFileName, image)) {
+        return 1;
+    }
+
+    cout << "Output saved as '" << specs[0].outputFileName << "'." << endl;
     return 0;
 }
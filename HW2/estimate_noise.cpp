@@ -0,0 +1,48 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+
+#include "../common/bmp_io.h"
+#include "../common/thread_pool.h"
+#include "../common/noise_estimate.h"
+
+using namespace std;
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        cerr << "Usage: " << argv[0] << " <input.bmp> [--method wavelet|laplacian] [--threads N]" << endl;
+        return 1;
+    }
+
+    string inputFileName = argv[1];
+    string method = "wavelet";
+    int threads = 0;
+    for (int i = 2; i < argc; i++) {
+        if (string(argv[i]) == "--method" && i + 1 < argc) {
+            method = argv[i + 1];
+            i++;
+        } else if (string(argv[i]) == "--threads" && i + 1 < argc) {
+            threads = stoi(argv[i + 1]);
+            i++;
+        }
+    }
+    if (method != "wavelet" && method != "laplacian") {
+        cerr << "Error: Method must be 'wavelet' or 'laplacian'." << endl;
+        return 1;
+    }
+
+    MappedBMP input;
+    if (!mapBMP(inputFileName, input)) {
+        return 1;
+    }
+    // 0 (the default) uses every hardware thread.
+    ThreadPool pool(threads);
+    NoiseEstimate estimate = estimateNoise(input.view(), method == "wavelet" ? NoiseEstimator::Wavelet : NoiseEstimator::Laplacian, &pool);
+
+    // Blue, green, red: the order estimate_noise.py printed them in.
+    cout << fixed << setprecision(4);
+    cout << "Estimated noise: [" << estimate.sigma[0] << ", " << estimate.sigma[1] << ", " << estimate.sigma[2] << "]" << endl;
+    cout << "Impulse pixels: [" << estimate.impulseFraction[0] << ", " << estimate.impulseFraction[1] << ", "
+         << estimate.impulseFraction[2] << "]" << endl;
+    return 0;
+}
@@ -4,107 +4,90 @@
 #include <string>
 #include <cmath>
 #include <algorithm>
-using namespace std;
-#pragma pack(push, 1) // Ensure no padding for BMP header
-struct BMPHeader {
-    uint16_t fileType;
-    uint32_t fileSize;
-    uint16_t reserved1;
-    uint16_t reserved2;
-    uint32_t offsetData;
-};
 
-struct BMPInfoHeader {
-    uint32_t size;
-    int32_t width;
-    int32_t height;
-    uint16_t planes;
-    uint16_t bitCount;
-    uint32_t compression;
-    uint32_t imageSize;
-    int32_t xPixelsPerMeter;
-    int32_t yPixelsPerMeter;
-    uint32_t colorsUsed;
-    uint32_t colorsImportant;
-};
-#pragma pack(pop)
+#include "../common/bmp_io.h"
+#include "../common/tone_curve.h"
+#include "../common/batch_runner.h"
 
-void gammaCorrection(vector<uint8_t>& channel, double gamma) {
-    for (auto& value : channel) {
-        double normalized = static_cast<double>(value) / 255.0;
-        value = static_cast<uint8_t>(pow(normalized, gamma) * 255);
-    }
-}
+using namespace std;
 
-void applyGammaCorrection(int width, int height, vector<uint8_t>& red, vector<uint8_t>& green, vector<uint8_t>& blue, double gamma) {
-    gammaCorrection(red, gamma);
-    gammaCorrection(green, gamma);
-    gammaCorrection(blue, gamma);
+// Optional levels stretch (black point to 0, white point to 255) followed by
+// the gamma curve, composed into one table and applied in a single pass.
+ToneCurve buildToneCurve(double gamma, int blackPoint, int whitePoint) {
+    ToneCurve curve = ToneCurve::identity();
+    if (blackPoint != 0 || whitePoint != 255) {
+        curve = ToneCurve::piecewiseLinear({{blackPoint, 0}, {whitePoint, 255}});
+    }
+    return curve.then(ToneCurve::gamma(gamma));
 }
 
 int main(int argc, char* argv[]) {
-    if (argc < 4) {
-        cerr << "Usage: " << argv[0] << " <input.bmp> <output.bmp> <gamma>" << endl;
+    // Batch mode takes a source and an output directory in place of the two
+    // file names.
+    bool batch = argc >= 2 && string(argv[1]) == "--batch";
+    int first = batch ? 2 : 1;
+    if (argc < first + 3) {
+        cerr << "Usage: " << argv[0] << " <input.bmp> <output.bmp> <gamma> [--levels <black> <white>] [--simd auto|avx2|sse4|neon|scalar]" << endl;
+        cerr << "       " << argv[0] << " --batch <input dir|manifest> <output dir> <gamma> [options] [--in-flight <MB>] [--threads N]" << endl;
         return 1;
     }
 
-    string inputFileName = argv[1];
-    string outputFileName = argv[2];
-    double gamma = stod(argv[3]);
+    string inputFileName = argv[first];
+    string outputFileName = argv[first + 1];
+    double gamma = stod(argv[first + 2]);
+    int blackPoint = 0, whitePoint = 255;
+    string simdName = "auto";
+    BatchOptions batchOptions;
+    int threads = 0;
 
-    ifstream inFile(inputFileName, ios::binary);
-    if (!inFile) {
-        cerr << "Error: Could not open input file." << endl;
-        return 1;
+    for (int i = first + 3; i < argc; i++) {
+        if (string(argv[i]) == "--levels" && i + 2 < argc) {
+            blackPoint = stoi(argv[i + 1]);
+            whitePoint = stoi(argv[i + 2]);
+            i += 2;
+        } else if (string(argv[i]) == "--simd" && i + 1 < argc) {
+            simdName = argv[i + 1];
+            i++;
+        } else if (string(argv[i]) == "--in-flight" && i + 1 < argc) {
+            batchOptions.memoryBudget = static_cast<size_t>(stod(argv[i + 1]) * (1 << 20));
+            i++;
+        } else if (string(argv[i]) == "--threads" && i + 1 < argc) {
+            threads = stoi(argv[i + 1]);
+            i++;
+        }
     }
 
-    BMPHeader header;
-    BMPInfoHeader infoHeader;
-    inFile.read(reinterpret_cast<char*>(&header), sizeof(header));
-    inFile.read(reinterpret_cast<char*>(&infoHeader), sizeof(infoHeader));
-
-    if (header.fileType != 0x4D42 || infoHeader.bitCount != 24) {
-        cerr << "Error: Only 24-bit BMP format is supported." << endl;
+    if (blackPoint < 0 || whitePoint > 255 || blackPoint >= whitePoint) {
+        cerr << "Error: Levels must satisfy 0 <= black < white <= 255." << endl;
+        return 1;
+    }
+    SimdPath simd;
+    if (!parseSimdPath(simdName, simd)) {
+        cerr << "Error: SIMD path '" << simdName << "' is unknown or not supported by this CPU." << endl;
         return 1;
     }
 
-    int width = infoHeader.width;
-    int height = infoHeader.height;
-    int padding = (4 - (width * 3) % 4) % 4;
-
-    vector<uint8_t> red, green, blue;
-    uint8_t pixel[3];
-
-    inFile.seekg(header.offsetData, ios::beg);
-    for (int i = 0; i < height; i++) {
-        for (int j = 0; j < width; j++) {
-            inFile.read(reinterpret_cast<char*>(pixel), 3);
-            blue.push_back(pixel[0]);
-            green.push_back(pixel[1]);
-            red.push_back(pixel[2]);
-        }
-        inFile.ignore(padding);
+    if (batch) {
+        // The curve is built once for the whole list.
+        ToneCurve curve = buildToneCurve(gamma, blackPoint, whitePoint);
+        ThreadPool pool(threads);
+        bool ok = runBatchTool(inputFileName, outputFileName, pool, batchOptions, [&](BMPImage& image, const BatchJob&, string&) {
+            applyToneCurve(image.view(), curve, simd);
+            return true;
+        });
+        return ok ? 0 : 1;
     }
-    inFile.close();
 
-    applyGammaCorrection(width, height, red, green, blue, gamma);
+    BMPImage image;
+    if (!readBMP(inputFileName, image)) {
+        return 1;
+    }
 
-    ofstream outFile(outputFileName, ios::binary);
-    outFile.write(reinterpret_cast<char*>(&header), sizeof(header));
-    outFile.write(reinterpret_cast<char*>(&infoHeader), sizeof(infoHeader));
+    applyToneCurve(image.view(), buildToneCurve(gamma, blackPoint, whitePoint), simd);
 
-    int index = 0;
-    for (int i = 0; i < height; i++) {
-        for (int j = 0; j < width; j++) {
-            pixel[0] = blue[index];
-            pixel[1] = green[index];
-            pixel[2] = red[index];
-            outFile.write(reinterpret_cast<char*>(pixel), 3);
-            index++;
-        }
-        outFile.write("\0\0\0", padding);
+    if (!writeBMP(outputFileName, image)) {
+        return 1;
     }
-    outFile.close();
 
     cout << "Gamma correction completed with gamma = " << gamma << ". Output saved as '" << outputFileName << "'." << endl;
     return 0;
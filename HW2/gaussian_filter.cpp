@@ -6,30 +6,13 @@
 #include <cstdint>
 #include <cmath>
 #include <iomanip>
+#include <chrono>
 
-#pragma pack(push, 1)
-struct BMPHeader {
-    uint16_t fileType;
-    uint32_t fileSize;
-    uint16_t reserved1;
-    uint16_t reserved2;
-    uint32_t offsetData;
-};
-
-struct BMPInfoHeader {
-    uint32_t size;
-    int32_t width;
-    int32_t height;
-    uint16_t planes;
-    uint16_t bitCount;
-    uint32_t compression;
-    uint32_t imageSize;
-    int32_t xPixelsPerMeter;
-    int32_t yPixelsPerMeter;
-    uint32_t colorsUsed;
-    uint32_t colorsImportant;
-};
-#pragma pack(pop)
+#include "../common/bmp_io.h"
+#include "../common/gaussian.h"
+#include "../common/gaussian_iir.h"
+#include "../common/padded_plane.h"
+#include "../common/fixed_point.h"
 
 int clamp(int value, int min, int max) {
     return std::max(min, std::min(value, max));
@@ -67,101 +50,145 @@ void printKernel(const std::vector<std::vector<float>>& kernel) {
     }
 }
 
-void applyGaussianFilter(const std::vector<std::vector<uint8_t>>& channel,
-                         std::vector<std::vector<uint8_t>>& output,
-                         int width, int height,
-                         const std::vector<std::vector<float>>& kernel) {
+// channel carries an apron of at least kernel.size() / 2 pixels.
+void applyGaussianFilter2D(const PaddedPlane& channel,
+                           PaddedPlane& output,
+                           const std::vector<std::vector<float>>& kernel) {
     int kernelSize = kernel.size();
     int halfKernel = kernelSize / 2;
 
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
+    for (int y = 0; y < channel.height; ++y) {
+        for (int x = 0; x < channel.width; ++x) {
             float sum = 0.0f;
 
             for (int ky = -halfKernel; ky <= halfKernel; ++ky) {
+                const uint8_t* row = channel.row(y + ky) + x;
+                const std::vector<float>& weights = kernel[ky + halfKernel];
                 for (int kx = -halfKernel; kx <= halfKernel; ++kx) {
-                    int nx = clamp(x + kx, 0, width - 1);
-                    int ny = clamp(y + ky, 0, height - 1);
-                    float weight = kernel[ky + halfKernel][kx + halfKernel];
-                    sum += channel[ny][nx] * weight;
+                    sum += row[kx] * weights[kx + halfKernel];
                 }
             }
 
-            output[y][x] = static_cast<uint8_t>(clamp(static_cast<int>(sum + 0.5f), 0, 255));
+            output.row(y)[x] = static_cast<uint8_t>(clamp(static_cast<int>(sum + 0.5f), 0, 255));
         }
     }
 }
 
-void readBMP(const std::string& filename, BMPHeader& header, BMPInfoHeader& infoHeader,
-             std::vector<std::vector<uint8_t>>& red,
-             std::vector<std::vector<uint8_t>>& green,
-             std::vector<std::vector<uint8_t>>& blue) {
-    std::ifstream inFile(filename, std::ios::binary);
-    if (!inFile) {
-        std::cerr << "Error: Could not open input file." << std::endl;
-        exit(1);
+// Isotropic kernels are rank one, so they run as two 1D passes (O(2k) per
+// pixel); anything else falls back to the full 2D convolution, which needs an
+// apron of kernel.size() / 2 pixels on channel.
+void applyGaussianFilter(const PaddedPlane& channel, PaddedPlane& output,
+                         const std::vector<std::vector<float>>& kernel) {
+    std::vector<float> kernelX, kernelY;
+    if (!factorSeparable(kernel, kernelX, kernelY)) {
+        applyGaussianFilter2D(channel, output, kernel);
+        return;
     }
+    convolveSeparable(channel.row(0), channel.stride, output.row(0), output.stride, channel.width, channel.height,
+                      kernelX, kernelY, Rounding::Nearest);
+}
 
-    inFile.read(reinterpret_cast<char*>(&header), sizeof(header));
-    inFile.read(reinterpret_cast<char*>(&infoHeader), sizeof(infoHeader));
+// Separable FIR on one channel (0 = blue, 1 = green, 2 = red) of an
+// interleaved image, reading the mapped input without splitting it first.
+void applyGaussianFilterInterleaved(const ConstImageView& src, const ImageView& dst, int channel,
+                                    const std::vector<float>& kernelX, const std::vector<float>& kernelY) {
+    convolveSeparable(src.data + channel, src.stride, dst.data + channel, dst.stride, src.width, src.height,
+                      kernelX, kernelY, Rounding::Nearest, src.channels, dst.channels);
+}
 
-    if (header.fileType != 0x4D42 || infoHeader.bitCount != 24) {
-        std::cerr << "Error: Only 24-bit BMP format is supported." << std::endl;
-        exit(1);
+// The same in Q-format fixed point, plus how far the result lands from the
+// float filter's (which runs once more for the comparison).
+void applyGaussianFilterFixed(const MappedBMP& input, BMPImage& image,
+                              const std::vector<float>& kernelX, const std::vector<float>& kernelY) {
+    FixedKernel fixedX, fixedY;
+    quantizeSeparable(kernelX, kernelY, fixedX, fixedY);
+    ConstImageView src = input.view();
+    ImageView dst = image.view();
+    for (int channel = 0; channel < 3; channel++) {
+        convolveSeparableFixed(src.data + channel, src.stride, dst.data + channel, dst.stride, src.width, src.height,
+                               fixedX, fixedY, Rounding::Nearest, src.channels, dst.channels);
     }
 
-    int width = infoHeader.width;
-    int height = infoHeader.height;
-    int padding = (4 - (width * 3) % 4) % 4;
-
-    red.resize(height, std::vector<uint8_t>(width));
-    green.resize(height, std::vector<uint8_t>(width));
-    blue.resize(height, std::vector<uint8_t>(width));
-
-    inFile.seekg(header.offsetData, std::ios::beg);
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            uint8_t pixel[3];
-            inFile.read(reinterpret_cast<char*>(pixel), 3);
-            blue[y][x] = pixel[0];
-            green[y][x] = pixel[1];
-            red[y][x] = pixel[2];
-        }
-        inFile.ignore(padding);
+    BMPImage reference = copyBMP(input);
+    for (int channel = 0; channel < 3; channel++) {
+        applyGaussianFilterInterleaved(src, reference.view(), channel, kernelX, kernelY);
     }
-    inFile.close();
+    Deviation deviation;
+    deviation.add(image.view(), reference.view());
+    std::cout << "Fixed point Q" << fixedX.fracBits << " rows / Q" << fixedY.fracBits << " columns: max abs deviation from float "
+              << deviation.maxAbsolute << " (" << std::fixed << std::setprecision(3)
+              << 100.0 * deviation.differing / deviation.count << "% of subpixels differ), bound "
+              << outputErrorBound(fixedY) << " (" << std::setprecision(2) << fixedY.errorBound << " before rounding)" << std::endl;
+    std::cout.unsetf(std::ios::fixed);
 }
 
-void writeBMP(const std::string& filename, const BMPHeader& header, const BMPInfoHeader& infoHeader,
-              const std::vector<std::vector<uint8_t>>& red,
-              const std::vector<std::vector<uint8_t>>& green,
-              const std::vector<std::vector<uint8_t>>& blue) {
-    std::ofstream outFile(filename, std::ios::binary);
-    if (!outFile) {
-        std::cerr << "Error: Could not open output file." << std::endl;
-        exit(1);
-    }
-
-    outFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
-    outFile.write(reinterpret_cast<const char*>(&infoHeader), sizeof(infoHeader));
+// Recursive Gaussian on one channel of an interleaved image.
+void applyGaussianFilterIIRInterleaved(const ConstImageView& src, const ImageView& dst, int channel,
+                                       float sigma, int order) {
+    gaussianFilterIIR(src.data + channel, src.stride, dst.data + channel, dst.stride, src.width, src.height,
+                      sigma, order, false, src.channels, dst.channels);
+}
 
-    int width = infoHeader.width;
-    int height = infoHeader.height;
-    int padding = (4 - (width * 3) % 4) % 4;
+// Recursive Gaussian: cost per pixel is independent of sigma.
+void applyGaussianFilterIIR(const PaddedPlane& channel, PaddedPlane& output, float sigma, int order) {
+    gaussianFilterIIR(channel.row(0), channel.stride, output.row(0), output.stride, channel.width, channel.height,
+                      sigma, order);
+}
 
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            uint8_t pixel[3] = {blue[y][x], green[y][x], red[y][x]};
-            outFile.write(reinterpret_cast<char*>(pixel), 3);
+// Times the separable FIR path against the recursive path on one channel for
+// a range of sigmas, to locate the crossover used by preferIIR().
+void benchmarkGaussian(const PaddedPlane& channel, int order) {
+    const float sigmas[] = {0.5f, 1, 2, 3, 4, 5, 6, 8, 10, 15, 20};
+    const int width = channel.width;
+    const int height = channel.height;
+    PaddedPlane output(width, height, 0);
+
+    auto timeMs = [](auto&& run) {
+        double best = 1e30;
+        for (int rep = 0; rep < 3; ++rep) {
+            auto start = std::chrono::steady_clock::now();
+            run();
+            auto end = std::chrono::steady_clock::now();
+            best = std::min(best, std::chrono::duration<double, std::milli>(end - start).count());
         }
-        outFile.write("\0\0\0", padding);
+        return best;
+    };
+
+    std::cout << "Image " << width << "x" << height << ", IIR order " << order << std::endl;
+    std::cout << std::setw(8) << "sigma" << std::setw(8) << "taps" << std::setw(12) << "FIR ms"
+              << std::setw(12) << "IIR ms" << std::setw(8) << "winner" << std::endl;
+    for (float sigma : sigmas) {
+        int kernelSize = static_cast<int>(2 * (3 * sigma) + 1);
+        std::vector<std::vector<float>> kernel;
+        generateGaussianKernel(kernel, kernelSize, sigma);
+
+        double fir = timeMs([&] { applyGaussianFilter(channel, output, kernel); });
+        double iir = timeMs([&] { applyGaussianFilterIIR(channel, output, sigma, order); });
+        std::cout << std::setw(8) << sigma << std::setw(8) << kernel.size() << std::fixed << std::setprecision(2)
+                  << std::setw(12) << fir << std::setw(12) << iir << std::setw(8) << (fir <= iir ? "FIR" : "IIR")
+                  << std::endl;
+        std::cout.unsetf(std::ios::fixed);
     }
-    outFile.close();
+    std::cout << "preferIIR() switches at sigma >= " << kIIRSigmaThreshold << std::endl;
 }
 
 int main(int argc, char* argv[]) {
+    if (argc >= 3 && std::string(argv[1]) == "--bench") {
+        int order = (argc >= 5 && std::string(argv[3]) == "--iir-order") ? std::stoi(argv[4]) : 4;
+        BMPImage image;
+        if (!readBMP(argv[2], image)) {
+            return 1;
+        }
+        // The green channel, with room for the 2D fallback of the widest kernel.
+        PaddedPlane green;
+        green.load(image.view(), 1, static_cast<int>(3 * 20.0f), BorderMode::Replicate);
+        benchmarkGaussian(green, order);
+        return 0;
+    }
+
     if (argc < 4) {
-        std::cerr << "Usage: " << argv[0] << " <input.bmp> <output.bmp> <sigma>" << std::endl;
+        std::cerr << "Usage: " << argv[0] << " <input.bmp> <output.bmp> <sigma> [--gaussian auto|fir|iir] [--iir-order 3|4] [--fixed]" << std::endl;
+        std::cerr << "       " << argv[0] << " --bench <input.bmp> [--iir-order 3|4]" << std::endl;
         return 1;
     }
 
@@ -174,36 +201,79 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
-    int kernelSize = static_cast<int>(2 * (3 * sigma) + 1);
-
-    BMPHeader header;
-    BMPInfoHeader infoHeader;
-    std::vector<std::vector<uint8_t>> red, green, blue;
-
-    readBMP(inputFileName, header, infoHeader, red, green, blue);
-
-    int width = infoHeader.width;
-    int height = infoHeader.height;
-
-    // Generate Gaussian kernel
-    std::vector<std::vector<float>> kernel;
-    generateGaussianKernel(kernel, kernelSize, sigma);
+    std::string method = "auto";
+    int order = 4;
+    bool fixedPoint = false;
+    for (int i = 4; i < argc; i++) {
+        if (std::string(argv[i]) == "--gaussian" && i + 1 < argc) {
+            method = argv[i + 1];
+            i++;
+        } else if (std::string(argv[i]) == "--iir-order" && i + 1 < argc) {
+            order = std::stoi(argv[i + 1]);
+            i++;
+        } else if (std::string(argv[i]) == "--fixed") {
+            fixedPoint = true;
+        }
+    }
+    if (method != "auto" && method != "fir" && method != "iir") {
+        std::cerr << "Error: Gaussian method must be 'auto', 'fir' or 'iir'." << std::endl;
+        return 1;
+    }
+    if (order != 3 && order != 4) {
+        std::cerr << "Error: IIR order must be 3 or 4." << std::endl;
+        return 1;
+    }
+    if (fixedPoint && method == "iir") {
+        std::cerr << "Error: --fixed quantizes the FIR kernel; use --gaussian fir." << std::endl;
+        return 1;
+    }
+    bool useIIR = method == "iir" || (method == "auto" && !fixedPoint && preferIIR(sigma));
 
-    // Print the kernel
-    printKernel(kernel);
+    int kernelSize = static_cast<int>(2 * (3 * sigma) + 1);
 
-    // Apply Gaussian filter directly on RGB channels
-    std::vector<std::vector<uint8_t>> redFiltered(height, std::vector<uint8_t>(width));
-    std::vector<std::vector<uint8_t>> greenFiltered(height, std::vector<uint8_t>(width));
-    std::vector<std::vector<uint8_t>> blueFiltered(height, std::vector<uint8_t>(width));
+    MappedBMP input;
+    if (!mapBMP(inputFileName, input)) {
+        return 1;
+    }
+    // The filters read the mapped pixels directly and overwrite B, G and R.
+    BMPImage image = copyBMP(input);
 
-    applyGaussianFilter(red, redFiltered, width, height, kernel);
-    applyGaussianFilter(green, greenFiltered, width, height, kernel);
-    applyGaussianFilter(blue, blueFiltered, width, height, kernel);
+    if (useIIR) {
+        std::cout << "Recursive Gaussian (order " << order << ")" << std::endl;
+        for (int channel = 0; channel < 3; channel++) {
+            applyGaussianFilterIIRInterleaved(input.view(), image.view(), channel, sigma, order);
+        }
+    } else {
+        // Generate Gaussian kernel
+        std::vector<std::vector<float>> kernel;
+        generateGaussianKernel(kernel, kernelSize, sigma);
+
+        // Print the kernel
+        printKernel(kernel);
+
+        std::vector<float> kernelX, kernelY;
+        bool separable = factorSeparable(kernel, kernelX, kernelY);
+        if (separable && fixedPoint) {
+            applyGaussianFilterFixed(input, image, kernelX, kernelY);
+        } else if (separable) {
+            for (int channel = 0; channel < 3; channel++) {
+                applyGaussianFilterInterleaved(input.view(), image.view(), channel, kernelX, kernelY);
+            }
+        } else {
+            PaddedPlane plane, filtered(image.width, image.height, 0);
+            for (int channel = 0; channel < 3; channel++) {
+                plane.load(input.view(), channel, kernelSize / 2, BorderMode::Replicate);
+                applyGaussianFilter2D(plane, filtered, kernel);
+                filtered.store(image.view(), channel);
+            }
+        }
+    }
 
-    writeBMP(outputFileName, header, infoHeader, redFiltered, greenFiltered, blueFiltered);
+    if (!writeBMP(outputFileName, image)) {
+        return 1;
+    }
 
     std::cout << "Gaussian smoothing applied directly to RGB channels with sigma = " << sigma << ". Output saved as '"
               << outputFileName << "'." << std::endl;
     return 0;
-}
\ No newline at end of file
+}
@@ -3,151 +3,96 @@
 #include <vector>
 #include <string>
 #include <algorithm>
-using namespace std;
-#pragma pack(push, 1) // Ensure no padding for BMP header
-struct BMPHeader {
-    uint16_t fileType;
-    uint32_t fileSize;
-    uint16_t reserved1;
-    uint16_t reserved2;
-    uint32_t offsetData;
-};
-
-struct BMPInfoHeader {
-    uint32_t size;
-    int32_t width;
-    int32_t height;
-    uint16_t planes;
-    uint16_t bitCount;
-    uint32_t compression;
-    uint32_t imageSize;
-    int32_t xPixelsPerMeter;
-    int32_t yPixelsPerMeter;
-    uint32_t colorsUsed;
-    uint32_t colorsImportant;
-};
-#pragma pack(pop)
-
-void histogramEqualization(vector<uint8_t>& intensities) {
-    int histogram[256] = {0};
-    int size = intensities.size();
-
-    for (int i = 0; i < size; i++) {
-        histogram[intensities[i]]++;
-    }
 
-    int cdf[256] = {0};
-    cdf[0] = histogram[0];
-    for (int i = 1; i < 256; i++) {
-        cdf[i] = cdf[i - 1] + histogram[i];
-    }
+#include "../common/bmp_io.h"
+#include "../common/histogram.h"
+#include "../common/clahe.h"
+#include "../common/thread_pool.h"
+#include "../common/batch_runner.h"
 
-    int min_cdf = 0;
-    for (int i = 0; i < 256; i++) {
-        if (cdf[i] > 0) {
-            min_cdf = cdf[i];
-            break;
-        }
-    }
-
-    for (int i = 0; i < 256; i++) {
-        cdf[i] = (cdf[i] - min_cdf) * 255 / (size - min_cdf);
-        if (cdf[i] < 0) cdf[i] = 0;
-    }
+using namespace std;
 
-    for (int i = 0; i < size; i++) {
-        intensities[i] = static_cast<uint8_t>(cdf[intensities[i]]);
-    }
+// Equalizes the intensity (B + G + R) / 3 and scales each pixel's channels by
+// new / old intensity, as one multiply-shift per subpixel from a table of
+// gains built off the histogram.
+void applyIntensityHistogramEqualization(const ImageView& image, ThreadPool& pool) {
+    Histogram histogram = intensityHistogram(image, &pool);
+    applyIntensityGains(image, intensityGains(equalizationCurve(histogram)), &pool);
 }
 
-void applyIntensityHistogramEqualization(int width, int height, vector<uint8_t>& red, vector<uint8_t>& green, vector<uint8_t>& blue) {
-    int size = width * height;
-    vector<uint8_t> intensities(size);
-
-    // Calculate the intensity (average of RGB channels)
-    for (int i = 0; i < size; i++) {
-        intensities[i] = static_cast<uint8_t>((red[i] + green[i] + blue[i]) / 3.);
+int main(int argc, char* argv[]) {
+    // Batch mode takes a source and an output directory in place of the two
+    // file names.
+    bool batch = argc >= 2 && string(argv[1]) == "--batch";
+    int first = batch ? 2 : 1;
+    if (argc < first + 2) {
+        cerr << "Usage: " << argv[0] << " <input.bmp>" << " <output.bmp> [--clahe] [--tiles N] [--clip-limit <value>] [--threads N]" << endl;
+        cerr << "       " << argv[0] << " --batch <input dir|manifest> <output dir> [options] [--in-flight <MB>]" << endl;
+        return 1;
     }
 
-    // Apply histogram equalization on intensity
-    histogramEqualization(intensities);
-
-    // Calculate the new RGB values based on the new intensity
-    for (int i = 0; i < size; i++) {
-        if (intensities[i] == 0) {
-            red[i] = green[i] = blue[i] = 0;
-        } else {
-            double ratio = static_cast<double>(intensities[i]) / ((red[i] + green[i] + blue[i]) / 3.0);
-            red[i] = min(static_cast<int>(red[i] * ratio), 255);
-            green[i] = min(static_cast<int>(green[i] * ratio), 255);
-            blue[i] = min(static_cast<int>(blue[i] * ratio), 255);
+    string inputFileName = argv[first];
+    string outputFileName = argv[first + 1];
+    int threads = 0;
+    bool useClahe = false;
+    ClaheOptions claheOptions;
+    BatchOptions batchOptions;
+
+    for (int i = first + 2; i < argc; i++) {
+        if (string(argv[i]) == "--clahe") {
+            useClahe = true;
+        } else if (string(argv[i]) == "--tiles" && i + 1 < argc) {
+            claheOptions.tilesX = claheOptions.tilesY = stoi(argv[i + 1]);
+            i++;
+        } else if (string(argv[i]) == "--clip-limit" && i + 1 < argc) {
+            claheOptions.clipLimit = stod(argv[i + 1]);
+            i++;
+        } else if (string(argv[i]) == "--threads" && i + 1 < argc) {
+            threads = stoi(argv[i + 1]);
+            i++;
+        } else if (string(argv[i]) == "--in-flight" && i + 1 < argc) {
+            batchOptions.memoryBudget = static_cast<size_t>(stod(argv[i + 1]) * (1 << 20));
+            i++;
         }
     }
-}
 
-int main(int argc, char* argv[]) {
-    if (argc < 3) {
-        cerr << "Usage: " << argv[0] << " <input.bmp>" << " <output.bmp>" << endl;
+    if (claheOptions.tilesX < 1) {
+        cerr << "Error: The tile count must be at least 1." << endl;
         return 1;
     }
 
-    string inputFileName = argv[1];
-    ifstream inFile(inputFileName, ios::binary);
-    if (!inFile) {
-        cerr << "Error: Could not open input file." << endl;
-        return 1;
+    ThreadPool pool(threads);
+    if (batch) {
+        bool ok = runBatchTool(inputFileName, outputFileName, pool, batchOptions, [&](BMPImage& image, const BatchJob&, string&) {
+            if (useClahe) {
+                applyClahe(image.view(), claheOptions, &pool);
+            } else {
+                applyIntensityHistogramEqualization(image.view(), pool);
+            }
+            return true;
+        });
+        return ok ? 0 : 1;
     }
 
-    string outputFileName = argv[2];
-
-    BMPHeader header;
-    BMPInfoHeader infoHeader;
-    inFile.read(reinterpret_cast<char*>(&header), sizeof(header));
-    inFile.read(reinterpret_cast<char*>(&infoHeader), sizeof(infoHeader));
-
-    if (header.fileType != 0x4D42 || infoHeader.bitCount != 24) {
-        cerr << "Error: Only 24-bit BMP format is supported." << endl;
+    BMPImage image;
+    if (!readBMP(inputFileName, image)) {
         return 1;
     }
 
-    int width = infoHeader.width;
-    int height = infoHeader.height;
-    int padding = (4 - (width * 3) % 4) % 4;
-
-    vector<uint8_t> red, green, blue;
-    uint8_t pixel[3];
-
-    inFile.seekg(header.offsetData, ios::beg);
-    for (int i = 0; i < height; i++) {
-        for (int j = 0; j < width; j++) {
-            inFile.read(reinterpret_cast<char*>(pixel), 3);
-            blue.push_back(pixel[0]);
-            green.push_back(pixel[1]);
-            red.push_back(pixel[2]);
-        }
-        inFile.ignore(padding);
+    if (useClahe) {
+        applyClahe(image.view(), claheOptions, &pool);
+    } else {
+        applyIntensityHistogramEqualization(image.view(), pool);
     }
-    inFile.close();
-
-    applyIntensityHistogramEqualization(width, height, red, green, blue);
-
-    ofstream outFile(outputFileName, ios::binary);
-    outFile.write(reinterpret_cast<char*>(&header), sizeof(header));
-    outFile.write(reinterpret_cast<char*>(&infoHeader), sizeof(infoHeader));
 
-    int index = 0;
-    for (int i = 0; i < height; i++) {
-        for (int j = 0; j < width; j++) {
-            pixel[0] = blue[index];
-            pixel[1] = green[index];
-            pixel[2] = red[index];
-            outFile.write(reinterpret_cast<char*>(pixel), 3);
-            index++;
-        }
-        outFile.write("\0\0\0", padding);
+    if (!writeBMP(outputFileName, image)) {
+        return 1;
     }
-    outFile.close();
 
-    cout << "Intensity-based histogram equalization completed. Output saved as '" << outputFileName << "'." << endl;
+    if (useClahe) {
+        cout << "CLAHE with " << claheOptions.tilesX << "x" << claheOptions.tilesY << " tiles completed. Output saved as '" << outputFileName << "'." << endl;
+    } else {
+        cout << "Intensity-based histogram equalization completed. Output saved as '" << outputFileName << "'." << endl;
+    }
     return 0;
 }
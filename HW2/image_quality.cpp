@@ -0,0 +1,184 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <cmath>
+
+#include "../common/bmp_io.h"
+#include "../common/thread_pool.h"
+#include "../common/image_quality.h"
+
+using namespace std;
+
+struct QualityOptions {
+    unsigned metrics = MetricAll;
+    bool perChannel = false;  // B, G, R and their mean instead of the luma
+    SsimOptions ssim;
+};
+
+// Scores of one reference / test pair: the luma, or channels 0-2 and their
+// mean at index 3.
+struct PairScores {
+    bool ok = false;
+    vector<QualityScores> scores;
+};
+
+bool parseMetrics(const string& name, unsigned& metrics) {
+    if (name == "all") metrics = MetricAll;
+    else if (name == "mse") metrics = MetricMse;
+    else if (name == "psnr") metrics = MetricPsnr;
+    else if (name == "ssim") metrics = MetricSsim;
+    else if (name == "msssim") metrics = MetricMsSsim;
+    else return false;
+    return true;
+}
+
+PairScores scorePair(const string& referenceFileName, const string& testFileName, const QualityOptions& options,
+                     ThreadPool& pool) {
+    PairScores result;
+    MappedBMP reference, test;
+    if (!mapBMP(referenceFileName, reference) || !mapBMP(testFileName, test)) {
+        return result;
+    }
+    ConstImageView a = reference.view();
+    ConstImageView b = test.view();
+    if (a.width != b.width || a.height != b.height) {
+        cerr << "Error: '" << referenceFileName << "' and '" << testFileName << "' differ in size." << endl;
+        return result;
+    }
+
+    MetricPlane planeA, planeB;
+    if (!options.perChannel) {
+        loadLuma(a, planeA);
+        loadLuma(b, planeB);
+        result.scores.push_back(measureQuality(planeA, planeB, options.metrics, options.ssim, &pool));
+    } else {
+        for (int channel = 0; channel < 3; channel++) {
+            loadChannel(a, channel, planeA);
+            loadChannel(b, channel, planeB);
+            result.scores.push_back(measureQuality(planeA, planeB, options.metrics, options.ssim, &pool));
+        }
+        result.scores.push_back(averageScores(result.scores.data(), 3, options.metrics, options.ssim.dataRange));
+    }
+    result.ok = true;
+    return result;
+}
+
+string formatScores(const QualityScores& scores, unsigned metrics) {
+    ostringstream out;
+    out << fixed;
+    if (metrics & MetricMse) out << "  MSE " << setprecision(4) << scores.mse;
+    if (metrics & MetricPsnr) out << "  PSNR " << setprecision(3) << scores.psnr << " dB";
+    if (metrics & MetricSsim) out << "  SSIM " << setprecision(6) << scores.ssim;
+    if (metrics & MetricMsSsim) {
+        out << "  MS-SSIM ";
+        if (isnan(scores.msSsim)) out << "n/a";
+        else out << setprecision(6) << scores.msSsim;
+    }
+    return out.str();
+}
+
+void printScores(const PairScores& pair, const QualityOptions& options, const string& prefix) {
+    if (!options.perChannel) {
+        cout << prefix << "luma:" << formatScores(pair.scores[0], options.metrics) << endl;
+        return;
+    }
+    const char* names[4] = {"B:   ", "G:   ", "R:   ", "mean:"};
+    for (int i = 0; i < 4; i++) {
+        cout << prefix << names[i] << formatScores(pair.scores[i], options.metrics) << endl;
+    }
+}
+
+// "<reference.bmp> <test.bmp>" per line; blank lines and lines starting with
+// # are skipped.
+bool readPairs(const string& listFileName, vector<pair<string, string>>& pairs) {
+    ifstream file(listFileName);
+    if (!file) {
+        cerr << "Error: Cannot open '" << listFileName << "'." << endl;
+        return false;
+    }
+    string line;
+    for (int number = 1; getline(file, line); number++) {
+        istringstream fields(line);
+        string reference, test;
+        if (!(fields >> reference) || reference[0] == '#') continue;
+        if (!(fields >> test)) {
+            cerr << "Error: " << listFileName << ":" << number << ": expected <reference.bmp> <test.bmp>." << endl;
+            return false;
+        }
+        pairs.emplace_back(reference, test);
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        cerr << "Usage: " << argv[0] << " <reference.bmp> <test.bmp> [--metric all|mse|psnr|ssim|msssim] [--channels luma|rgb] [--window box|gaussian] [--threads N]" << endl;
+        cerr << "       " << argv[0] << " --batch <pairs.txt> [options]" << endl;
+        return 1;
+    }
+
+    vector<pair<string, string>> pairs;
+    bool batch = string(argv[1]) == "--batch";
+    if (batch) {
+        if (!readPairs(argv[2], pairs)) {
+            return 1;
+        }
+    } else {
+        pairs.emplace_back(argv[1], argv[2]);
+    }
+
+    QualityOptions options;
+    int threads = 0;
+    string channels = "luma";
+    string window = "box";
+    for (int i = 3; i < argc; i++) {
+        if (string(argv[i]) == "--metric" && i + 1 < argc) {
+            if (!parseMetrics(argv[i + 1], options.metrics)) {
+                cerr << "Error: Metric must be 'all', 'mse', 'psnr', 'ssim' or 'msssim'." << endl;
+                return 1;
+            }
+            i++;
+        } else if (string(argv[i]) == "--channels" && i + 1 < argc) {
+            channels = argv[i + 1];
+            i++;
+        } else if (string(argv[i]) == "--window" && i + 1 < argc) {
+            window = argv[i + 1];
+            i++;
+        } else if (string(argv[i]) == "--threads" && i + 1 < argc) {
+            threads = stoi(argv[i + 1]);
+            i++;
+        }
+    }
+    if (channels != "luma" && channels != "rgb") {
+        cerr << "Error: Channels must be 'luma' or 'rgb'." << endl;
+        return 1;
+    }
+    if (window != "box" && window != "gaussian") {
+        cerr << "Error: Window must be 'box' or 'gaussian'." << endl;
+        return 1;
+    }
+    options.perChannel = channels == "rgb";
+    options.ssim.window = window == "box" ? SsimWindow::Box : SsimWindow::Gaussian;
+    // 0 (the default) uses every hardware thread.
+    ThreadPool pool(threads);
+
+    // Pairs are scored concurrently, each also splitting its planes into
+    // bands on the same pool, and printed in list order.
+    vector<PairScores> results(pairs.size());
+    pool.parallelFor(static_cast<int>(pairs.size()), [&](int i) {
+        results[i] = scorePair(pairs[i].first, pairs[i].second, options, pool);
+    });
+
+    bool ok = true;
+    for (size_t i = 0; i < pairs.size(); i++) {
+        if (!results[i].ok) {
+            ok = false;
+            continue;
+        }
+        printScores(results[i], options, batch ? pairs[i].second + " vs " + pairs[i].first + "  " : "");
+    }
+    return ok ? 0 : 1;
+}
@@ -3,124 +3,16 @@
 #include <vector>
 #include <algorithm>
 #include <string>
-using namespace std;
-#pragma pack(push, 1) // Ensure no padding for BMP header
-struct BMPHeader {
-    uint16_t fileType;
-    uint32_t fileSize;
-    uint16_t reserved1;
-    uint16_t reserved2;
-    uint32_t offsetData;
-};
-
-struct BMPInfoHeader {
-    uint32_t size;
-    int32_t width;
-    int32_t height;
-    uint16_t planes;
-    uint16_t bitCount;
-    uint32_t compression;
-    uint32_t imageSize;
-    int32_t xPixelsPerMeter;
-    int32_t yPixelsPerMeter;
-    uint32_t colorsUsed;
-    uint32_t colorsImportant;
-};
-#pragma pack(pop)
-
-int clamp(int value, int min, int max) {
-    return std::max(min, std::min(value, max));
-}
-
-void applyMaxFilter(const vector<vector<uint8_t>>& channel, vector<vector<uint8_t>>& output, int width, int height, int kernelSize) {
-    int halfKernel = kernelSize / 2;
-    vector<uint8_t> window;
-
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            window.clear();
-
-            // Collect pixels within the kernel
-            for (int ky = -halfKernel; ky <= halfKernel; ++ky) {
-                for (int kx = -halfKernel; kx <= halfKernel; ++kx) {
-                    int nx = clamp(x + kx, 0, width - 1);
-                    int ny = clamp(y + ky, 0, height - 1);
-                    window.push_back(channel[ny][nx]);
-                }
-            }
-
-            // Sort and pick the median value
-            sort(window.begin(), window.end());
-            output[y][x] = window[window.size() - 1];
-        }
-    }
-}
-
-void readBMP(const string& filename, BMPHeader& header, BMPInfoHeader& infoHeader, 
-             vector<vector<uint8_t>>& red, 
-             vector<vector<uint8_t>>& green, 
-             vector<vector<uint8_t>>& blue) {
-    ifstream inFile(filename, ios::binary);
-    if (!inFile) {
-        cerr << "Error: Could not open input file." << endl;
-        exit(1);
-    }
-
-    inFile.read(reinterpret_cast<char*>(&header), sizeof(header));
-    inFile.read(reinterpret_cast<char*>(&infoHeader), sizeof(infoHeader));
-
-    if (header.fileType != 0x4D42 || infoHeader.bitCount != 24) {
-        cerr << "Error: Only 24-bit BMP format is supported." << endl;
-        exit(1);
-    }
-
-    int width = infoHeader.width;
-    int height = infoHeader.height;
-    int padding = (4 - (width * 3) % 4) % 4;
-
-    red.resize(height, vector<uint8_t>(width));
-    green.resize(height, vector<uint8_t>(width));
-    blue.resize(height, vector<uint8_t>(width));
 
-    inFile.seekg(header.offsetData, ios::beg);
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            uint8_t pixel[3];
-            inFile.read(reinterpret_cast<char*>(pixel), 3);
-            blue[y][x] = pixel[0];
-            green[y][x] = pixel[1];
-            red[y][x] = pixel[2];
-        }
-        inFile.ignore(padding);
-    }
-    inFile.close();
-}
-
-void writeBMP(const string& filename, const BMPHeader& header, const BMPInfoHeader& infoHeader, 
-              const vector<vector<uint8_t>>& red, 
-              const vector<vector<uint8_t>>& green, 
-              const vector<vector<uint8_t>>& blue) {
-    ofstream outFile(filename, ios::binary);
-    if (!outFile) {
-        cerr << "Error: Could not open output file." << endl;
-        exit(1);
-    }
-
-    outFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
-    outFile.write(reinterpret_cast<const char*>(&infoHeader), sizeof(infoHeader));
+#include "../common/bmp_io.h"
+#include "../common/morphology.h"
 
-    int width = infoHeader.width;
-    int height = infoHeader.height;
-    int padding = (4 - (width * 3) % 4) % 4;
-
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            uint8_t pixel[3] = {blue[y][x], green[y][x], red[y][x]};
-            outFile.write(reinterpret_cast<char*>(pixel), 3);
-        }
-        outFile.write("\0\0\0", padding);
-    }
-    outFile.close();
+using namespace std;
+// van Herk / Gil-Werman max filter on one channel (0 = blue, 1 = green,
+// 2 = red) of an interleaved image, read in place instead of split into planes.
+void applyMaxFilter(const ConstImageView& src, const ImageView& dst, int channel, int kernelSize) {
+    maxFilterVHGW(src.data + channel, src.stride, dst.data + channel, dst.stride, src.width, src.height,
+                  kernelSize / 2, src.channels, dst.channels);
 }
 
 int main(int argc, char* argv[]) {
@@ -138,25 +30,19 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
-    BMPHeader header;
-    BMPInfoHeader infoHeader;
-    vector<vector<uint8_t>> red, green, blue;
-
-    readBMP(inputFileName, header, infoHeader, red, green, blue);
-
-    int width = infoHeader.width;
-    int height = infoHeader.height;
-
-    vector<vector<uint8_t>> redFiltered(height, vector<uint8_t>(width));
-    vector<vector<uint8_t>> greenFiltered(height, vector<uint8_t>(width));
-    vector<vector<uint8_t>> blueFiltered(height, vector<uint8_t>(width));
-
-    applyMaxFilter(red, redFiltered, width, height, kernelSize);
-    applyMaxFilter(green, greenFiltered, width, height, kernelSize);
-    applyMaxFilter(blue, blueFiltered, width, height, kernelSize);
+    MappedBMP input;
+    if (!mapBMP(inputFileName, input)) {
+        return 1;
+    }
+    BMPImage image = copyBMP(input);
+    for (int channel = 0; channel < 3; channel++) {
+        applyMaxFilter(input.view(), image.view(), channel, kernelSize);
+    }
 
-    writeBMP(outputFileName, header, infoHeader, redFiltered, greenFiltered, blueFiltered);
+    if (!writeBMP(outputFileName, image)) {
+        return 1;
+    }
 
-    cout << "Median filter applied. Output saved as '" << outputFileName << "'." << endl;
+    cout << "Max filter applied. Output saved as '" << outputFileName << "'." << endl;
     return 0;
 }
@@ -3,129 +3,56 @@
 #include <vector>
 #include <algorithm>
 #include <string>
+
+#include "../common/bmp_io.h"
+#include "../common/median_histogram.h"
+#include "../common/median_network.h"
+#include "../common/padded_plane.h"
+
 using namespace std;
-#pragma pack(push, 1) // Ensure no padding for BMP header
-struct BMPHeader {
-    uint16_t fileType;
-    uint32_t fileSize;
-    uint16_t reserved1;
-    uint16_t reserved2;
-    uint32_t offsetData;
-};
-
-struct BMPInfoHeader {
-    uint32_t size;
-    int32_t width;
-    int32_t height;
-    uint16_t planes;
-    uint16_t bitCount;
-    uint32_t compression;
-    uint32_t imageSize;
-    int32_t xPixelsPerMeter;
-    int32_t yPixelsPerMeter;
-    uint32_t colorsUsed;
-    uint32_t colorsImportant;
-};
-#pragma pack(pop)
-
-int clamp(int value, int min, int max) {
-    return std::max(min, std::min(value, max));
-}
 
-void applyMedianFilter(const vector<vector<uint8_t>>& channel, vector<vector<uint8_t>>& output, int width, int height, int kernelSize) {
+// channel carries an apron of at least kernelSize / 2 pixels.
+void applyMedianFilter(const PaddedPlane& channel, PaddedPlane& output, int kernelSize) {
     int halfKernel = kernelSize / 2;
     vector<uint8_t> window;
 
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
+    for (int y = 0; y < channel.height; ++y) {
+        for (int x = 0; x < channel.width; ++x) {
             window.clear();
 
             // Collect pixels within the kernel
             for (int ky = -halfKernel; ky <= halfKernel; ++ky) {
+                const uint8_t* row = channel.row(y + ky) + x;
                 for (int kx = -halfKernel; kx <= halfKernel; ++kx) {
-                    int nx = clamp(x + kx, 0, width - 1);
-                    int ny = clamp(y + ky, 0, height - 1);
-                    window.push_back(channel[ny][nx]);
+                    window.push_back(row[kx]);
                 }
             }
 
             // Sort and pick the median value
             sort(window.begin(), window.end());
-            output[y][x] = window[window.size() / 2];
+            output.row(y)[x] = window[window.size() / 2];
         }
     }
 }
 
-void readBMP(const string& filename, BMPHeader& header, BMPInfoHeader& infoHeader, 
-             vector<vector<uint8_t>>& red, 
-             vector<vector<uint8_t>>& green, 
-             vector<vector<uint8_t>>& blue) {
-    ifstream inFile(filename, ios::binary);
-    if (!inFile) {
-        cerr << "Error: Could not open input file." << endl;
-        exit(1);
-    }
-
-    inFile.read(reinterpret_cast<char*>(&header), sizeof(header));
-    inFile.read(reinterpret_cast<char*>(&infoHeader), sizeof(infoHeader));
-
-    if (header.fileType != 0x4D42 || infoHeader.bitCount != 24) {
-        cerr << "Error: Only 24-bit BMP format is supported." << endl;
-        exit(1);
-    }
-
-    int width = infoHeader.width;
-    int height = infoHeader.height;
-    int padding = (4 - (width * 3) % 4) % 4;
-
-    red.resize(height, vector<uint8_t>(width));
-    green.resize(height, vector<uint8_t>(width));
-    blue.resize(height, vector<uint8_t>(width));
-
-    inFile.seekg(header.offsetData, ios::beg);
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            uint8_t pixel[3];
-            inFile.read(reinterpret_cast<char*>(pixel), 3);
-            blue[y][x] = pixel[0];
-            green[y][x] = pixel[1];
-            red[y][x] = pixel[2];
-        }
-        inFile.ignore(padding);
-    }
-    inFile.close();
+// Same result as applyMedianFilter, but O(1) per pixel regardless of kernel
+// size. Works on one channel (0 = blue, 1 = green, 2 = red) of an interleaved
+// image, so the mapped input is read as is instead of being split into planes.
+void applyMedianFilterHistogram(const ConstImageView& src, const ImageView& dst, int channel, int kernelSize) {
+    medianFilterHistogram(src.data + channel, src.stride, dst.data + channel, dst.stride,
+                          src.width, src.height, kernelSize / 2, src.channels, dst.channels);
 }
 
-void writeBMP(const string& filename, const BMPHeader& header, const BMPInfoHeader& infoHeader, 
-              const vector<vector<uint8_t>>& red, 
-              const vector<vector<uint8_t>>& green, 
-              const vector<vector<uint8_t>>& blue) {
-    ofstream outFile(filename, ios::binary);
-    if (!outFile) {
-        cerr << "Error: Could not open output file." << endl;
-        exit(1);
-    }
-
-    outFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
-    outFile.write(reinterpret_cast<const char*>(&infoHeader), sizeof(infoHeader));
-
-    int width = infoHeader.width;
-    int height = infoHeader.height;
-    int padding = (4 - (width * 3) % 4) % 4;
-
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            uint8_t pixel[3] = {blue[y][x], green[y][x], red[y][x]};
-            outFile.write(reinterpret_cast<char*>(pixel), 3);
-        }
-        outFile.write("\0\0\0", padding);
-    }
-    outFile.close();
+// Same result again, from sorting networks over blocks of pixels; 3x3 and
+// 5x5 only.
+void applyMedianFilterNetwork(const ConstImageView& src, const ImageView& dst, int channel, int kernelSize) {
+    medianFilterSmall(src.data + channel, src.stride, dst.data + channel, dst.stride,
+                      src.width, src.height, kernelSize / 2, src.channels, dst.channels);
 }
 
 int main(int argc, char* argv[]) {
     if (argc < 4) {
-        cerr << "Usage: " << argv[0] << " <input.bmp> <output.bmp> <kernel_size>" << endl;
+        cerr << "Usage: " << argv[0] << " <input.bmp> <output.bmp> <kernel_size> [--median auto|network|histogram|sort]" << endl;
         return 1;
     }
 
@@ -138,24 +65,54 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
-    BMPHeader header;
-    BMPInfoHeader infoHeader;
-    vector<vector<uint8_t>> red, green, blue;
-
-    readBMP(inputFileName, header, infoHeader, red, green, blue);
-
-    int width = infoHeader.width;
-    int height = infoHeader.height;
+    string medianEngine = "auto";
+    for (int i = 4; i < argc; i++) {
+        if (string(argv[i]) == "--median" && i + 1 < argc) {
+            medianEngine = argv[i + 1];
+            i++;
+        }
+    }
+    // Sorting networks exist for 3x3 and 5x5; larger windows take the
+    // histogram filter, whose cost does not grow with the size.
+    bool smallMedian = kernelSize <= 5;
+    if (medianEngine == "auto") {
+        medianEngine = smallMedian ? "network" : "histogram";
+    }
+    if (medianEngine != "network" && medianEngine != "sort" && medianEngine != "histogram") {
+        cerr << "Error: Median engine must be 'auto', 'network', 'histogram' or 'sort'." << endl;
+        return 1;
+    }
+    if (medianEngine == "network" && !smallMedian) {
+        cerr << "Error: The network median is only available for kernel sizes 3 and 5." << endl;
+        return 1;
+    }
 
-    vector<vector<uint8_t>> redFiltered(height, vector<uint8_t>(width));
-    vector<vector<uint8_t>> greenFiltered(height, vector<uint8_t>(width));
-    vector<vector<uint8_t>> blueFiltered(height, vector<uint8_t>(width));
+    MappedBMP input;
+    if (!mapBMP(inputFileName, input)) {
+        return 1;
+    }
+    BMPImage image = copyBMP(input);
 
-    applyMedianFilter(red, redFiltered, width, height, kernelSize);
-    applyMedianFilter(green, greenFiltered, width, height, kernelSize);
-    applyMedianFilter(blue, blueFiltered, width, height, kernelSize);
+    if (medianEngine == "network") {
+        for (int channel = 0; channel < 3; channel++) {
+            applyMedianFilterNetwork(input.view(), image.view(), channel, kernelSize);
+        }
+    } else if (medianEngine == "histogram") {
+        for (int channel = 0; channel < 3; channel++) {
+            applyMedianFilterHistogram(input.view(), image.view(), channel, kernelSize);
+        }
+    } else {
+        PaddedPlane plane, filtered(image.width, image.height, 0);
+        for (int channel = 0; channel < 3; channel++) {
+            plane.load(input.view(), channel, kernelSize / 2, BorderMode::Replicate);
+            applyMedianFilter(plane, filtered, kernelSize);
+            filtered.store(image.view(), channel);
+        }
+    }
 
-    writeBMP(outputFileName, header, infoHeader, redFiltered, greenFiltered, blueFiltered);
+    if (!writeBMP(outputFileName, image)) {
+        return 1;
+    }
 
     cout << "Median filter applied. Output saved as '" << outputFileName << "'." << endl;
     return 0;
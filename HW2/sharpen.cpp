@@ -5,178 +5,124 @@
 #include <algorithm>
 #include <cstdint>
 #include <iomanip> // for setw and setprecision
-using namespace std;
-// BMP header structures
-#pragma pack(push, 1)
-struct BMPHeader {
-    uint16_t fileType{0x4D42}; // "BM"
-    uint32_t fileSize{0};       // Size of file in bytes
-    uint16_t reserved1{0};
-    uint16_t reserved2{0};
-    uint32_t offsetData{0};     // Offset to image data in bytes
-};
 
-struct BMPInfoHeader {
-    uint32_t size{0};           // Size of this header in bytes
-    int32_t width{0};           // Width of bitmap in pixels
-    int32_t height{0};          // Height of bitmap in pixels
-    uint16_t planes{1};         // Number of color planes (must be 1)
-    uint16_t bitCount{0};       // Number of bits per pixel
-    uint32_t compression{0};    // Compression type (0 = uncompressed)
-    uint32_t imageSize{0};      // Image size (0 for uncompressed)
-    int32_t xPixelsPerMeter{0};
-    int32_t yPixelsPerMeter{0};
-    uint32_t colorsUsed{0};
-    uint32_t colorsImportant{0};
-};
-#pragma pack(pop)
+#include "../common/bmp_io.h"
+#include "../common/tile_scheduler.h"
+#include "../common/convolve_simd.h"
+#include "../common/log_sharpen.h"
+#include "../common/fft_convolve.h"
+#include "../common/fixed_point.h"
 
-// Generate 2D LoG Kernel with the delta function (center point)
+using namespace std;
+
+// 2D LoG kernel with the delta function (center point) folded in, for the
+// reference path and for printing
 vector<vector<double>> createLoGKernel(double sigma) {
-    int radius = static_cast<int>(ceil(3 * sigma));
-    int size = 2 * radius + 1;
-    vector<vector<double>> kernel(size, vector<double>(size));
-
-    double sigma2 = sigma * sigma;
-    double sigma4 = sigma2 * sigma2;
-    double normalization_factor = 1;
-    double sum = 0;
-
-    for (int y = -radius; y <= radius; y++) {
-        for (int x = -radius; x <= radius; x++) {
-            double distance_squared = x * x + y * y;
-            double exponent = -distance_squared / (2 * sigma2);
-            kernel[y + radius][x + radius] = normalization_factor * (1 - distance_squared / (2 * sigma2)) * exp(exponent);
-            sum += kernel[y + radius][x + radius];
-        }
-        
-    }
-    
-    
-    
-    // Print kernel for verification
-    cout << "2D LoG Kernel with sigma = " << sigma << ":\n";
+    vector<vector<double>> kernel = createLoGKernel2D(sigma);
+    int radius = kernel.size() / 2;
     kernel[radius][radius] += 1;
-
-    // 
-    for (int y = 0; y < size; y++) {
-        for (int x = 0; x < size; x++) {
-            cout << setw(10) << fixed << setprecision(4) << kernel[y][x] << " ";
-        }
-        cout << "\n";
-    }
     return kernel;
 }
 
-// Apply 2D convolution
-void convolve2D(const vector<vector<double>>& kernel, const vector<uint8_t>& src, vector<uint8_t>& dst, int width, int height) {
-    int kRadius = kernel.size() / 2;
-
-    for (int y = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            double sum = 0.0;
-            for (int ky = -kRadius; ky <= kRadius; ky++) {
-                for (int kx = -kRadius; kx <= kRadius; kx++) {
-                    int ix = clamp(x + kx, 0, width - 1);
-                    int iy = clamp(y + ky, 0, height - 1);
-                    sum += src[iy * width + ix] * kernel[ky + kRadius][kx + kRadius];
-                }
-            }
-            dst[y * width + x] = static_cast<uint8_t>(clamp(sum, 0.0, 255.0));
+void printKernel(const vector<vector<double>>& kernel, double sigma) {
+    cout << "2D LoG Kernel with sigma = " << sigma << ":\n";
+    for (const auto& row : kernel) {
+        for (double value : row) {
+            cout << setw(10) << fixed << setprecision(4) << value << " ";
         }
+        cout << "\n";
     }
 }
 
-// Load BMP image (basic uncompressed 24-bit)
-bool loadBMP(const string& filename, BMPHeader& header, BMPInfoHeader& infoHeader, vector<uint8_t>& imageData) {
-    ifstream file(filename, ios::binary);
-    if (!file) {
-        cerr << "Unable to open file " << filename << endl;
-        return false;
-    }
-
-    file.read(reinterpret_cast<char*>(&header), sizeof(header));
-    file.read(reinterpret_cast<char*>(&infoHeader), sizeof(infoHeader));
+enum class SharpenMethod {
+    Auto,       // whichever of Separable, Dense and FFT the planner expects to be fastest
+    Separable,  // exact LoG as two separable terms, delta added after
+    DoG,        // difference-of-Gaussians approximation, same cost
+    Dense,      // the full 2D kernel, O(k^2) per pixel; the reference
+    FFT,        // the full 2D kernel by overlap-save FFT, O(log k) per pixel
+};
 
-    if (infoHeader.bitCount != 24 || infoHeader.compression != 0) {
-        cerr << "Only uncompressed 24-bit BMP files are supported." << endl;
-        return false;
+SharpenMethod plannedMethod(int kernelSize, int width, int height) {
+    switch (chooseConvolutionBackend(kernelSize, 2, width, height)) {
+        case ConvolutionBackend::Separable: return SharpenMethod::Separable;
+        case ConvolutionBackend::FFT: return SharpenMethod::FFT;
+        default: return SharpenMethod::Dense;
     }
-
-    file.seekg(header.offsetData, file.beg);
-    int imageSize = infoHeader.width * infoHeader.height * 3;
-    imageData.resize(imageSize);
-    file.read(reinterpret_cast<char*>(imageData.data()), imageSize);
-
-    file.close();
-    return true;
 }
 
-// Save BMP image
-bool saveBMP(const string& filename, const BMPHeader& header, const BMPInfoHeader& infoHeader, const vector<uint8_t>& imageData) {
-    ofstream file(filename, ios::binary);
-    if (!file) {
-        cerr << "Unable to open file " << filename << endl;
-        return false;
-    }
-
-    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
-    file.write(reinterpret_cast<const char*>(&infoHeader), sizeof(infoHeader));
-    file.write(reinterpret_cast<const char*>(imageData.data()), imageData.size());
-
-    file.close();
-    return true;
+// The dense kernel in Q-format fixed point, plus how far its output lands
+// from the float dense kernel's (which runs once more for the comparison).
+void sharpenFixed(const MappedBMP& input, BMPImage& image, double sigma, SimdPath simd, ThreadPool& pool) {
+    auto logKernel = createLoGKernel(sigma);
+    int size = logKernel.size();
+    vector<float> kernel = flattenKernel(logKernel);
+    FixedKernel fixedKernel = quantizeKernel(kernel);
+    filterTiles(pool, input.view(), image.view(), 3, size / 2, [&](const ConstImageView& src, const ImageView& dst, int channel) {
+        convolveKernel2DFixed(src.data + channel, src.stride, dst.data + channel, dst.stride, src.width, src.height,
+                              fixedKernel, size, Rounding::Truncate, simd, src.channels, dst.channels);
+    });
+
+    BMPImage reference = copyBMP(input);
+    filterTiles(pool, input.view(), reference.view(), 3, size / 2, [&](const ConstImageView& src, const ImageView& dst, int channel) {
+        convolveKernel2D(src.data + channel, src.stride, dst.data + channel, dst.stride, src.width, src.height,
+                         kernel, size, simd, src.channels, dst.channels);
+    });
+    Deviation deviation;
+    deviation.add(image.view(), reference.view());
+    cout << "Fixed point Q" << fixedKernel.fracBits << ": max abs deviation from float " << deviation.maxAbsolute
+         << " (" << fixed << setprecision(3) << 100.0 * deviation.differing / deviation.count
+         << "% of subpixels differ), bound " << outputErrorBound(fixedKernel) << " (" << setprecision(2)
+         << fixedKernel.errorBound << " before rounding)" << endl;
+    cout.unsetf(ios::fixed);
 }
 
 // Main sharpening function
-void sharpenImage(const string& inputFilename, const string& outputFilename, double sigma) {
-    BMPHeader header;
-    BMPInfoHeader infoHeader;
-    vector<uint8_t> imageData;
-
-    if (!loadBMP(inputFilename, header, infoHeader, imageData)) {
+void sharpenImage(const string& inputFilename, const string& outputFilename, double sigma, SharpenMethod method,
+                  bool fixedPoint, SimdPath simd, ThreadPool& pool) {
+    MappedBMP input;
+    if (!mapBMP(inputFilename, input)) {
         return;
     }
+    BMPImage image = copyBMP(input);
 
-    int width = infoHeader.width;
-    int height = infoHeader.height;
-    int imageSize = width * height;
-
-    // Separate color channels
-    vector<uint8_t> redChannel(imageSize);
-    vector<uint8_t> greenChannel(imageSize);
-    vector<uint8_t> blueChannel(imageSize);
-
-    for (int i = 0; i < imageSize; i++) {
-        blueChannel[i] = imageData[3 * i];
-        greenChannel[i] = imageData[3 * i + 1];
-        redChannel[i] = imageData[3 * i + 2];
+    if (fixedPoint) {
+        sharpenFixed(input, image, sigma, simd, pool);
+        writeBMP(outputFilename, image);
+        return;
+    }
+    if (method == SharpenMethod::Auto) {
+        method = plannedMethod(cachedLoGKernels(sigma, LoGMethod::Exact).radius * 2 + 1, image.width, image.height);
     }
 
-    // Apply LoG filter
-    vector<uint8_t> redOutput(imageSize);
-    vector<uint8_t> greenOutput(imageSize);
-    vector<uint8_t> blueOutput(imageSize);
-
-    auto logKernel = createLoGKernel(sigma);
-    convolve2D(logKernel, redChannel, redOutput, width, height);
-    convolve2D(logKernel, greenChannel, greenOutput, width, height);
-    convolve2D(logKernel, blueChannel, blueOutput, width, height);
-
-    // Reconstruct image
-    for (int i = 0; i < imageSize; i++) {
-        imageData[3 * i] = blueOutput[i];
-        imageData[3 * i + 1] = greenOutput[i];
-        imageData[3 * i + 2] = redOutput[i];
+    // Apply LoG filter to each colour channel, tile by tile, or block by
+    // block for the FFT
+    if (method == SharpenMethod::FFT) {
+        auto logKernel = createLoGKernel(sigma);
+        int size = logKernel.size();
+        convolveFFT(input.view(), image.view(), 3, flattenKernel(logKernel), size, Rounding::Truncate,
+                    BorderMode::Replicate, &pool);
+    } else if (method == SharpenMethod::Dense) {
+        auto logKernel = createLoGKernel(sigma);
+        int size = logKernel.size();
+        vector<float> kernel = flattenKernel(logKernel);
+        filterTiles(pool, input.view(), image.view(), 3, size / 2, [&](const ConstImageView& src, const ImageView& dst, int channel) {
+            convolveKernel2D(src.data + channel, src.stride, dst.data + channel, dst.stride, src.width, src.height,
+                             kernel, size, simd, src.channels, dst.channels);
+        });
+    } else {
+        const LoGKernels& kernels = cachedLoGKernels(sigma, method == SharpenMethod::DoG ? LoGMethod::DoG : LoGMethod::Exact);
+        filterTiles(pool, input.view(), image.view(), 3, kernels.radius, [&](const ConstImageView& src, const ImageView& dst, int channel) {
+            sharpenLoG(src.data + channel, src.stride, dst.data + channel, dst.stride, src.width, src.height,
+                       kernels, src.channels, dst.channels);
+        });
     }
 
-    // Save the sharpened image
-    saveBMP(outputFilename, header, infoHeader, imageData);
+    writeBMP(outputFilename, image);
 }
 
 int main(int argc, char* argv[]) {
     if (argc < 4) {
-        cerr << "Usage: " << argv[0] << " <input BMP> <output BMP> <sigma>" << endl;
+        cerr << "Usage: " << argv[0] << " <input BMP> <output BMP> <sigma> [--method auto|separable|dog|dense|fft] [--fixed] [--verbose] [--threads N] [--simd auto|avx2|sse4|neon|scalar]" << endl;
         return 1;
     }
 
@@ -184,7 +130,59 @@ int main(int argc, char* argv[]) {
     string outputFilename = argv[2];
     double sigma = stod(argv[3]);
 
-    sharpenImage(inputFilename, outputFilename, sigma);
+    int threads = 0;
+    string simdName = "auto";
+    string methodName = "auto";
+    bool verbose = false;
+    bool fixedPoint = false;
+    for (int i = 4; i < argc; i++) {
+        if (string(argv[i]) == "--threads" && i + 1 < argc) {
+            threads = stoi(argv[i + 1]);
+            i++;
+        } else if (string(argv[i]) == "--simd" && i + 1 < argc) {
+            simdName = argv[i + 1];
+            i++;
+        } else if (string(argv[i]) == "--method" && i + 1 < argc) {
+            methodName = argv[i + 1];
+            i++;
+        } else if (string(argv[i]) == "--fixed") {
+            fixedPoint = true;
+        } else if (string(argv[i]) == "--verbose") {
+            verbose = true;
+        }
+    }
+
+    SharpenMethod method;
+    if (methodName == "auto") {
+        method = SharpenMethod::Auto;
+    } else if (methodName == "separable") {
+        method = SharpenMethod::Separable;
+    } else if (methodName == "dog") {
+        method = SharpenMethod::DoG;
+    } else if (methodName == "dense") {
+        method = SharpenMethod::Dense;
+    } else if (methodName == "fft") {
+        method = SharpenMethod::FFT;
+    } else {
+        cerr << "Method must be 'auto', 'separable', 'dog', 'dense' or 'fft'." << endl;
+        return 1;
+    }
+    if (fixedPoint && method != SharpenMethod::Auto && method != SharpenMethod::Dense) {
+        cerr << "--fixed quantizes the dense kernel; use it with --method dense." << endl;
+        return 1;
+    }
+
+    SimdPath simd;
+    if (!parseSimdPath(simdName, simd)) {
+        cerr << "SIMD path '" << simdName << "' is unknown or not supported by this CPU." << endl;
+        return 1;
+    }
+    ThreadPool pool(threads);
+
+    if (verbose) {
+        printKernel(createLoGKernel(sigma), sigma);
+    }
+    sharpenImage(inputFilename, outputFilename, sigma, method, fixedPoint, simd, pool);
 
     return 0;
 }
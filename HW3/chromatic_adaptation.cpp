@@ -8,57 +8,31 @@
 #include <algorithm>
 #include <iomanip>
 
+#include "../common/bmp_io.h"
+#include "../common/point_ops.h"
+#include "../common/histogram.h"
+#include "../common/batch_runner.h"
+
 using namespace std;
-#pragma pack(push, 1)
-// BMP file headers
-struct BMPFileHeader {
-    uint16_t bfType;
-    uint32_t bfSize;
-    uint16_t bfReserved1;
-    uint16_t bfReserved2;
-    uint32_t bfOffBits;
-};
-
-struct BMPInfoHeader {
-    uint32_t biSize;
-    int32_t biWidth;
-    int32_t biHeight;
-    uint16_t biPlanes;
-    uint16_t biBitCount;
-    uint32_t biCompression;
-    uint32_t biSizeImage;
-    int32_t biXPelsPerMeter;
-    int32_t biYPelsPerMeter;
-    uint32_t biClrUsed;
-    uint32_t biClrImportant;
-};
-#pragma pack(pop)
-
-// RGB structure
-struct RGB {
-    uint8_t blue;
-    uint8_t green;
-    uint8_t red;
-};
 
 // Utility function to clamp a value between 0 and 255
 inline uint8_t clamp(int value) {
     return static_cast<uint8_t>((value < 0) ? 0 : (value > 255) ? 255 : value);
 }
 
+// Both methods measure the image from its channel histograms, counted in one
+// pass, and return per-channel gains, which are then applied in a single
+// lookup pass.
+
 // Chromatic Adaptation using Grey World method
-void applyGreyWorldAdaptation(vector<vector<RGB>>& image) {
-    double totalR = 0, totalG = 0, totalB = 0;
-    int width = image[0].size();
-    int height = image.size();
-
-    for (const auto& row : image) {
-        for (const auto& pixel : row) {
-            totalR += pixel.red;
-            totalG += pixel.green;
-            totalB += pixel.blue;
-        }
-    }
+PointOps greyWorldAdaptation(const ConstImageView& image) {
+    Histogram histograms[3];
+    channelHistograms(image, histograms);
+    double totalR = histograms[2].valueSum();
+    double totalG = histograms[1].valueSum();
+    double totalB = histograms[0].valueSum();
+    int width = image.width;
+    int height = image.height;
 
     double meanR = totalR / (width * height);
     double meanG = totalG / (width * height);
@@ -69,105 +43,87 @@ void applyGreyWorldAdaptation(vector<vector<RGB>>& image) {
     double G_coef = meanGray / meanG;
     double B_coef = meanGray / meanB;
 
-    for (auto& row : image) {
-        for (auto& pixel : row) {
-            pixel.red = clamp(static_cast<int>(pixel.red * R_coef));
-            pixel.green = clamp(static_cast<int>(pixel.green * G_coef));
-            pixel.blue = clamp(static_cast<int>(pixel.blue * B_coef));
-        }
-    }
+    PointOps ops;
+    ops.gain(2, R_coef).gain(1, G_coef).gain(0, B_coef);
+    return ops;
 }
 
 // Chromatic Adaptation using Max-RGB method
-void applyMaxRGBAdaptation(vector<vector<RGB>>& image) {
-    int maxR = 0, maxG = 0, maxB = 0;
-
-    for (const auto& row : image) {
-        for (const auto& pixel : row) {
-            maxR = max(maxR, static_cast<int>(pixel.red));
-            maxG = max(maxG, static_cast<int>(pixel.green));
-            maxB = max(maxB, static_cast<int>(pixel.blue));
-        }
-    }
+PointOps maxRGBAdaptation(const ConstImageView& image) {
+    Histogram histograms[3];
+    channelHistograms(image, histograms);
+    int maxR = max(0, histograms[2].maxValue());
+    int maxG = max(0, histograms[1].maxValue());
+    int maxB = max(0, histograms[0].maxValue());
 
     int AVCM = (maxR + maxG + maxB) / 3;
-    for (auto& row : image) {
-        for (auto& pixel : row) {
-            pixel.red = clamp(static_cast<int>(pixel.red * AVCM / maxR));
-            pixel.green = clamp(static_cast<int>(pixel.green * AVCM / maxG));
-            pixel.blue = clamp(static_cast<int>(pixel.blue * AVCM / maxB));
-        }
-    }
+    auto scale = [AVCM](int channelMax) {
+        return [AVCM, channelMax](uint8_t v) { return clamp(v * AVCM / channelMax); };
+    };
+    PointOps ops;
+    ops.map(2, scale(maxR)).map(1, scale(maxG)).map(0, scale(maxB));
+    return ops;
 }
 
-// Read BMP file into a 2D vector of RGB pixels
-vector<vector<RGB>> readBMP(const string& filename, BMPFileHeader& fileHeader, BMPInfoHeader& infoHeader) {
-    ifstream file(filename, ios::binary);
-    if (!file) {
-        throw runtime_error("Error opening input file.");
+// Gains of the given method measured from the image itself.
+PointOps adaptationOps(const string& mode, const ConstImageView& image) {
+    if (mode == "grey") {
+        return greyWorldAdaptation(image);
     }
-
-    file.read(reinterpret_cast<char*>(&fileHeader), sizeof(fileHeader));
-    file.read(reinterpret_cast<char*>(&infoHeader), sizeof(infoHeader));
-
-    if (fileHeader.bfType != 0x4D42 || infoHeader.biBitCount != 24) {
-        throw runtime_error("Unsupported BMP format. Only 24-bit BMP files are supported.");
+    else if (mode == "max") {
+        return maxRGBAdaptation(image);
     }
-
-    int width = infoHeader.biWidth;
-    int height = abs(infoHeader.biHeight);
-    int padding = (4 - (width * 3) % 4) % 4;
-
-    vector<vector<RGB>> image(height, vector<RGB>(width));
-    for (int i = 0; i < height; i++) {
-        file.read(reinterpret_cast<char*>(image[i].data()), width * sizeof(RGB));
-        file.ignore(padding);
-    }
-
-    return image;
+    throw runtime_error("Invalid mode. Use 'grey' or 'max'.");
 }
 
-// Write BMP file from a 2D vector of RGB pixels
-void writeBMP(const string& filename, const BMPFileHeader& fileHeader, const BMPInfoHeader& infoHeader, const vector<vector<RGB>>& image) {
-    ofstream file(filename, ios::binary);
-    if (!file) {
-        throw runtime_error("Error opening output file.");
+// Batch mode: every image of the list gets the gains measured from itself.
+int adaptationBatch(int argc, char* argv[]) {
+    string mode = argv[1];
+    if (mode != "grey" && mode != "max") {
+        cerr << "Error: Invalid mode. Use 'grey' or 'max'.\n";
+        return 1;
     }
-
-    file.write(reinterpret_cast<const char*>(&fileHeader), sizeof(fileHeader));
-    file.write(reinterpret_cast<const char*>(&infoHeader), sizeof(infoHeader));
-
-    int width = infoHeader.biWidth;
-    int height = abs(infoHeader.biHeight);
-    int padding = (4 - (width * 3) % 4) % 4;
-
-    for (const auto& row : image) {
-        file.write(reinterpret_cast<const char*>(row.data()), width * sizeof(RGB));
-        file.write("\0\0\0", padding);
+    BatchOptions batchOptions;
+    int threads = 0;
+    for (int i = 5; i < argc; i++) {
+        if (string(argv[i]) == "--in-flight" && i + 1 < argc) {
+            batchOptions.memoryBudget = static_cast<size_t>(stod(argv[i + 1]) * (1 << 20));
+            i++;
+        } else if (string(argv[i]) == "--threads" && i + 1 < argc) {
+            threads = stoi(argv[i + 1]);
+            i++;
+        }
     }
+
+    ThreadPool pool(threads);
+    bool ok = runBatchTool(argv[3], argv[4], pool, batchOptions, [&](BMPImage& image, const BatchJob&, string&) {
+        adaptationOps(mode, image.view()).apply(image.view());
+        return true;
+    });
+    return ok ? 0 : 1;
 }
 
 int main(int argc, char* argv[]) {
-    if (argc != 4) {
+    bool batch = argc >= 3 && string(argv[2]) == "--batch";
+    if ((!batch && argc != 4) || (batch && argc < 5)) {
         cerr << "Usage: " << argv[0] << "<mode> <input.bmp> <output.bmp>\n";
+        cerr << "       " << argv[0] << "<mode> --batch <input dir|manifest> <output dir> [--in-flight <MB>] [--threads N]\n";
         return 1;
     }
+    if (batch) {
+        return adaptationBatch(argc, argv);
+    }
 
-    BMPFileHeader fileHeader;
-    BMPInfoHeader infoHeader;
+    BMPImage bmp;
     string mode = argv[1];
     try {
-        auto image = readBMP(argv[2], fileHeader, infoHeader);
-        if (mode == "grey") {
-            applyGreyWorldAdaptation(image);
-            writeBMP(argv[3], fileHeader, infoHeader, image);
-        } 
-        else if (mode == "max") {
-            applyMaxRGBAdaptation(image);
-            writeBMP(argv[3], fileHeader, infoHeader, image);
-        } 
-        else {
-            throw runtime_error("Invalid mode. Use 'grey' or 'max'.");
+        if (!readBMP(argv[2], bmp)) {
+            throw runtime_error("Could not read '" + string(argv[2]) + "'.");
+        }
+        PointOps ops = adaptationOps(mode, bmp.view());
+        ops.apply(bmp.view());
+        if (!writeBMP(argv[3], bmp)) {
+            throw runtime_error("Could not write '" + string(argv[3]) + "'.");
         }
     } 
     catch (const exception& ex) {
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <vector>
+#include <new>
+#include <cstdint>
+#include <cstddef>
+
+// Contiguous, cache-line aligned pixel storage.
+//
+// Images the tools build for themselves are one block aligned to kImageAlign
+// bytes, with every row padded to a multiple of it, rather than a vector per
+// row: one allocation per image instead of one per row, vertical neighbours
+// a fixed stride apart instead of behind a row pointer, and every row starting
+// on its own cache line.
+
+const size_t kImageAlign = 64;
+
+template <typename T>
+struct AlignedAllocator {
+    using value_type = T;
+
+    AlignedAllocator() = default;
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(kImageAlign)));
+    }
+    void deallocate(T* p, size_t) { ::operator delete(p, std::align_val_t(kImageAlign)); }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U>&) const { return true; }
+    template <typename U>
+    bool operator!=(const AlignedAllocator<U>&) const { return false; }
+};
+
+template <typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+inline size_t alignedRowBytes(size_t bytes) {
+    return (bytes + kImageAlign - 1) / kImageAlign * kImageAlign;
+}
+
+// width x height pixels of any trivially copyable type (e.g. a packed BGR
+// struct), row 0 first. stride is in bytes.
+template <typename Pixel>
+struct PackedImage {
+    int width = 0;
+    int height = 0;
+    ptrdiff_t stride = 0;
+    AlignedVector<uint8_t> bytes;
+
+    PackedImage() = default;
+    PackedImage(int w, int h) { resize(w, h); }
+
+    void resize(int w, int h) {
+        width = w;
+        height = h;
+        stride = static_cast<ptrdiff_t>(alignedRowBytes(static_cast<size_t>(w) * sizeof(Pixel)));
+        bytes.resize(static_cast<size_t>(stride) * h);
+    }
+
+    Pixel* row(int y) { return reinterpret_cast<Pixel*>(bytes.data() + y * stride); }
+    const Pixel* row(int y) const { return reinterpret_cast<const Pixel*>(bytes.data() + y * stride); }
+};
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <functional>
+
+#include "bmp_io.h"
+
+// Streaming (out-of-core) execution of neighbourhood filters.
+//
+// streamBMP reads the input one band of rows at a time, together with `halo`
+// rows above and below it, runs the filter on that slice, appends the band's
+// rows to the output file and slides down. Only the halo rows are carried over
+// from one band to the next, so every input row is read from disk once and
+// the output is written in one pass. Band height is chosen so that the band
+// buffers plus the filter's own scratch stay within the memory budget, which
+// makes peak memory O(width x (band + kernel)) instead of O(width x height).
+//
+// Any window filter that clamps at the image edges gives the same result on
+// a slice as on the whole image as long as halo >= its radius: inside the
+// image the halo supplies every row the window touches, and at the top and
+// bottom the slice ends at the real edge. Rows are read in file order, but the
+// slices are handed to the filter bottom row first like every other BMP view.
+
+// The filter's scratch memory, used to size the bands. Filters that bin rows
+// into cells (the bilateral grid) set rowAlign to the cell height so every
+// slice starts on the same cell boundary as the whole image would.
+struct BandCost {
+    size_t bytesPerPixel = 0;   // per pixel of the slice (band + halo rows)
+    size_t bytesPerColumn = 0;  // per image column, independent of the slice height
+    size_t bytesFixed = 0;      // independent of the image size, e.g. per-thread tile scratch
+    int rowAlign = 1;           // band height and halo are multiples of this
+};
+
+// filter(input, output) gets one slice of the image; output has the same size
+// and starts as a copy of input, so channels the filter does not touch (alpha,
+// padding) pass through. Only the band rows of output are kept.
+typedef std::function<void(const ConstImageView& input, const ImageView& output)> BandFilter;
+
+inline bool streamBMP(const std::string& inputFile, const std::string& outputFile,
+                      int halo, size_t memoryBudget, const BandCost& cost,
+                      const BandFilter& filter, int* bandRowsUsed = nullptr) {
+    std::ifstream in(inputFile, std::ios::binary);
+    if (!in) {
+        std::cerr << "Error: Could not open input file '" << inputFile << "'." << std::endl;
+        return false;
+    }
+    BMPImage layout;
+    if (!readBMPHeaders(in, layout, inputFile)) return false;
+
+    const int height = layout.height;
+    const size_t stride = layout.stride;
+    const int align = std::max(1, cost.rowAlign);
+    halo = (halo + align - 1) / align * align;
+
+    // Input and output slices plus the filter's scratch, per slice row.
+    const size_t perRow = 2 * stride + cost.bytesPerPixel * layout.width;
+    const size_t fixed = cost.bytesPerColumn * layout.width + cost.bytesFixed;
+    size_t sliceRows = memoryBudget > fixed ? (memoryBudget - fixed) / perRow : 0;
+    size_t fit = sliceRows > static_cast<size_t>(2 * halo) ? (sliceRows - 2 * halo) / align * align : 0;
+    if (fit == 0) {
+        size_t needed = fixed + static_cast<size_t>(2 * halo + align) * perRow;
+        std::cerr << "Error: Memory budget too small for this image width and kernel; need at least "
+                  << (needed + (1 << 20) - 1) / (1 << 20) << " MB." << std::endl;
+        return false;
+    }
+    const int bandRows = static_cast<int>(std::min<size_t>(fit, height));
+    if (bandRowsUsed) *bandRowsUsed = bandRows;
+
+    std::ofstream out(outputFile, std::ios::binary);
+    if (!out) {
+        std::cerr << "Error: Could not open output file '" << outputFile << "'." << std::endl;
+        return false;
+    }
+    writeBMPHeaders(out, layout);
+
+    const int maxSlice = std::min(bandRows + 2 * halo, height);
+    std::vector<uint8_t> input(static_cast<size_t>(maxSlice) * stride);
+    std::vector<uint8_t> output(static_cast<size_t>(maxSlice) * stride);
+    int loadedTop = 0;   // image row held in input[0]
+    int loadedRows = 0;
+
+    // Band boundaries sit at multiples of bandRows from the bottom image row
+    // (row 0 of a BMP view), so for top-down files the short band comes first.
+    int rows = layout.topDown && height % bandRows ? height % bandRows : bandRows;
+    for (int top = 0; top < height; top += rows, rows = bandRows) {
+        rows = std::min(rows, height - top);
+        const int sliceTop = std::max(0, top - halo);
+        const int sliceEnd = std::min(height, top + rows + halo);
+
+        // Keep the rows still needed as halo, then read the rest in one call.
+        int drop = sliceTop - loadedTop;
+        if (drop > 0) {
+            std::memmove(input.data(), input.data() + static_cast<size_t>(drop) * stride,
+                         static_cast<size_t>(loadedRows - drop) * stride);
+            loadedTop = sliceTop;
+            loadedRows -= drop;
+        }
+        int fresh = sliceEnd - (loadedTop + loadedRows);
+        if (fresh > 0) {
+            size_t bytes = static_cast<size_t>(fresh) * stride;
+            in.read(reinterpret_cast<char*>(input.data() + static_cast<size_t>(loadedRows) * stride), bytes);
+            if (static_cast<size_t>(in.gcount()) != bytes) {
+                std::cerr << "Error: '" << inputFile << "' is truncated." << std::endl;
+                return false;
+            }
+            loadedRows += fresh;
+        }
+
+        const int sliceRowsNow = sliceEnd - sliceTop;
+        std::memcpy(output.data(), input.data(), static_cast<size_t>(sliceRowsNow) * stride);
+        ConstImageView inView = bmpPixelView(static_cast<const uint8_t*>(input.data()), layout.width, sliceRowsNow,
+                                             layout.channels, layout.stride, layout.topDown);
+        ImageView outView = bmpPixelView(output.data(), layout.width, sliceRowsNow, layout.channels, layout.stride,
+                                         layout.topDown);
+        filter(inView, outView);
+
+        out.write(reinterpret_cast<const char*>(output.data() + static_cast<size_t>(top - sliceTop) * stride),
+                  static_cast<size_t>(rows) * stride);
+        if (!out) {
+            std::cerr << "Error: Could not write '" << outputFile << "'." << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,269 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <deque>
+#include <map>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <system_error>
+
+#include "bmp_io.h"
+#include "thread_pool.h"
+
+// Batch execution of a per-image tool over a directory or a manifest.
+//
+// One process handles the whole list, so the thread pool is started once and
+// stays warm from image to image. Images go through three stages at once: a
+// reader thread decodes the next files, lane threads process the decoded ones,
+// and a writer thread encodes the finished ones, so disk and compute overlap.
+// Up to `lanes` images are processed at the same time, each on a lane thread
+// of its own; the filters an image runs split their tiles over the shared
+// pool, so a large image still uses every thread and small ones do not leave
+// any idle. Lanes are not pool tasks themselves: a lane waits for the reader,
+// and a thread that picked one up while helping with another image's tiles
+// would hold that image back until the whole list is done.
+//
+// The reader stops while the images already read but not yet written would
+// exceed the memory budget (measured by file size), so memory stays bounded
+// however long the list is. One image is always admitted, even when it alone
+// is over the budget. The tools' own scratch (e.g. the output copy of a
+// filter) comes on top, once per lane.
+
+struct BatchJob {
+    std::string input;
+    std::string output;
+};
+
+// The bitmaps in a directory, in name order, each written under the same name
+// in outputDir.
+inline bool listBatchDirectory(const std::string& directory, const std::string& outputDir, std::vector<BatchJob>& jobs) {
+    namespace fs = std::filesystem;
+    std::error_code error;
+    std::vector<fs::path> files;
+    for (fs::directory_iterator it(directory, error), end; !error && it != end; it.increment(error)) {
+        std::string extension = it->path().extension().string();
+        std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return std::tolower(c); });
+        // A broken link or an unreadable entry is skipped, not fatal.
+        std::error_code entryError;
+        if (extension == ".bmp" && it->is_regular_file(entryError)) files.push_back(it->path());
+    }
+    if (error) {
+        std::cerr << "Error: Cannot list '" << directory << "': " << error.message() << "." << std::endl;
+        return false;
+    }
+    std::sort(files.begin(), files.end());
+    for (const fs::path& file : files) {
+        jobs.push_back({file.string(), (fs::path(outputDir) / file.filename()).string()});
+    }
+    return true;
+}
+
+// "<input.bmp> [<output.bmp>]" per line; blank lines and lines starting with
+// # are skipped. Outputs are relative to outputDir and default to the input's
+// file name there.
+inline bool readBatchManifest(const std::string& manifest, const std::string& outputDir, std::vector<BatchJob>& jobs) {
+    namespace fs = std::filesystem;
+    std::ifstream file(manifest);
+    if (!file) {
+        std::cerr << "Error: Cannot open '" << manifest << "'." << std::endl;
+        return false;
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream fields(line);
+        std::string input, output;
+        if (!(fields >> input) || input[0] == '#') continue;
+        if (!(fields >> output)) output = fs::path(input).filename().string();
+        jobs.push_back({input, (fs::path(outputDir) / output).string()});
+    }
+    return true;
+}
+
+// source is a directory of bitmaps or a manifest file. The output directories
+// are created as needed. Two jobs writing the same file (e.g. manifest inputs
+// of the same name from different directories) are an error.
+inline bool collectBatchJobs(const std::string& source, const std::string& outputDir, std::vector<BatchJob>& jobs) {
+    namespace fs = std::filesystem;
+    std::error_code error;
+    bool ok = fs::is_directory(source, error) ? listBatchDirectory(source, outputDir, jobs)
+                                              : readBatchManifest(source, outputDir, jobs);
+    if (!ok) return false;
+    if (jobs.empty()) {
+        std::cerr << "Error: No BMP files in '" << source << "'." << std::endl;
+        return false;
+    }
+    std::map<std::string, const BatchJob*> outputs;
+    bool unique = true;
+    for (const BatchJob& job : jobs) {
+        auto inserted = outputs.emplace(fs::path(job.output).lexically_normal().string(), &job);
+        if (!inserted.second) {
+            std::cerr << "Error: '" << inserted.first->second->input << "' and '" << job.input << "' would both be written to '"
+                      << job.output << "'." << std::endl;
+            unique = false;
+        }
+    }
+    if (!unique) return false;
+    for (const BatchJob& job : jobs) {
+        fs::path parent = fs::path(job.output).parent_path();
+        if (!parent.empty() && !fs::is_directory(parent, error) && !fs::create_directories(parent, error)) {
+            std::cerr << "Error: Cannot create '" << parent.string() << "': " << error.message() << "." << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+struct BatchOptions {
+    size_t memoryBudget = size_t(256) << 20;  // bytes of decoded images between the stages
+    int lanes = 0;                            // images processed at once; 0 for one per pool thread
+};
+
+// Processes one decoded image in place; it may also replace it, e.g. by one of
+// another size. Returns false (after printing why) to skip writing it. A line
+// left in note is printed next to the output name once the image is written.
+typedef std::function<bool(BMPImage& image, const BatchJob& job, std::string& note)> BatchProcess;
+
+struct BatchReport {
+    int images = 0;   // written
+    int failed = 0;   // not read, not processed or not written
+    size_t bytes = 0;  // input bytes of the written images
+    double seconds = 0;
+
+    void print(std::ostream& out) const {
+        double rate = seconds > 0 ? images / seconds : 0;
+        double throughput = seconds > 0 ? bytes / seconds / (1 << 20) : 0;
+        out << "Processed " << images << " of " << images + failed << " images in " << std::fixed
+            << std::setprecision(2) << seconds << " s: " << std::setprecision(1) << rate << " images/s, "
+            << throughput << " MB/s." << std::defaultfloat << std::setprecision(6) << std::endl;
+    }
+};
+
+inline BatchReport runBatch(const std::vector<BatchJob>& jobs, ThreadPool& pool, const BatchOptions& options,
+                            const BatchProcess& process) {
+    struct Slot {
+        BMPImage image;
+        size_t bytes = 0;  // charged against the budget
+        bool ok = false;
+        std::string note;
+    };
+    const int count = static_cast<int>(jobs.size());
+    std::vector<Slot> slots(count);
+    std::deque<int> decoded, processed;
+    size_t inFlight = 0;
+    bool readerDone = false, processingDone = false;
+    std::mutex mutex;
+    std::condition_variable changed;
+
+    BatchReport report;
+    auto start = std::chrono::steady_clock::now();
+
+    std::thread reader([&] {
+        for (int i = 0; i < count; ++i) {
+            std::error_code error;
+            uintmax_t size = std::filesystem::file_size(jobs[i].input, error);
+            size_t bytes = error ? 0 : static_cast<size_t>(size);
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&] { return inFlight == 0 || inFlight + bytes <= options.memoryBudget; });
+                inFlight += bytes;
+            }
+            slots[i].bytes = bytes;
+            slots[i].ok = readBMP(jobs[i].input, slots[i].image);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                decoded.push_back(i);
+            }
+            changed.notify_all();
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        readerDone = true;
+        changed.notify_all();
+    });
+
+    std::thread writer([&] {
+        for (;;) {
+            int i;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&] { return !processed.empty() || processingDone; });
+                if (processed.empty()) return;
+                i = processed.front();
+                processed.pop_front();
+            }
+            Slot& slot = slots[i];
+            bool written = slot.ok && writeBMP(jobs[i].output, slot.image);
+            if (written && !slot.note.empty()) std::cout << jobs[i].output << ": " << slot.note << std::endl;
+            slot.image = BMPImage();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                inFlight -= slot.bytes;
+                if (written) {
+                    report.images++;
+                    report.bytes += slot.bytes;
+                } else {
+                    report.failed++;
+                }
+            }
+            changed.notify_all();
+        }
+    });
+
+    // Every lane takes the next decoded image until the reader has run dry.
+    auto lane = [&] {
+        for (;;) {
+            int i;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&] { return !decoded.empty() || readerDone; });
+                if (decoded.empty()) return;
+                i = decoded.front();
+                decoded.pop_front();
+            }
+            Slot& slot = slots[i];
+            if (slot.ok) slot.ok = process(slot.image, jobs[i], slot.note);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                processed.push_back(i);
+            }
+            changed.notify_all();
+        }
+    };
+    int lanes = std::min(options.lanes > 0 ? options.lanes : pool.size(), count);
+    std::vector<std::thread> laneThreads;
+    for (int i = 1; i < lanes; ++i) laneThreads.emplace_back(lane);
+    lane();
+    for (std::thread& thread : laneThreads) thread.join();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        processingDone = true;
+    }
+    changed.notify_all();
+    reader.join();
+    writer.join();
+
+    report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return report;
+}
+
+// Collects the jobs, runs them and prints the throughput; false if any image
+// failed.
+inline bool runBatchTool(const std::string& source, const std::string& outputDir, ThreadPool& pool,
+                         const BatchOptions& options, const BatchProcess& process) {
+    std::vector<BatchJob> jobs;
+    if (!collectBatchJobs(source, outputDir, jobs)) {
+        return false;
+    }
+    BatchReport report = runBatch(jobs, pool, options, process);
+    report.print(std::cout);
+    return report.failed == 0;
+}
@@ -0,0 +1,176 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <cstddef>
+
+// Bilateral filtering for 8-bit planes.
+//
+// bilateralFilterLUT is the brute-force filter with both exponentials taken
+// out of the inner loop: the spatial weights form a k x k table and the range
+// weight only depends on |I(q) - I(p)|, so 256 entries cover it. The weights
+// are computed with the same float expressions as before, so the output is
+// identical to the per-tap std::exp version.
+//
+// bilateralFilterGrid is the bilateral grid approximation (Paris & Durand
+// 2006, Chen et al. 2007): pixels are splatted into a coarse 3D grid
+// (x / sigmaSpatial, y / sigmaSpatial, I / sigmaRange), the grid is blurred
+// with a small separable kernel and the result is read back with trilinear
+// interpolation. Its cost does not depend on the kernel radius.
+//
+// Strides are in bytes and may be negative; srcStep/dstStep are the byte
+// distances between neighbouring pixels, as in convolveSeparable.
+
+namespace bilateral {
+
+inline int clampIndex(int value, int maxValue) {
+    return value < 0 ? 0 : (value > maxValue ? maxValue : value);
+}
+
+}  // namespace bilateral
+
+inline void bilateralFilterLUT(const uint8_t* src, ptrdiff_t srcStride, uint8_t* dst, ptrdiff_t dstStride,
+                               int width, int height, int kernelSize,
+                               float sigmaSpatial, float sigmaRange, int srcStep = 1, int dstStep = 1) {
+    const int halfKernel = kernelSize / 2;
+    const int size = 2 * halfKernel + 1;
+
+    std::vector<float> spatial(size * size);
+    for (int ky = -halfKernel; ky <= halfKernel; ++ky) {
+        for (int kx = -halfKernel; kx <= halfKernel; ++kx) {
+            float spatialDistance = kx * kx + ky * ky;
+            spatial[(ky + halfKernel) * size + kx + halfKernel] =
+                std::exp(-spatialDistance / (2 * sigmaSpatial * sigmaSpatial));
+        }
+    }
+    float range[256];
+    for (int d = 0; d < 256; ++d) {
+        float intensityDifference = static_cast<float>(d);
+        range[d] = std::exp(-(intensityDifference * intensityDifference) / (2 * sigmaRange * sigmaRange));
+    }
+
+    for (int y = 0; y < height; ++y) {
+        uint8_t* out = dst + y * dstStride;
+        for (int x = 0; x < width; ++x) {
+            float sum = 0.0f;
+            float normFactor = 0.0f;
+            const int center = src[y * srcStride + x * srcStep];
+
+            for (int ky = -halfKernel; ky <= halfKernel; ++ky) {
+                const uint8_t* row = src + bilateral::clampIndex(y + ky, height - 1) * srcStride;
+                const float* spatialRow = &spatial[(ky + halfKernel) * size + halfKernel];
+                for (int kx = -halfKernel; kx <= halfKernel; ++kx) {
+                    int neighbor = row[bilateral::clampIndex(x + kx, width - 1) * srcStep];
+                    float weight = spatialRow[kx] * range[std::abs(neighbor - center)];
+                    sum += static_cast<float>(neighbor) * weight;
+                    normFactor += weight;
+                }
+            }
+
+            int v = static_cast<int>(sum / normFactor + 0.5f);
+            out[x * dstStep] = static_cast<uint8_t>(v < 0 ? 0 : (v > 255 ? 255 : v));
+        }
+    }
+}
+
+inline void bilateralFilterGrid(const uint8_t* src, ptrdiff_t srcStride, uint8_t* dst, ptrdiff_t dstStride,
+                                int width, int height, float sigmaSpatial, float sigmaRange,
+                                int srcStep = 1, int dstStep = 1) {
+    if (width <= 0 || height <= 0) return;
+
+    const int pad = 2;  // half-width of the [1 4 6 4 1] blur
+    const float invS = 1.0f / sigmaSpatial;
+    const float invR = 1.0f / sigmaRange;
+    // The blur reaches 2 cells = 2 * sigmaSpatial pixels, so that many rows and
+    // columns of replicated edge pixels are splatted around the image to match
+    // the clamp-to-edge border of the exact filter.
+    const int border = static_cast<int>(std::ceil(2 * sigmaSpatial));
+    const int gw = static_cast<int>((width - 1 + 2 * border) * invS) + 2 + 2 * pad;
+    const int gh = static_cast<int>((height - 1 + 2 * border) * invS) + 2 + 2 * pad;
+    const int gd = static_cast<int>(255 * invR) + 2 + 2 * pad;
+    const size_t cells = static_cast<size_t>(gw) * gh * gd;
+
+    // Interleaved (value, weight) pairs; z is the fastest axis.
+    std::vector<float> grid(cells * 2, 0.0f), scratch(cells * 2);
+    auto cell = [&](int gx, int gy, int gz) { return ((static_cast<size_t>(gy) * gw + gx) * gd + gz) * 2; };
+
+    // Splat with trilinear weights.
+    for (int y = -border; y < height + border; ++y) {
+        const uint8_t* row = src + bilateral::clampIndex(y, height - 1) * srcStride;
+        float fy = (y + border) * invS + pad;
+        int y0 = static_cast<int>(fy);
+        float ty = fy - y0;
+        for (int x = -border; x < width + border; ++x) {
+            float value = row[bilateral::clampIndex(x, width - 1) * srcStep];
+            float fx = (x + border) * invS + pad;
+            float fz = value * invR + pad;
+            int x0 = static_cast<int>(fx), z0 = static_cast<int>(fz);
+            float tx = fx - x0, tz = fz - z0;
+            for (int dy = 0; dy < 2; ++dy) {
+                float wy = dy ? ty : 1 - ty;
+                for (int dx = 0; dx < 2; ++dx) {
+                    float wxy = wy * (dx ? tx : 1 - tx);
+                    for (int dz = 0; dz < 2; ++dz) {
+                        float w = wxy * (dz ? tz : 1 - tz);
+                        size_t i = cell(x0 + dx, y0 + dy, z0 + dz);
+                        grid[i] += w * value;
+                        grid[i + 1] += w;
+                    }
+                }
+            }
+        }
+    }
+
+    // [1 4 6 4 1] / 16 along each axis: variance 1 cell, i.e. sigmaSpatial
+    // pixels and sigmaRange intensity levels.
+    const float taps[5] = {1 / 16.0f, 4 / 16.0f, 6 / 16.0f, 4 / 16.0f, 1 / 16.0f};
+    auto blurAxis = [&](size_t stride, int extent, auto index) {
+        std::fill(scratch.begin(), scratch.end(), 0.0f);
+        for (size_t base = 0; base < cells; ++base) {
+            int pos = index(base);
+            for (int t = -2; t <= 2; ++t) {
+                int p = pos + t;
+                if (p < 0 || p >= extent) continue;
+                size_t from = (base + t * static_cast<ptrdiff_t>(stride)) * 2;
+                scratch[base * 2] += taps[t + 2] * grid[from];
+                scratch[base * 2 + 1] += taps[t + 2] * grid[from + 1];
+            }
+        }
+        grid.swap(scratch);
+    };
+    blurAxis(1, gd, [&](size_t i) { return static_cast<int>(i % gd); });
+    blurAxis(gd, gw, [&](size_t i) { return static_cast<int>((i / gd) % gw); });
+    blurAxis(static_cast<size_t>(gd) * gw, gh, [&](size_t i) { return static_cast<int>(i / (static_cast<size_t>(gd) * gw)); });
+
+    // Slice: trilinear read-back at each pixel's own position.
+    for (int y = 0; y < height; ++y) {
+        const uint8_t* row = src + y * srcStride;
+        uint8_t* out = dst + y * dstStride;
+        float fy = (y + border) * invS + pad;
+        int y0 = static_cast<int>(fy);
+        float ty = fy - y0;
+        for (int x = 0; x < width; ++x) {
+            float fx = (x + border) * invS + pad;
+            float fz = row[x * srcStep] * invR + pad;
+            int x0 = static_cast<int>(fx), z0 = static_cast<int>(fz);
+            float tx = fx - x0, tz = fz - z0;
+            float num = 0.0f, den = 0.0f;
+            for (int dy = 0; dy < 2; ++dy) {
+                float wy = dy ? ty : 1 - ty;
+                for (int dx = 0; dx < 2; ++dx) {
+                    float wxy = wy * (dx ? tx : 1 - tx);
+                    for (int dz = 0; dz < 2; ++dz) {
+                        float w = wxy * (dz ? tz : 1 - tz);
+                        size_t i = cell(x0 + dx, y0 + dy, z0 + dz);
+                        num += w * grid[i];
+                        den += w * grid[i + 1];
+                    }
+                }
+            }
+            int v = den > 0 ? static_cast<int>(num / den + 0.5f) : row[x * srcStep];
+            out[x * dstStep] = static_cast<uint8_t>(v < 0 ? 0 : (v > 255 ? 255 : v));
+        }
+    }
+}
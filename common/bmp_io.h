@@ -0,0 +1,341 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <cstddef>
+#include <algorithm>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Shared BMP reader/writer for all tools.
+//
+// The pixel array is read and written with a single stream call and kept in
+// its on-disk layout (rows padded to 4 bytes, bottom-up or top-down as the
+// header says). Tools access it through ImageView, a stride-aware view whose
+// row 0 is always the first row of a bottom-up file, i.e. the bottom of the
+// picture; top-down files get a negative stride so the tools see the same
+// orientation either way. 24-bit and 32-bit uncompressed files are supported.
+//
+// mapBMP is the zero-copy alternative for large inputs: the file is mapped
+// read-only and filters read the pixel array straight from the page cache
+// through the same kind of view.
+
+#pragma pack(push, 1)
+struct BMPHeader {
+    uint16_t fileType;
+    uint32_t fileSize;
+    uint16_t reserved1;
+    uint16_t reserved2;
+    uint32_t offsetData;
+};
+
+struct BMPInfoHeader {
+    uint32_t size;
+    int32_t width;
+    int32_t height;
+    uint16_t planes;
+    uint16_t bitCount;
+    uint32_t compression;
+    uint32_t imageSize;
+    int32_t xPixelsPerMeter;
+    int32_t yPixelsPerMeter;
+    uint32_t colorsUsed;
+    uint32_t colorsImportant;
+};
+#pragma pack(pop)
+
+// Interleaved 8-bit pixels, `channels` bytes per pixel in B, G, R(, A) order.
+// stride is the byte distance between consecutive rows and may be negative.
+template <typename T>
+struct BasicImageView {
+    T* data = nullptr;
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    ptrdiff_t stride = 0;
+
+    BasicImageView() = default;
+    // Lets an ImageView be passed where a ConstImageView is expected.
+    template <typename U>
+    BasicImageView(const BasicImageView<U>& other)
+        : data(other.data), width(other.width), height(other.height), channels(other.channels), stride(other.stride) {}
+
+    T* row(int y) const { return data + y * stride; }
+    T* pixel(int x, int y) const { return row(y) + x * channels; }
+    // The w x h rectangle whose row 0, column 0 is (x, y).
+    BasicImageView sub(int x, int y, int w, int h) const {
+        BasicImageView v = *this;
+        v.data = pixel(x, y);
+        v.width = w;
+        v.height = h;
+        return v;
+    }
+};
+
+typedef BasicImageView<uint8_t> ImageView;
+typedef BasicImageView<const uint8_t> ConstImageView;
+
+// View over a stored pixel array; bottom-up rows are kept as they are and
+// top-down rows are walked backwards so row 0 is the bottom row in both cases.
+template <typename T>
+BasicImageView<T> bmpPixelView(T* pixels, int width, int height, int channels, int stride, bool topDown) {
+    BasicImageView<T> v;
+    v.width = width;
+    v.height = height;
+    v.channels = channels;
+    v.stride = topDown ? -static_cast<ptrdiff_t>(stride) : stride;
+    v.data = pixels + (topDown ? static_cast<size_t>(height - 1) * stride : 0);
+    return v;
+}
+
+struct BMPImage {
+    BMPHeader header{};
+    BMPInfoHeader info{};
+    std::vector<uint8_t> extraHeader;  // anything between the info header and the pixels (V4/V5 fields)
+    std::vector<uint8_t> pixels;       // the pixel array exactly as stored in the file
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    int stride = 0;  // padded bytes per stored row
+    bool topDown = false;
+
+    ImageView view() {
+        return bmpPixelView(pixels.data(), width, height, channels, stride, topDown);
+    }
+
+    ConstImageView view() const {
+        return bmpPixelView(pixels.data(), width, height, channels, stride, topDown);
+    }
+};
+
+inline int bmpRowStride(int width, int channels) {
+    return (width * channels + 3) & ~3;
+}
+
+// Fills in the layout fields and (re)allocates the pixel array for a new size,
+// keeping the orientation and format of the existing headers.
+inline void resizeBMP(BMPImage& image, int width, int height) {
+    image.width = width;
+    image.height = height;
+    image.stride = bmpRowStride(width, image.channels);
+    image.pixels.assign(static_cast<size_t>(image.stride) * height, 0);
+
+    image.info.width = width;
+    image.info.height = image.topDown ? -height : height;
+    image.info.imageSize = static_cast<uint32_t>(image.pixels.size());
+    image.header.offsetData = static_cast<uint32_t>(sizeof(BMPHeader) + sizeof(BMPInfoHeader) + image.extraHeader.size());
+    image.header.fileSize = image.header.offsetData + image.info.imageSize;
+}
+
+// Headers beyond the V5 info header (colour masks, a palette some writers
+// add to 24-bit files) stay far below this; a larger pixel offset is taken as
+// a corrupt file rather than allocated.
+const uint32_t kMaxBMPHeaderBytes = 1 << 16;
+
+// Checks the headers already stored in image against the size of the file
+// they came from and fills in the layout fields.
+inline bool parseBMPLayout(BMPImage& image, const std::string& filename, uint64_t fileSize) {
+    if (image.header.fileType != 0x4D42) {
+        std::cerr << "Error: '" << filename << "' is not a BMP file." << std::endl;
+        return false;
+    }
+    // BI_BITFIELDS (3) is allowed for 32-bit files as long as the masks are the
+    // usual BGRA ones, which is what every writer we have produces.
+    bool uncompressed = image.info.compression == 0 || (image.info.compression == 3 && image.info.bitCount == 32);
+    if ((image.info.bitCount != 24 && image.info.bitCount != 32) || !uncompressed) {
+        std::cerr << "Error: Only uncompressed 24-bit and 32-bit BMP files are supported." << std::endl;
+        return false;
+    }
+    // Rows must be addressable with an int stride, and -height must exist.
+    const int32_t maxWidth = (INT32_MAX - 3) / 4;
+    if (image.header.offsetData < sizeof(BMPHeader) + sizeof(BMPInfoHeader) || image.header.offsetData > kMaxBMPHeaderBytes ||
+        image.info.width <= 0 || image.info.width > maxWidth || image.info.height == 0 || image.info.height == INT32_MIN) {
+        std::cerr << "Error: Corrupt BMP header in '" << filename << "'." << std::endl;
+        return false;
+    }
+
+    image.width = image.info.width;
+    image.height = image.info.height < 0 ? -image.info.height : image.info.height;
+    image.topDown = image.info.height < 0;
+    image.channels = image.info.bitCount / 8;
+    image.stride = bmpRowStride(image.width, image.channels);
+    // Checked before anything is allocated for the pixels.
+    if (image.header.offsetData + static_cast<uint64_t>(image.stride) * image.height > fileSize) {
+        std::cerr << "Error: '" << filename << "' is truncated." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Reads the headers (including any V4/V5 extension) and leaves the stream at
+// the first pixel row. Used by readBMP and by the streaming executor.
+inline bool readBMPHeaders(std::istream& file, BMPImage& image, const std::string& filename) {
+    file.seekg(0, std::ios::end);
+    std::streamoff fileSize = file.tellg();
+    file.seekg(0, std::ios::beg);
+    file.read(reinterpret_cast<char*>(&image.header), sizeof(image.header));
+    file.read(reinterpret_cast<char*>(&image.info), sizeof(image.info));
+    if (!file) {
+        std::cerr << "Error: '" << filename << "' is not a BMP file." << std::endl;
+        return false;
+    }
+    if (!parseBMPLayout(image, filename, static_cast<uint64_t>(std::max<std::streamoff>(fileSize, 0)))) return false;
+
+    image.extraHeader.resize(image.header.offsetData - sizeof(BMPHeader) - sizeof(BMPInfoHeader));
+    if (!image.extraHeader.empty()) {
+        file.read(reinterpret_cast<char*>(image.extraHeader.data()), image.extraHeader.size());
+    }
+    file.seekg(image.header.offsetData, std::ios::beg);
+    return static_cast<bool>(file);
+}
+
+inline bool readBMP(const std::string& filename, BMPImage& image) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) {
+        std::cerr << "Error: Could not open input file '" << filename << "'." << std::endl;
+        return false;
+    }
+    if (!readBMPHeaders(file, image, filename)) return false;
+
+    // One read for the whole pixel array.
+    image.pixels.resize(static_cast<size_t>(image.stride) * image.height);
+    file.read(reinterpret_cast<char*>(image.pixels.data()), image.pixels.size());
+    if (file.gcount() != static_cast<std::streamsize>(image.pixels.size())) {
+        std::cerr << "Error: '" << filename << "' is truncated." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Read-only mapping of a BMP file. `image` carries the headers and layout but
+// its pixel vector stays empty; the pixels are read through view(), which
+// points into the mapping. Peak memory for a filter is then the output image
+// only, and the input pages can be dropped by the kernel once they are read.
+struct MappedBMP {
+    BMPImage image;
+    const uint8_t* pixels = nullptr;
+
+    MappedBMP() = default;
+    MappedBMP(const MappedBMP&) = delete;
+    MappedBMP& operator=(const MappedBMP&) = delete;
+    ~MappedBMP() { unmap(); }
+
+    ConstImageView view() const {
+        return bmpPixelView(pixels, image.width, image.height, image.channels, image.stride, image.topDown);
+    }
+
+    void unmap() {
+#ifndef _WIN32
+        if (base) munmap(base, length);
+#endif
+        base = nullptr;
+        length = 0;
+        pixels = nullptr;
+        fallback.clear();
+    }
+
+    void* base = nullptr;
+    size_t length = 0;
+    std::vector<uint8_t> fallback;  // whole file, where mmap is not available
+};
+
+inline bool mapBMP(const std::string& filename, MappedBMP& mapped) {
+    mapped.unmap();
+    const uint8_t* bytes = nullptr;
+    size_t length = 0;
+
+#ifndef _WIN32
+    int fd = open(filename.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) close(fd);
+        std::cerr << "Error: Could not open input file '" << filename << "'." << std::endl;
+        return false;
+    }
+    length = static_cast<size_t>(st.st_size);
+    void* base = length > 0 ? mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (base == MAP_FAILED) {
+        std::cerr << "Error: Could not map input file '" << filename << "'." << std::endl;
+        return false;
+    }
+    // Filters walk the rows front to back, so let the kernel read ahead and
+    // drop pages behind them.
+    madvise(base, length, MADV_SEQUENTIAL);
+    mapped.base = base;
+    mapped.length = length;
+    bytes = static_cast<const uint8_t*>(base);
+#else
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    if (!file) {
+        std::cerr << "Error: Could not open input file '" << filename << "'." << std::endl;
+        return false;
+    }
+    mapped.fallback.resize(static_cast<size_t>(file.tellg()));
+    file.seekg(0, std::ios::beg);
+    file.read(reinterpret_cast<char*>(mapped.fallback.data()), mapped.fallback.size());
+    length = mapped.fallback.size();
+    bytes = mapped.fallback.data();
+#endif
+
+    BMPImage& image = mapped.image;
+    size_t headerBytes = sizeof(BMPHeader) + sizeof(BMPInfoHeader);
+    if (length < headerBytes) {
+        std::cerr << "Error: '" << filename << "' is not a BMP file." << std::endl;
+        mapped.unmap();
+        return false;
+    }
+    std::memcpy(&image.header, bytes, sizeof(BMPHeader));
+    std::memcpy(&image.info, bytes + sizeof(BMPHeader), sizeof(BMPInfoHeader));
+    if (!parseBMPLayout(image, filename, length)) {
+        mapped.unmap();
+        return false;
+    }
+    image.extraHeader.assign(bytes + headerBytes, bytes + image.header.offsetData);
+    image.pixels.clear();
+    mapped.pixels = bytes + image.header.offsetData;
+    return true;
+}
+
+// Writable in-memory copy of a mapped file, e.g. as the output of a filter
+// that only replaces some of the channels. Filters start their output from
+// this copy so row padding and the alpha channel carry over unchanged.
+inline BMPImage copyBMP(const MappedBMP& mapped) {
+    BMPImage image = mapped.image;
+    image.pixels.assign(mapped.pixels, mapped.pixels + static_cast<size_t>(image.stride) * image.height);
+    return image;
+}
+
+// Writes the headers for image's layout; the pixel rows follow.
+inline void writeBMPHeaders(std::ostream& file, const BMPImage& image) {
+    BMPHeader header = image.header;
+    BMPInfoHeader info = image.info;
+    header.offsetData = static_cast<uint32_t>(sizeof(header) + sizeof(info) + image.extraHeader.size());
+    header.fileSize = header.offsetData + static_cast<uint32_t>(static_cast<size_t>(image.stride) * image.height);
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(&info), sizeof(info));
+    file.write(reinterpret_cast<const char*>(image.extraHeader.data()), image.extraHeader.size());
+}
+
+inline bool writeBMP(const std::string& filename, const BMPImage& image) {
+    std::ofstream file(filename, std::ios::binary);
+    if (!file) {
+        std::cerr << "Error: Could not open output file '" << filename << "'." << std::endl;
+        return false;
+    }
+
+    writeBMPHeaders(file, image);
+    file.write(reinterpret_cast<const char*>(image.pixels.data()), image.pixels.size());
+    return static_cast<bool>(file);
+}
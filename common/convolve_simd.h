@@ -0,0 +1,221 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+
+#include "simd_dispatch.h"
+
+// Dense k x k convolution of 8-bit images with vectorized kernels.
+//
+// Input rows are converted once into a ring of k float rows padded by the
+// kernel radius with replicated edge pixels, so the tap loop needs no
+// clamping and every tap is one unaligned load of consecutive pixels: 8 per
+// instruction with AVX2, 4 with SSE4.1 or NEON. Each output pixel is summed
+// in float, tap by tap in row-major kernel order with a separate multiply and
+// add, and then clamped to [0, 255] and truncated. The scalar path does
+// exactly the same operations one pixel at a time, so all paths give
+// bit-identical output and the scalar one serves as the reference.
+//
+// The path is picked as described in simd_dispatch.h.
+
+// A fused multiply-add rounds once instead of twice and would break the
+// equality with the scalar path; GCC contracts a * b + c by default on ARM.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC push_options
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+namespace simd {
+
+inline int clampIndex(int value, int maxValue) {
+    return value < 0 ? 0 : (value > maxValue ? maxValue : value);
+}
+
+inline uint8_t toByte(float sum) {
+    sum = sum < 0.0f ? 0.0f : (sum > 255.0f ? 255.0f : sum);
+    return static_cast<uint8_t>(static_cast<int>(sum));
+}
+
+// One output pixel from k padded rows; rows[ky] already points at column x.
+inline float convolvePixel(const float* const* rows, const float* kernel, int size, int x) {
+    float sum = 0.0f;
+    for (int ky = 0; ky < size; ++ky) {
+        const float* row = rows[ky] + x;
+        const float* weights = kernel + ky * size;
+        for (int kx = 0; kx < size; ++kx) {
+            float product = row[kx] * weights[kx];
+            sum = sum + product;
+        }
+    }
+    return sum;
+}
+
+inline void convolveRowScalar(const float* const* rows, const float* kernel, int size, int width, float* out) {
+    for (int x = 0; x < width; ++x) out[x] = convolvePixel(rows, kernel, size, x);
+}
+
+#if defined(SIMD_X86)
+__attribute__((target("avx2")))
+inline void convolveRowAVX2(const float* const* rows, const float* kernel, int size, int width, float* out) {
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        __m256 sum = _mm256_setzero_ps();
+        for (int ky = 0; ky < size; ++ky) {
+            const float* row = rows[ky] + x;
+            const float* weights = kernel + ky * size;
+            for (int kx = 0; kx < size; ++kx) {
+                __m256 product = _mm256_mul_ps(_mm256_loadu_ps(row + kx), _mm256_set1_ps(weights[kx]));
+                sum = _mm256_add_ps(sum, product);
+            }
+        }
+        _mm256_storeu_ps(out + x, sum);
+    }
+    for (; x < width; ++x) out[x] = convolvePixel(rows, kernel, size, x);
+}
+
+__attribute__((target("sse4.1")))
+inline void convolveRowSSE41(const float* const* rows, const float* kernel, int size, int width, float* out) {
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+        __m128 sum = _mm_setzero_ps();
+        for (int ky = 0; ky < size; ++ky) {
+            const float* row = rows[ky] + x;
+            const float* weights = kernel + ky * size;
+            for (int kx = 0; kx < size; ++kx) {
+                __m128 product = _mm_mul_ps(_mm_loadu_ps(row + kx), _mm_set1_ps(weights[kx]));
+                sum = _mm_add_ps(sum, product);
+            }
+        }
+        _mm_storeu_ps(out + x, sum);
+    }
+    for (; x < width; ++x) out[x] = convolvePixel(rows, kernel, size, x);
+}
+
+// uint8 -> float row conversion, 8 pixels at a time.
+__attribute__((target("avx2")))
+inline void widenAVX2(const uint8_t* in, float* out, int count) {
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(in + i));
+        _mm256_storeu_ps(out + i, _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes)));
+    }
+    for (; i < count; ++i) out[i] = in[i];
+}
+
+__attribute__((target("sse4.1")))
+inline void widenSSE41(const uint8_t* in, float* out, int count) {
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        int32_t packed;
+        std::copy(in + i, in + i + 4, reinterpret_cast<uint8_t*>(&packed));
+        _mm_storeu_ps(out + i, _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(packed))));
+    }
+    for (; i < count; ++i) out[i] = in[i];
+}
+#endif
+
+#if defined(SIMD_NEON)
+inline void convolveRowNEON(const float* const* rows, const float* kernel, int size, int width, float* out) {
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+        float32x4_t sum = vdupq_n_f32(0.0f);
+        for (int ky = 0; ky < size; ++ky) {
+            const float* row = rows[ky] + x;
+            const float* weights = kernel + ky * size;
+            for (int kx = 0; kx < size; ++kx) {
+                // vmulq + vaddq rather than vmlaq/vfmaq, to round like the scalar path.
+                float32x4_t product = vmulq_n_f32(vld1q_f32(row + kx), weights[kx]);
+                sum = vaddq_f32(sum, product);
+            }
+        }
+        vst1q_f32(out + x, sum);
+    }
+    for (; x < width; ++x) out[x] = convolvePixel(rows, kernel, size, x);
+}
+#endif
+
+}  // namespace simd
+
+// Square kernel as convolveKernel2D takes it: float, row-major.
+inline std::vector<float> flattenKernel(const std::vector<std::vector<double>>& kernel) {
+    std::vector<float> flat;
+    flat.reserve(kernel.size() * kernel.size());
+    for (const std::vector<double>& row : kernel) {
+        for (double weight : row) flat.push_back(static_cast<float>(weight));
+    }
+    return flat;
+}
+
+// kernel is size x size, row-major, size odd. Borders replicate the edge pixel
+// like clamp(x + kx, 0, width - 1). srcStep/dstStep are the byte distances
+// between neighbouring pixels, so one channel of an interleaved image can be
+// filtered in place of a plane.
+inline void convolveKernel2D(const uint8_t* src, ptrdiff_t srcStride, uint8_t* dst, ptrdiff_t dstStride,
+                             int width, int height, const std::vector<float>& kernel, int size,
+                             SimdPath path, int srcStep = 1, int dstStep = 1) {
+    if (width <= 0 || height <= 0) return;
+    const int radius = size / 2;
+    const int padded = width + 2 * radius;
+
+    // Padded float copies of the input rows clamp(y - r) .. clamp(y + r); they
+    // are a contiguous range of at most `size` rows, so row i lives in slot
+    // i % size without collisions.
+    std::vector<float> ring(static_cast<size_t>(size) * padded);
+    std::vector<uint8_t> bytes(width);
+    std::vector<float> sums(width);
+    std::vector<const float*> rows(size);
+    int loaded = -1;  // last input row converted
+
+    auto loadRow = [&](int y) {
+        const uint8_t* in = src + y * srcStride;
+        const uint8_t* contiguous = in;
+        if (srcStep != 1) {
+            for (int x = 0; x < width; ++x) bytes[x] = in[x * srcStep];
+            contiguous = bytes.data();
+        }
+        float* out = &ring[static_cast<size_t>(y % size) * padded];
+#if defined(SIMD_X86)
+        if (path == SimdPath::AVX2) {
+            simd::widenAVX2(contiguous, out + radius, width);
+        } else if (path == SimdPath::SSE41) {
+            simd::widenSSE41(contiguous, out + radius, width);
+        } else
+#endif
+        {
+            for (int x = 0; x < width; ++x) out[radius + x] = contiguous[x];
+        }
+        for (int p = 0; p < radius; ++p) {
+            out[p] = out[radius];
+            out[radius + width + p] = out[radius + width - 1];
+        }
+    };
+
+    for (int y = 0; y < height; ++y) {
+        int last = std::min(height - 1, y + radius);
+        while (loaded < last) loadRow(++loaded);
+        for (int ky = 0; ky < size; ++ky) {
+            rows[ky] = &ring[static_cast<size_t>(simd::clampIndex(y + ky - radius, height - 1) % size) * padded];
+        }
+
+        switch (path) {
+#if defined(SIMD_X86)
+            case SimdPath::AVX2: simd::convolveRowAVX2(rows.data(), kernel.data(), size, width, sums.data()); break;
+            case SimdPath::SSE41: simd::convolveRowSSE41(rows.data(), kernel.data(), size, width, sums.data()); break;
+#endif
+#if defined(SIMD_NEON)
+            case SimdPath::NEON: simd::convolveRowNEON(rows.data(), kernel.data(), size, width, sums.data()); break;
+#endif
+            default: simd::convolveRowScalar(rows.data(), kernel.data(), size, width, sums.data()); break;
+        }
+
+        uint8_t* out = dst + y * dstStride;
+        for (int x = 0; x < width; ++x) out[x * dstStep] = simd::toByte(sums[x]);
+    }
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC pop_options
+#endif
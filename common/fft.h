@@ -0,0 +1,323 @@
+#pragma once
+
+#include <vector>
+#include <map>
+#include <mutex>
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+
+// Fast Fourier transforms for the frequency-domain convolution in
+// fft_convolve.h.
+//
+// Complex transforms of any length whose only prime factors are 2, 3 and 5
+// run as Stockham autosort passes of radix 4, 2, 3 and 5: every pass reads
+// one buffer and writes the other in order, so no bit-reversal permutation
+// is needed. Values are kept as separate planes of real and imaginary parts,
+// and a pass transforms `count` interleaved sequences at once, element e of
+// sequence t at [e * count + t]. With count = the row length of a row-major
+// block that is all of its columns together: every butterfly and twiddle is
+// applied to whole row segments, written in groups of 8 so that they become
+// vector instructions even where the compiler will not vectorize a loop of
+// unknown length (GCC at -O2).
+//
+// A real sequence of even length 2n is transformed as the complex sequence
+// of n whose real parts are the even samples and imaginary parts the odd
+// ones, and the result is untangled into the n + 1 non-redundant bins.
+// Transforms are unnormalized; the inverse of the forward transform is the
+// length times the input.
+//
+// A plan (the factorization of its length and the twiddle factors of every
+// pass) is built once per length and kept for the rest of the process.
+
+// Real and imaginary parts of the same values, in two arrays.
+struct SplitComplex {
+    float* re;
+    float* im;
+};
+
+namespace fft {
+
+// Forward DFTs of R points, e^(-2 pi i jk / R), on L lanes at once:
+// x[r][l] is point r of lane l, in place.
+template <int R, int L>
+struct Butterfly;
+
+template <int L>
+struct Butterfly<2, L> {
+    static void run(float (&xr)[2][L], float (&xi)[2][L]) {
+        for (int l = 0; l < L; ++l) {
+            float ar = xr[0][l], ai = xi[0][l], br = xr[1][l], bi = xi[1][l];
+            xr[0][l] = ar + br;
+            xi[0][l] = ai + bi;
+            xr[1][l] = ar - br;
+            xi[1][l] = ai - bi;
+        }
+    }
+};
+
+template <int L>
+struct Butterfly<3, L> {
+    static void run(float (&xr)[3][L], float (&xi)[3][L]) {
+        const float c = -0.5f, s = -0.86602540378443865f;  // cos, sin of -2 pi / 3
+        for (int l = 0; l < L; ++l) {
+            float t1r = xr[1][l] + xr[2][l], t1i = xi[1][l] + xi[2][l];
+            float t2r = xr[1][l] - xr[2][l], t2i = xi[1][l] - xi[2][l];
+            float mr = xr[0][l] + c * t1r, mi = xi[0][l] + c * t1i;
+            float nr = -s * t2i, ni = s * t2r;  // i s t2
+            xr[0][l] += t1r;
+            xi[0][l] += t1i;
+            xr[1][l] = mr + nr;
+            xi[1][l] = mi + ni;
+            xr[2][l] = mr - nr;
+            xi[2][l] = mi - ni;
+        }
+    }
+};
+
+template <int L>
+struct Butterfly<4, L> {
+    static void run(float (&xr)[4][L], float (&xi)[4][L]) {
+        for (int l = 0; l < L; ++l) {
+            float t0r = xr[0][l] + xr[2][l], t0i = xi[0][l] + xi[2][l];
+            float t1r = xr[0][l] - xr[2][l], t1i = xi[0][l] - xi[2][l];
+            float t2r = xr[1][l] + xr[3][l], t2i = xi[1][l] + xi[3][l];
+            float t3r = xi[1][l] - xi[3][l], t3i = xr[3][l] - xr[1][l];  // -i (x1 - x3)
+            xr[0][l] = t0r + t2r;
+            xi[0][l] = t0i + t2i;
+            xr[2][l] = t0r - t2r;
+            xi[2][l] = t0i - t2i;
+            xr[1][l] = t1r + t3r;
+            xi[1][l] = t1i + t3i;
+            xr[3][l] = t1r - t3r;
+            xi[3][l] = t1i - t3i;
+        }
+    }
+};
+
+template <int L>
+struct Butterfly<5, L> {
+    static void run(float (&xr)[5][L], float (&xi)[5][L]) {
+        const float c1 = 0.30901699437494742f, c2 = -0.80901699437494742f;   // cos 2 pi / 5, cos 4 pi / 5
+        const float s1 = -0.95105651629515357f, s2 = -0.58778525229247313f;  // -sin 2 pi / 5, -sin 4 pi / 5
+        for (int l = 0; l < L; ++l) {
+            float t1r = xr[1][l] + xr[4][l], t1i = xi[1][l] + xi[4][l];
+            float t2r = xr[2][l] + xr[3][l], t2i = xi[2][l] + xi[3][l];
+            float t3r = xr[1][l] - xr[4][l], t3i = xi[1][l] - xi[4][l];
+            float t4r = xr[2][l] - xr[3][l], t4i = xi[2][l] - xi[3][l];
+            float m1r = xr[0][l] + c1 * t1r + c2 * t2r, m1i = xi[0][l] + c1 * t1i + c2 * t2i;
+            float m2r = xr[0][l] + c2 * t1r + c1 * t2r, m2i = xi[0][l] + c2 * t1i + c1 * t2i;
+            // i (s1 t3 + s2 t4) and i (s2 t3 - s1 t4)
+            float n1r = -(s1 * t3i + s2 * t4i), n1i = s1 * t3r + s2 * t4r;
+            float n2r = -(s2 * t3i - s1 * t4i), n2i = s2 * t3r - s1 * t4r;
+            xr[0][l] += t1r + t2r;
+            xi[0][l] += t1i + t2i;
+            xr[1][l] = m1r + n1r;
+            xi[1][l] = m1i + n1i;
+            xr[4][l] = m1r - n1r;
+            xi[4][l] = m1i - n1i;
+            xr[2][l] = m2r + n2r;
+            xi[2][l] = m2i + n2i;
+            xr[3][l] = m2r - n2r;
+            xi[3][l] = m2i - n2i;
+        }
+    }
+};
+
+// Lanes t .. t + L - 1 of one butterfly: point r read at in + r * inStep and
+// multiplied by twiddle r (r >= 1), output r written at out + r * outStep.
+template <int R, int L>
+inline void butterflyLanes(SplitComplex in, size_t inStep, SplitComplex out, size_t outStep,
+                           const float* wr, const float* wi, size_t t) {
+    float xr[R][L], xi[R][L];
+    for (int l = 0; l < L; ++l) {
+        xr[0][l] = in.re[t + l];
+        xi[0][l] = in.im[t + l];
+    }
+    for (int r = 1; r < R; ++r) {
+        const float* re = in.re + r * inStep + t;
+        const float* im = in.im + r * inStep + t;
+        for (int l = 0; l < L; ++l) {
+            xr[r][l] = re[l] * wr[r - 1] - im[l] * wi[r - 1];
+            xi[r][l] = re[l] * wi[r - 1] + im[l] * wr[r - 1];
+        }
+    }
+    Butterfly<R, L>::run(xr, xi);
+    for (int r = 0; r < R; ++r) {
+        float* re = out.re + r * outStep + t;
+        float* im = out.im + r * outStep + t;
+        for (int l = 0; l < L; ++l) {
+            re[l] = xr[r][l];
+            im[l] = xi[r][l];
+        }
+    }
+}
+
+// One radix-R pass: sub-transforms of length span become transforms of
+// length span * R. Element j + r * n / R, times its twiddle, goes into the
+// butterfly and output r lands at (j / span) * span * R + j % span + r * span.
+template <int R>
+inline void pass(SplitComplex in, SplitComplex out, int n, int span, const float* twiddleRe, const float* twiddleIm, int count) {
+    const int stride = n / R;
+    for (int j = 0; j < stride; ++j) {
+        const int k = j % span;
+        const size_t source = static_cast<size_t>(j) * count;
+        const size_t target = (static_cast<size_t>(j - k) * R + k) * count;
+        SplitComplex from = {in.re + source, in.im + source};
+        SplitComplex to = {out.re + target, out.im + target};
+        const float* wr = twiddleRe + static_cast<size_t>(k) * (R - 1);
+        const float* wi = twiddleIm + static_cast<size_t>(k) * (R - 1);
+        const size_t inStep = static_cast<size_t>(stride) * count, outStep = static_cast<size_t>(span) * count;
+        size_t t = 0;
+        for (; t + 8 <= static_cast<size_t>(count); t += 8) butterflyLanes<R, 8>(from, inStep, to, outStep, wr, wi, t);
+        for (; t < static_cast<size_t>(count); ++t) butterflyLanes<R, 1>(from, inStep, to, outStep, wr, wi, t);
+    }
+}
+
+// Bin k of the transform of a real sequence of length 2n packed as above,
+// from a = Z[k] and b = conj Z[n - k] of its complex transform Z and the
+// twiddle w = e^(-pi i k / n):
+//     X[k] = (a + b) / 2 - i w (a - b) / 2.
+// The same formula turns the conjugate spectrum a = conj X[k], b = X[n - k]
+// back into conj Z[k], whose forward transform is n times the conjugate of
+// the packed samples.
+inline void untangleBin(float ar, float ai, float br, float bi, float wr, float wi, float& outRe, float& outIm) {
+    float dr = ai - bi, di = br - ar;  // -i (a - b)
+    outRe = 0.5f * (ar + br + wr * dr - wi * di);
+    outIm = 0.5f * (ai + bi + wr * di + wi * dr);
+}
+
+}  // namespace fft
+
+// The radices of the passes for length n, 4s first; empty if n has other
+// prime factors than 2, 3 and 5 (or is 1).
+inline std::vector<int> fftRadices(int n) {
+    std::vector<int> radices;
+    int rest = n;
+    for (int radix : {4, 2, 3, 5}) {
+        while (rest % radix == 0) {
+            radices.push_back(radix);
+            rest /= radix;
+        }
+    }
+    if (rest != 1) radices.clear();
+    return radices;
+}
+
+class FFTPlan {
+public:
+    explicit FFTPlan(int n) : n_(n), radices_(fftRadices(n)) {
+        valid_ = n == 1 || !radices_.empty();
+
+        int span = 1;
+        for (int radix : radices_) {
+            std::vector<float> re(static_cast<size_t>(span) * (radix - 1)), im(re.size());
+            for (int k = 0; k < span; ++k) {
+                for (int r = 1; r < radix; ++r) {
+                    double angle = -2 * M_PI * r * k / (static_cast<double>(span) * radix);
+                    re[static_cast<size_t>(k) * (radix - 1) + r - 1] = static_cast<float>(std::cos(angle));
+                    im[static_cast<size_t>(k) * (radix - 1) + r - 1] = static_cast<float>(std::sin(angle));
+                }
+            }
+            twiddleRe_.push_back(re);
+            twiddleIm_.push_back(im);
+            span *= radix;
+        }
+
+        // e^(-pi i k / n), the twiddles of the real transform of length 2n.
+        realRe_.resize(n + 1);
+        realIm_.resize(n + 1);
+        for (int k = 0; k <= n; ++k) {
+            double angle = -M_PI * k / n;
+            realRe_[k] = static_cast<float>(std::cos(angle));
+            realIm_[k] = static_cast<float>(std::sin(angle));
+        }
+    }
+
+    int size() const { return n_; }
+
+    // Whether n only has the prime factors 2, 3 and 5.
+    bool valid() const { return valid_; }
+
+    // Forward transform of the count interleaved sequences of length n in
+    // data, using work (the same size) as the other buffer. Returns whichever
+    // of the two holds the result.
+    SplitComplex forward(SplitComplex data, SplitComplex work, int count = 1) const {
+        SplitComplex in = data, out = work;
+        int span = 1;
+        for (size_t stage = 0; stage < radices_.size(); ++stage) {
+            const float* re = twiddleRe_[stage].data();
+            const float* im = twiddleIm_[stage].data();
+            switch (radices_[stage]) {
+                case 2: fft::pass<2>(in, out, n_, span, re, im, count); break;
+                case 3: fft::pass<3>(in, out, n_, span, re, im, count); break;
+                case 4: fft::pass<4>(in, out, n_, span, re, im, count); break;
+                default: fft::pass<5>(in, out, n_, span, re, im, count); break;
+            }
+            span *= radices_[stage];
+            std::swap(in, out);
+        }
+        return in;
+    }
+
+    // The bins X[0 .. n] of count real sequences of length 2n, from the
+    // forward transform z of their packed form (n x count, interleaved as
+    // above). Bin k of sequence t goes to spectrum[k * binStep + t * laneStep],
+    // so the result can be written transposed.
+    void untangle(SplitComplex z, int count, SplitComplex spectrum, size_t binStep, size_t laneStep) const {
+        for (int k = 0; k <= n_; ++k) {
+            const size_t a = static_cast<size_t>(k % n_) * count, b = static_cast<size_t>((n_ - k) % n_) * count;
+            for (int t = 0; t < count; ++t) {
+                const size_t out = k * binStep + t * laneStep;
+                fft::untangleBin(z.re[a + t], z.im[a + t], z.re[b + t], -z.im[b + t], realRe_[k], realIm_[k],
+                                 spectrum.re[out], spectrum.im[out]);
+            }
+        }
+    }
+
+    // The reverse: from the conjugated bins conj X[0 .. n] of count real
+    // sequences, bin k of sequence t at spectrum[k * binStep + t * laneStep],
+    // the n x count values whose forward transform is n times the conjugate of
+    // their packed form.
+    void retangle(SplitComplex spectrum, size_t binStep, size_t laneStep, int count, SplitComplex z) const {
+        for (int k = 0; k < n_; ++k) {
+            for (int t = 0; t < count; ++t) {
+                const size_t a = k * binStep + t * laneStep, b = (n_ - k) * binStep + t * laneStep;
+                const size_t out = static_cast<size_t>(k) * count + t;
+                fft::untangleBin(spectrum.re[a], spectrum.im[a], spectrum.re[b], -spectrum.im[b], realRe_[k], realIm_[k],
+                                 z.re[out], z.im[out]);
+            }
+        }
+    }
+
+private:
+    int n_;
+    std::vector<int> radices_;
+    bool valid_ = false;
+    std::vector<std::vector<float>> twiddleRe_, twiddleIm_;
+    std::vector<float> realRe_, realIm_;
+};
+
+// Smallest length >= n with no prime factors other than 2, 3 and 5.
+inline int smoothFFTSize(int n) {
+    for (int size = std::max(n, 1);; ++size) {
+        int rest = size;
+        for (int p : {2, 3, 5}) {
+            while (rest % p == 0) rest /= p;
+        }
+        if (rest == 1) return size;
+    }
+}
+
+// The plan for length n (2, 3 and 5 its only prime factors), built on first
+// use and kept for the rest of the process. Safe to call from several
+// threads.
+inline const FFTPlan& cachedFFTPlan(int n) {
+    static std::mutex mutex;
+    static std::map<int, FFTPlan> cache;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = cache.find(n);
+    if (it == cache.end()) it = cache.emplace(n, FFTPlan(n)).first;
+    return it->second;
+}
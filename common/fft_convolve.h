@@ -0,0 +1,304 @@
+#pragma once
+
+#include <vector>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+
+#include "bmp_io.h"
+#include "thread_pool.h"
+#include "aligned_image.h"
+#include "padded_plane.h"
+#include "gaussian.h"
+#include "tile_scheduler.h"
+#include "fft.h"
+
+// Frequency-domain convolution of 8-bit images with large dense kernels, and
+// the planner that picks between it and the spatial filters.
+//
+// The image is covered by blocks of blockWidth x blockHeight input pixels
+// (overlap-save): a block is transformed with the 2D real FFT of fft.h,
+// multiplied by the transform of the kernel and transformed back. Of the
+// circular result only the part at least the kernel radius away from the
+// block's edges, which the wrap-around does not reach, is kept; neighbouring
+// blocks overlap by the kernel size - 1 so the kept parts tile the image. Every (block, channel) pair is
+// one task on the thread pool; the border of the image is read through
+// borderIndex, so every mode works without a padded copy.
+//
+// Per output pixel this costs a few passes over the block per doubling of its
+// size, whatever the kernel size, while the direct kernel costs size^2 taps
+// and the separable LoG 2 * size per term.
+// The kernel transform depends on the kernel and the block size only and is
+// built once per pair; the FFT plans are cached as well (cachedFFTPlan).
+//
+// The sums pick up float rounding errors on the way through the transforms
+// that grow with the kernel's absolute sum: about 2e-4 for the LoG at sigma
+// 1 and 3e-3 at sigma 8, where the spatial filters sum the same products in
+// a fixed order. Outputs therefore differ from theirs by one where a sum
+// lies that close to an integer. Flat areas under a normalized kernel come
+// out as exact integers in the spatial filters, and truncation would take
+// them one lower whenever the FFT lands just below, so truncation is applied
+// to the sum plus a bias of 2^-9.
+
+// Largest block side the planner considers; larger blocks outgrow the cache
+// faster than they save passes.
+const int kMaxFFTBlock = 512;
+
+namespace fftconv {
+
+const float kTruncateBias = 1.0f / 512;
+
+// The 2D transform of a blockWidth x blockHeight real block (blockHeight
+// even) whose row y loadRow(y, out) writes. Rows 2k and 2k + 1 are packed as
+// the real and imaginary parts of row k, the columns are transformed and
+// untangled into blockHeight / 2 + 1 bins, written transposed, and the rows
+// transformed: bin (u, v) ends up at [u * (blockHeight / 2 + 1) + v]. a and b
+// hold blockWidth * (blockHeight / 2 + 1) values each; returns the one with
+// the result.
+template <typename LoadRow>
+inline SplitComplex forward2D(LoadRow loadRow, int blockWidth, int blockHeight, SplitComplex a, SplitComplex b) {
+    const int half = blockHeight / 2;
+    const int bins = half + 1;
+    const FFTPlan& columns = cachedFFTPlan(half);
+    const FFTPlan& rows = cachedFFTPlan(blockWidth);
+    for (int k = 0; k < half; ++k) {
+        loadRow(2 * k, a.re + static_cast<size_t>(k) * blockWidth);
+        loadRow(2 * k + 1, a.im + static_cast<size_t>(k) * blockWidth);
+    }
+    SplitComplex packed = columns.forward(a, b, blockWidth);
+    SplitComplex transposed = packed.re == a.re ? b : a;
+    columns.untangle(packed, blockWidth, transposed, 1, bins);
+    return rows.forward(transposed, packed, bins);
+}
+
+}  // namespace fftconv
+
+// The transform of kernel (size x size, row-major, as convolveKernel2D takes
+// it) in the layout of fftconv::forward2D, placed so that the circular
+// convolution of a block reads the kernel centred on each pixel, and scaled
+// by 2 / (blockWidth * blockHeight), the inverse of the scale the
+// unnormalized inverse transforms add.
+struct KernelSpectrum {
+    std::vector<float> re;
+    std::vector<float> im;
+};
+
+inline KernelSpectrum kernelSpectrum(const std::vector<float>& kernel, int size, int blockWidth, int blockHeight) {
+    const int radius = size / 2;
+    std::vector<float> wrapped(static_cast<size_t>(blockWidth) * blockHeight, 0.0f);
+    // Correlation with kernel is convolution with the kernel mirrored; pixel
+    // (x + kx - r, y + ky - r) gets weight kernel[ky][kx] at offset
+    // (r - kx, r - ky), modulo the block size.
+    for (int ky = 0; ky < size; ++ky) {
+        for (int kx = 0; kx < size; ++kx) {
+            int x = ((radius - kx) % blockWidth + blockWidth) % blockWidth;
+            int y = ((radius - ky) % blockHeight + blockHeight) % blockHeight;
+            wrapped[static_cast<size_t>(y) * blockWidth + x] += kernel[static_cast<size_t>(ky) * size + kx];
+        }
+    }
+    const size_t count = static_cast<size_t>(blockWidth) * (blockHeight / 2 + 1);
+    std::vector<float> buffers(4 * count);
+    SplitComplex a = {&buffers[0], &buffers[count]}, b = {&buffers[2 * count], &buffers[3 * count]};
+    SplitComplex result = fftconv::forward2D([&](int y, float* out) {
+        std::copy(wrapped.begin() + static_cast<size_t>(y) * blockWidth, wrapped.begin() + static_cast<size_t>(y + 1) * blockWidth, out);
+    }, blockWidth, blockHeight, a, b);
+    const float scale = 2.0f / (static_cast<float>(blockWidth) * blockHeight);
+    KernelSpectrum spectrum;
+    spectrum.re.resize(count);
+    spectrum.im.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        spectrum.re[i] = result.re[i] * scale;
+        spectrum.im[i] = result.im[i] * scale;
+    }
+    return spectrum;
+}
+
+// The spectrum of (kernel, block size), built on first use and kept for the
+// rest of the process. Safe to call from several threads.
+inline const KernelSpectrum& cachedKernelSpectrum(const std::vector<float>& kernel, int size, int blockWidth, int blockHeight) {
+    static std::mutex mutex;
+    static std::map<std::tuple<std::vector<float>, int, int>, KernelSpectrum> cache;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto key = std::make_tuple(kernel, blockWidth, blockHeight);
+    auto it = cache.find(key);
+    if (it == cache.end()) it = cache.emplace(key, kernelSpectrum(kernel, size, blockWidth, blockHeight)).first;
+    return it->second;
+}
+
+struct FFTBlocking {
+    int width = 0;   // block size in input pixels, both FFT lengths; height even
+    int height = 0;
+    double cost = 0;  // estimated nanoseconds per output pixel and channel
+};
+
+// Estimated time per output sample of one (block, channel) pair: the passes
+// of the forward and inverse transforms over all its values, plus about four
+// more for loading, the spectrum product, untangling and storing, spread over
+// the pixels it keeps. A pass costs about the same whatever its radix. The
+// constants come from timing convolveFFT at -O2 on one core; blocks whose
+// buffers outgrow a typical 1 MB L2 cache get slower per pass.
+inline double fftBlockCost(int blockWidth, int blockHeight, int keptWidth, int keptHeight) {
+    const double nsPerValue = 1.85;
+    const double values = blockWidth * (blockHeight / 2 + 1.0);
+    const double passes = 2.0 * (fftRadices(blockWidth).size() + fftRadices(blockHeight / 2).size()) + 4;
+    const double cache = values * 4 * sizeof(float) > (1 << 20) ? 1.4 : 1.0;
+    return nsPerValue * cache * values * passes / (static_cast<double>(keptWidth) * keptHeight);
+}
+
+// The block size with the lowest estimated cost for a width x height image
+// and a size x size kernel. Candidates run from twice the kernel up to the
+// whole image or kMaxFFTBlock; partial blocks at the right and bottom edges
+// count in full.
+inline FFTBlocking planFFTBlocks(int width, int height, int size) {
+    const int reach = size - 1;
+    // 2, 3, 5-smooth lengths from 2 * size until one covers limit or reaches
+    // kMaxFFTBlock.
+    auto lengths = [&](int limit, bool even) {
+        std::vector<int> out;
+        for (int n = smoothFFTSize(2 * size);; n = smoothFFTSize(n + 1)) {
+            if (even && n % 2 != 0) continue;
+            out.push_back(n);
+            if (n >= limit || n >= kMaxFFTBlock) break;
+        }
+        return out;
+    };
+    FFTBlocking best;
+    best.cost = -1;
+    for (int bw : lengths(width + reach, false)) {
+        for (int bh : lengths(height + reach, true)) {
+            int keptWidth = bw - reach, keptHeight = bh - reach;
+            long long blocks = static_cast<long long>((width + keptWidth - 1) / keptWidth) * ((height + keptHeight - 1) / keptHeight);
+            double cost = fftBlockCost(bw, bh, keptWidth, keptHeight) * blocks * keptWidth * keptHeight /
+                          (static_cast<double>(width) * height);
+            if (best.cost < 0 || cost < best.cost) {
+                best.width = bw;
+                best.height = bh;
+                best.cost = cost;
+            }
+        }
+    }
+    return best;
+}
+
+// Correlates channels 0 .. channels - 1 of src with kernel (size x size,
+// row-major, odd size, as convolveKernel2D takes it) into dst, the same size,
+// clamped to [0, 255] and rounded per rounding. Pixels outside src are read
+// per border.
+inline void convolveFFT(const ConstImageView& src, const ImageView& dst, int channels,
+                        const std::vector<float>& kernel, int size, Rounding rounding,
+                        BorderMode border = BorderMode::Replicate, ThreadPool* pool = nullptr) {
+    if (src.width <= 0 || src.height <= 0) return;
+    const int radius = size / 2;
+    const FFTBlocking blocking = planFFTBlocks(src.width, src.height, size);
+    const int blockWidth = blocking.width, blockHeight = blocking.height;
+    const int keptWidth = blockWidth - 2 * radius, keptHeight = blockHeight - 2 * radius;
+    const int blocksX = (src.width + keptWidth - 1) / keptWidth;
+    const int blocksY = (src.height + keptHeight - 1) / keptHeight;
+    const KernelSpectrum& kernelBins = cachedKernelSpectrum(kernel, size, blockWidth, blockHeight);
+    const FFTPlan& columns = cachedFFTPlan(blockHeight / 2);
+    const FFTPlan& rows = cachedFFTPlan(blockWidth);
+    const int bins = blockHeight / 2 + 1;
+    const size_t count = static_cast<size_t>(blockWidth) * bins;
+    const float bias = rounding == Rounding::Truncate ? fftconv::kTruncateBias : 0.0f;
+
+    parallelFor(pool, blocksX * blocksY * channels, [&](int task) {
+        const int channel = task % channels;
+        const int block = task / channels;
+        const int x0 = (block % blocksX) * keptWidth, y0 = (block / blocksX) * keptHeight;
+
+        // Per-thread buffers, reused across tasks.
+        thread_local AlignedVector<float> buffers;
+        thread_local std::vector<int> columnIndex;
+        buffers.resize(4 * count);
+        SplitComplex a = {buffers.data(), buffers.data() + count};
+        SplitComplex b = {buffers.data() + 2 * count, buffers.data() + 3 * count};
+        columnIndex.resize(blockWidth);
+        for (int x = 0; x < blockWidth; ++x) columnIndex[x] = borderIndex(x0 - radius + x, src.width, border);
+
+        const uint8_t* plane = src.data + channel;
+        SplitComplex spectrum = fftconv::forward2D([&](int y, float* out) {
+            int sy = borderIndex(y0 - radius + y, src.height, border);
+            if (sy < 0) {
+                std::fill(out, out + blockWidth, 0.0f);
+                return;
+            }
+            const uint8_t* row = plane + sy * src.stride;
+            for (int x = 0; x < blockWidth; ++x) {
+                int sx = columnIndex[x];
+                out[x] = sx < 0 ? 0.0f : row[sx * src.channels];
+            }
+        }, blockWidth, blockHeight, a, b);
+        SplitComplex other = spectrum.re == a.re ? b : a;
+
+        // conj(X K), so that the forward transforms that follow give the
+        // conjugates of the inverse ones.
+        for (size_t i = 0; i < count; ++i) {
+            float xr = spectrum.re[i], xi = spectrum.im[i], kr = kernelBins.re[i], ki = kernelBins.im[i];
+            spectrum.re[i] = xr * kr - xi * ki;
+            spectrum.im[i] = -(xr * ki + xi * kr);
+        }
+        SplitComplex filtered = rows.forward(spectrum, other, bins);
+        SplitComplex packed = filtered.re == a.re ? b : a;
+        columns.retangle(filtered, 1, bins, blockWidth, packed);
+        SplitComplex samples = columns.forward(packed, filtered, blockWidth);
+
+        // Row y of the block is the real part of packed row y / 2 for even y,
+        // minus the imaginary part for odd y.
+        const int keepRows = std::min(keptHeight, src.height - y0);
+        const int keepColumns = std::min(keptWidth, src.width - x0);
+        for (int y = 0; y < keepRows; ++y) {
+            const int by = radius + y;
+            const size_t offset = static_cast<size_t>(by / 2) * blockWidth + radius;
+            const float sign = by % 2 == 0 ? 1.0f : -1.0f;
+            const float* values = (by % 2 == 0 ? samples.re : samples.im) + offset;
+            uint8_t* out = dst.data + channel + (y0 + y) * dst.stride + x0 * dst.channels;
+            for (int x = 0; x < keepColumns; ++x) {
+                out[x * dst.channels] = separable::toByte(sign * values[x] + bias, rounding);
+            }
+        }
+    });
+}
+
+enum class ConvolutionBackend {
+    Direct,     // convolveKernel2D, size^2 taps
+    Separable,  // a sum of 1D passes, 2 * size taps per term
+    FFT,        // convolveFFT
+};
+
+inline const char* convolutionBackendName(ConvolutionBackend backend) {
+    switch (backend) {
+        case ConvolutionBackend::Separable: return "separable";
+        case ConvolutionBackend::FFT: return "fft";
+        default: return "direct";
+    }
+}
+
+// The backend with the lowest estimated time for a size x size kernel over a
+// width x height image. separableTerms is the number of separable terms the
+// kernel splits into, 0 if it does not. The spatial filters run on grown
+// tiles (tile_scheduler.h) and pay for their halo on top of a fixed cost per
+// pixel for the tile copies and conversions; the constants, in ns per pixel
+// and channel, come from timing each at -O2 on one core, the dense kernel
+// with AVX2.
+inline ConvolutionBackend chooseConvolutionBackend(int size, int separableTerms, int width, int height) {
+    const int radius = size / 2;
+    const double tile = std::max(kTileSize, 4 * radius);
+    const double halo = (tile + 2 * radius) * (tile + 2 * radius) / (tile * tile);
+
+    double direct = (5.7 + 0.095 * size * size) * halo;
+    double separable = separableTerms > 0 ? (3.8 + 0.155 * separableTerms * (size + 1)) * halo : -1;
+    double fft = planFFTBlocks(width, height, size).cost;
+
+    ConvolutionBackend best = ConvolutionBackend::Direct;
+    double bestCost = direct;
+    if (separable >= 0 && separable < bestCost) {
+        best = ConvolutionBackend::Separable;
+        bestCost = separable;
+    }
+    if (fft < bestCost) best = ConvolutionBackend::FFT;
+    return best;
+}
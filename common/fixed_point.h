@@ -0,0 +1,383 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+
+#include "simd_dispatch.h"
+#include "gaussian.h"
+#include "bmp_io.h"
+
+// Fixed-point (Q-format) convolution of 8-bit images.
+//
+// Weights are scaled by 2^q and rounded to int16, pixels are multiplied by
+// them and summed in int32, and each sum is shifted back down by q with one
+// rounding at the end. q is picked per kernel as large as two limits allow:
+// the largest weight must fit int16, and the largest input times the sum of
+// the absolute weights must fit int32, so no image can overflow a sum. The
+// weight with the largest magnitude takes up the difference between the sum
+// of the rounded weights and the rounded sum, so flat areas come out as with
+// the float kernel.
+//
+// Integer sums are exact whatever the order of the additions, so all SIMD
+// paths give the same bytes. The dense kernel pairs neighbouring taps for
+// pmaddwd (two int16 products added into each int32 lane), which covers 16
+// pixels per AVX2 instruction where the float kernel covers 8.
+//
+// The only difference from the float reference is the rounding of the
+// weights. errorBound is the most it can move a sum on any image, in grey
+// levels, and Deviation measures how far two outputs actually differ.
+
+struct FixedKernel {
+    std::vector<int16_t> taps;
+    int fracBits = 0;       // q: the weights are taps / 2^q
+    double errorBound = 0;  // 255 * sum |weight - tap / 2^q|
+};
+
+// Quantizes weights for inputs of magnitude up to inputPeak, with at most
+// maxBits fractional bits.
+inline FixedKernel quantizeKernel(const std::vector<float>& weights, double inputPeak = 255, int maxBits = 24) {
+    FixedKernel kernel;
+    if (weights.empty()) return kernel;
+    size_t peakIndex = 0;
+    double sum = 0;
+    for (size_t i = 0; i < weights.size(); ++i) {
+        sum += weights[i];
+        if (std::fabs(weights[i]) > std::fabs(weights[peakIndex])) peakIndex = i;
+    }
+
+    for (int q = maxBits; q >= 0; --q) {
+        double scale = std::ldexp(1.0, q);
+        std::vector<long long> taps(weights.size());
+        long long tapSum = 0;
+        for (size_t i = 0; i < weights.size(); ++i) {
+            taps[i] = std::llround(weights[i] * scale);
+            tapSum += taps[i];
+        }
+        taps[peakIndex] += std::llround(sum * scale) - tapSum;
+
+        long long absSum = 0;
+        bool fits = true;
+        for (long long t : taps) {
+            fits = fits && t >= INT16_MIN && t <= INT16_MAX;
+            absSum += std::llabs(t);
+        }
+        if (!fits || inputPeak * absSum > INT32_MAX) continue;
+
+        kernel.fracBits = q;
+        kernel.taps.assign(taps.begin(), taps.end());
+        for (size_t i = 0; i < weights.size(); ++i) {
+            kernel.errorBound += 255 * std::fabs(weights[i] - taps[i] / scale);
+        }
+        return kernel;
+    }
+    return kernel;
+}
+
+// errorBound limits how far the fixed-point sum can be from the float one
+// before either is rounded to 8 bits. Rounding or truncating both can add up
+// to one more grey level, so this is the bound on the output bytes.
+inline int outputErrorBound(const FixedKernel& kernel) {
+    return static_cast<int>(std::floor(kernel.errorBound)) + 1;
+}
+
+inline long long absoluteTapSum(const FixedKernel& kernel) {
+    long long sum = 0;
+    for (int16_t t : kernel.taps) sum += std::abs(t);
+    return sum;
+}
+
+// A separable pair: the row pass keeps its sums exact in int32 and the column
+// pass scales them by kernelY, so the product of both must fit int32. The
+// bits are shared about evenly; errorBound of the result covers the pair.
+inline void quantizeSeparable(const std::vector<float>& kernelX, const std::vector<float>& kernelY,
+                              FixedKernel& fixedX, FixedKernel& fixedY) {
+    double absX = 0, absY = 0;
+    for (float w : kernelX) absX += std::fabs(w);
+    for (float w : kernelY) absY += std::fabs(w);
+    // One bit of slack for the rounding of the taps.
+    int total = static_cast<int>(std::floor(std::log2(INT32_MAX / (255 * absX * absY)))) - 1;
+    fixedX = quantizeKernel(kernelX, 255, std::max(0, (total + 1) / 2));
+    fixedY = quantizeKernel(kernelY, 255.0 * absoluteTapSum(fixedX));
+
+    double scale = std::ldexp(1.0, fixedX.fracBits + fixedY.fracBits);
+    double bound = 0;
+    for (size_t y = 0; y < kernelY.size(); ++y) {
+        for (size_t x = 0; x < kernelX.size(); ++x) {
+            bound += std::fabs(static_cast<double>(kernelY[y]) * kernelX[x] - fixedY.taps[y] * fixedX.taps[x] / scale);
+        }
+    }
+    fixedY.errorBound = 255 * bound;
+}
+
+namespace fixedpoint {
+
+// sum / 2^q as a byte, rounded the way the float paths round.
+inline uint8_t toByte(int32_t sum, int fracBits, Rounding rounding) {
+    if (rounding == Rounding::Nearest && fracBits > 0) sum += 1 << (fracBits - 1);
+    int v = sum >> fracBits;
+    return static_cast<uint8_t>(v < 0 ? 0 : (v > 255 ? 255 : v));
+}
+
+// uint8 -> int16, in groups of 8 so GCC vectorizes it at -O2.
+inline void widen(const uint8_t* __restrict in, int16_t* __restrict out, int count) {
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        for (int j = 0; j < 8; ++j) out[i + j] = in[i + j];
+    }
+    for (; i < count; ++i) out[i] = in[i];
+}
+
+// out[x] = w * a[x], and out[x] += w * (a[x] + b[x]) as in log_sharpen.h, on
+// integers.
+template <typename In>
+inline void setTaps(int32_t* __restrict out, int32_t w, const In* __restrict a, int n) {
+    int x = 0;
+    for (; x + 8 <= n; x += 8) {
+        for (int j = 0; j < 8; ++j) out[x + j] = w * static_cast<int32_t>(a[x + j]);
+    }
+    for (; x < n; ++x) out[x] = w * static_cast<int32_t>(a[x]);
+}
+
+template <typename In>
+inline void addSymmetricTaps(int32_t* __restrict out, int32_t w, const In* __restrict a, const In* __restrict b, int n) {
+    int x = 0;
+    for (; x + 8 <= n; x += 8) {
+        for (int j = 0; j < 8; ++j) out[x + j] += w * (static_cast<int32_t>(a[x + j]) + b[x + j]);
+    }
+    for (; x < n; ++x) out[x] += w * (static_cast<int32_t>(a[x]) + b[x]);
+}
+
+// One output sum from k padded int16 rows; rows[ky] already points at column x.
+inline int32_t convolvePixel(const int16_t* const* rows, const int16_t* kernel, int size, int x) {
+    int32_t sum = 0;
+    for (int ky = 0; ky < size; ++ky) {
+        const int16_t* row = rows[ky] + x;
+        const int16_t* weights = kernel + ky * size;
+        for (int kx = 0; kx < size; ++kx) sum += row[kx] * weights[kx];
+    }
+    return sum;
+}
+
+inline void convolveRowScalar(const int16_t* const* rows, const int16_t* kernel, const int32_t*, int size, int width, int32_t* out) {
+    for (int x = 0; x < width; ++x) out[x] = convolvePixel(rows, kernel, size, x);
+}
+
+// pairs[ky * ((size + 1) / 2) + i] holds the weights of taps 2i and 2i + 1 of
+// kernel row ky (the odd one out paired with 0) as the low and high int16 of
+// one int32. Interleaving the pixels at x + 2i and x + 2i + 1 lines them up
+// with it, and pmaddwd adds both products into one lane. The rows carry one
+// extra column for the read at 2i + 1.
+#if defined(SIMD_X86)
+__attribute__((target("avx2")))
+inline void convolveRowAVX2(const int16_t* const* rows, const int16_t* kernel, const int32_t* pairs, int size, int width, int32_t* out) {
+    const int pairCount = (size + 1) / 2;
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        // unpacklo/hi work within 128-bit halves: lo holds pixels 0-3 and
+        // 8-11, hi holds 4-7 and 12-15.
+        __m256i lo = _mm256_setzero_si256(), hi = _mm256_setzero_si256();
+        for (int ky = 0; ky < size; ++ky) {
+            const int16_t* row = rows[ky] + x;
+            const int32_t* weights = pairs + ky * pairCount;
+            for (int i = 0; i < pairCount; ++i) {
+                __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + 2 * i));
+                __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + 2 * i + 1));
+                __m256i w = _mm256_set1_epi32(weights[i]);
+                lo = _mm256_add_epi32(lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), w));
+                hi = _mm256_add_epi32(hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), w));
+            }
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + x), _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + x + 8), _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+    for (; x < width; ++x) out[x] = convolvePixel(rows, kernel, size, x);
+}
+
+__attribute__((target("sse4.1")))
+inline void convolveRowSSE41(const int16_t* const* rows, const int16_t* kernel, const int32_t* pairs, int size, int width, int32_t* out) {
+    const int pairCount = (size + 1) / 2;
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        __m128i lo = _mm_setzero_si128(), hi = _mm_setzero_si128();
+        for (int ky = 0; ky < size; ++ky) {
+            const int16_t* row = rows[ky] + x;
+            const int32_t* weights = pairs + ky * pairCount;
+            for (int i = 0; i < pairCount; ++i) {
+                __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + 2 * i));
+                __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + 2 * i + 1));
+                __m128i w = _mm_set1_epi32(weights[i]);
+                lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), w));
+                hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), w));
+            }
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), lo);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x + 4), hi);
+    }
+    for (; x < width; ++x) out[x] = convolvePixel(rows, kernel, size, x);
+}
+#endif
+
+#if defined(SIMD_NEON)
+inline void convolveRowNEON(const int16_t* const* rows, const int16_t* kernel, const int32_t*, int size, int width, int32_t* out) {
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        int32x4_t lo = vdupq_n_s32(0), hi = vdupq_n_s32(0);
+        for (int ky = 0; ky < size; ++ky) {
+            const int16_t* row = rows[ky] + x;
+            const int16_t* weights = kernel + ky * size;
+            for (int kx = 0; kx < size; ++kx) {
+                int16x8_t pixels = vld1q_s16(row + kx);
+                lo = vmlal_n_s16(lo, vget_low_s16(pixels), weights[kx]);
+                hi = vmlal_n_s16(hi, vget_high_s16(pixels), weights[kx]);
+            }
+        }
+        vst1q_s32(out + x, lo);
+        vst1q_s32(out + x + 4, hi);
+    }
+    for (; x < width; ++x) out[x] = convolvePixel(rows, kernel, size, x);
+}
+#endif
+
+}  // namespace fixedpoint
+
+// convolveKernel2D with a quantized kernel (size x size, row-major, size odd):
+// same borders, strides and steps, and the output rounded as asked.
+inline void convolveKernel2DFixed(const uint8_t* src, ptrdiff_t srcStride, uint8_t* dst, ptrdiff_t dstStride,
+                                  int width, int height, const FixedKernel& kernel, int size, Rounding rounding,
+                                  SimdPath path, int srcStep = 1, int dstStep = 1) {
+    if (width <= 0 || height <= 0) return;
+    const int radius = size / 2;
+    const int padded = width + 2 * radius + 1;
+    const int pairCount = (size + 1) / 2;
+
+    std::vector<int32_t> pairs(static_cast<size_t>(size) * pairCount);
+    for (int ky = 0; ky < size; ++ky) {
+        for (int i = 0; i < pairCount; ++i) {
+            uint16_t first = static_cast<uint16_t>(kernel.taps[ky * size + 2 * i]);
+            uint16_t second = 2 * i + 1 < size ? static_cast<uint16_t>(kernel.taps[ky * size + 2 * i + 1]) : 0;
+            pairs[ky * pairCount + i] = static_cast<int32_t>(first | static_cast<uint32_t>(second) << 16);
+        }
+    }
+
+    // Padded int16 copies of the input rows, in a ring as in convolveKernel2D.
+    std::vector<int16_t> ring(static_cast<size_t>(size) * padded);
+    std::vector<uint8_t> bytes(width);
+    std::vector<int32_t> sums(width);
+    std::vector<const int16_t*> rows(size);
+    int loaded = -1;
+
+    auto loadRow = [&](int y) {
+        const uint8_t* in = src + y * srcStride;
+        if (srcStep != 1) {
+            for (int x = 0; x < width; ++x) bytes[x] = in[x * srcStep];
+            in = bytes.data();
+        }
+        int16_t* out = &ring[static_cast<size_t>(y % size) * padded];
+        fixedpoint::widen(in, out + radius, width);
+        for (int p = 0; p < radius; ++p) {
+            out[p] = out[radius];
+            out[radius + width + p] = out[radius + width - 1];
+        }
+        out[padded - 1] = 0;
+    };
+
+    for (int y = 0; y < height; ++y) {
+        int last = std::min(height - 1, y + radius);
+        while (loaded < last) loadRow(++loaded);
+        for (int ky = 0; ky < size; ++ky) {
+            rows[ky] = &ring[static_cast<size_t>(separable::clampIndex(y + ky - radius, height - 1) % size) * padded];
+        }
+
+        switch (path) {
+#if defined(SIMD_X86)
+            case SimdPath::AVX2: fixedpoint::convolveRowAVX2(rows.data(), kernel.taps.data(), pairs.data(), size, width, sums.data()); break;
+            case SimdPath::SSE41: fixedpoint::convolveRowSSE41(rows.data(), kernel.taps.data(), pairs.data(), size, width, sums.data()); break;
+#endif
+#if defined(SIMD_NEON)
+            case SimdPath::NEON: fixedpoint::convolveRowNEON(rows.data(), kernel.taps.data(), pairs.data(), size, width, sums.data()); break;
+#endif
+            default: fixedpoint::convolveRowScalar(rows.data(), kernel.taps.data(), pairs.data(), size, width, sums.data()); break;
+        }
+
+        uint8_t* out = dst + y * dstStride;
+        for (int x = 0; x < width; ++x) out[x * dstStep] = fixedpoint::toByte(sums[x], kernel.fracBits, rounding);
+    }
+}
+
+// convolveSeparable with a pair from quantizeSeparable. The kernels must be
+// symmetric (Gaussians are): taps at -k and +k are added before they are
+// multiplied, as in convolveSeparableSum. The row pass sums int16 pixels into
+// an int32 ring, which the column pass sums again without rounding.
+inline void convolveSeparableFixed(const uint8_t* src, ptrdiff_t srcStride, uint8_t* dst, ptrdiff_t dstStride,
+                                   int width, int height, const FixedKernel& kernelX, const FixedKernel& kernelY,
+                                   Rounding rounding = Rounding::Nearest, int srcStep = 1, int dstStep = 1) {
+    if (width <= 0 || height <= 0) return;
+
+    const int radiusX = static_cast<int>(kernelX.taps.size()) / 2;
+    const int radiusY = static_cast<int>(kernelY.taps.size()) / 2;
+    const int ringSize = std::min(2 * radiusY + 1, height);
+    const int fracBits = kernelX.fracBits + kernelY.fracBits;
+
+    std::vector<int32_t> ring(static_cast<size_t>(ringSize) * width);
+    std::vector<int16_t> line(width + 2 * radiusX);
+    std::vector<int32_t> acc(std::min(width, separable::kColumnBlock));
+    const int16_t* mid = line.data() + radiusX;
+
+    int nextRow = 0;
+    auto fillUpTo = [&](int last) {
+        for (; nextRow <= last; ++nextRow) {
+            const uint8_t* row = src + nextRow * srcStride;
+            for (int p = 0; p < width + 2 * radiusX; ++p) {
+                line[p] = row[separable::clampIndex(p - radiusX, width - 1) * srcStep];
+            }
+            int32_t* out = &ring[static_cast<size_t>(nextRow % ringSize) * width];
+            fixedpoint::setTaps(out, kernelX.taps[radiusX], mid, width);
+            for (int k = 1; k <= radiusX; ++k) {
+                fixedpoint::addSymmetricTaps(out, kernelX.taps[radiusX + k], mid - k, mid + k, width);
+            }
+        }
+    };
+
+    for (int y = 0; y < height; ++y) {
+        fillUpTo(std::min(y + radiusY, height - 1));
+        uint8_t* out = dst + y * dstStride;
+        for (int x0 = 0; x0 < width; x0 += separable::kColumnBlock) {
+            int n = std::min(separable::kColumnBlock, width - x0);
+            auto ringRow = [&](int r) {
+                r = separable::clampIndex(r, height - 1);
+                return &ring[static_cast<size_t>(r % ringSize) * width + x0];
+            };
+            int32_t* sum = acc.data();
+            fixedpoint::setTaps(sum, kernelY.taps[radiusY], ringRow(y), n);
+            for (int k = 1; k <= radiusY; ++k) {
+                fixedpoint::addSymmetricTaps(sum, kernelY.taps[radiusY + k], ringRow(y - k), ringRow(y + k), n);
+            }
+            for (int x = 0; x < n; ++x) out[(x0 + x) * dstStep] = fixedpoint::toByte(sum[x], fracBits, rounding);
+        }
+    }
+}
+
+// How far one output is from another, over the first `channels` bytes of
+// each pixel.
+struct Deviation {
+    long long count = 0;
+    long long differing = 0;
+    int maxAbsolute = 0;
+
+    void add(const ConstImageView& a, const ConstImageView& b, int channels = 3) {
+        for (int y = 0; y < a.height; ++y) {
+            for (int x = 0; x < a.width; ++x) {
+                for (int c = 0; c < channels; ++c) {
+                    int d = std::abs(a.pixel(x, y)[c] - b.pixel(x, y)[c]);
+                    maxAbsolute = std::max(maxAbsolute, d);
+                    differing += d != 0;
+                    ++count;
+                }
+            }
+        }
+    }
+};
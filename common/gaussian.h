@@ -0,0 +1,260 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <cstddef>
+
+// Separable Gaussian smoothing for 8-bit planes.
+//
+// exp(-(x^2 + y^2) / 2s^2) = exp(-x^2 / 2s^2) * exp(-y^2 / 2s^2), so the 2D
+// kernel built by generateGaussianKernel is the outer product of a 1D kernel
+// with itself and one horizontal plus one vertical pass give the same result
+// for 2k instead of k^2 taps per pixel.
+//
+// The horizontal pass fills a ring of k float rows; the vertical pass then
+// accumulates whole row segments (a column block at a time) so every tap is a
+// sequential, vectorizable read instead of a stride-width jump.
+//
+// Kernels of 3, 5 and 7 taps, the sizes the tools are mostly run with, go to
+// a copy of the passes with the radius as a template parameter: the taps are
+// unrolled, the weights stay in registers and each group of 8 pixels is
+// summed in one go. The sums are formed in the same order as in the generic
+// passes, so the output does not change.
+
+enum class Rounding {
+    Nearest,   // static_cast<int>(sum + 0.5f), as in denoise / gaussian_filter
+    Truncate,  // static_cast<uint8_t>(sum), as in enhance
+};
+
+// Same size rule as the 2D generators: radius = kernelSize / 2.
+inline std::vector<float> generateGaussianKernel1D(int kernelSize, float sigma) {
+    int radius = kernelSize / 2;
+    std::vector<float> kernel(2 * radius + 1);
+    float sum = 0.0f;
+    for (int i = -radius; i <= radius; ++i) {
+        kernel[i + radius] = std::exp(-(i * i) / (2 * sigma * sigma));
+        sum += kernel[i + radius];
+    }
+    for (auto& value : kernel) value /= sum;
+    return kernel;
+}
+
+namespace separable {
+
+inline int clampIndex(int value, int maxValue) {
+    return value < 0 ? 0 : (value > maxValue ? maxValue : value);
+}
+
+inline uint8_t toByte(float value, Rounding rounding) {
+    int v = rounding == Rounding::Nearest ? static_cast<int>(value + 0.5f) : static_cast<int>(value);
+    return static_cast<uint8_t>(v < 0 ? 0 : (v > 255 ? 255 : v));
+}
+
+// Columns handled per vertical block; 512 floats of accumulator stay in L1.
+const int kColumnBlock = 512;
+
+inline void horizontalRow(const uint8_t* row, int step, float* out, float* line, int width, const std::vector<float>& kernel) {
+    int radius = static_cast<int>(kernel.size()) / 2;
+    int padded = width + 2 * radius;
+    for (int p = 0; p < padded; ++p) line[p] = row[clampIndex(p - radius, width - 1) * step];
+
+    for (int x = 0; x < width; ++x) out[x] = 0.0f;
+    for (int k = 0; k < static_cast<int>(kernel.size()); ++k) {
+        const float w = kernel[k];
+        const float* in = line + k;
+        for (int x = 0; x < width; ++x) out[x] += w * in[x];
+    }
+}
+
+// sum[x] = sum over k of kernel[k] * rows[k][x], for x < n, k = 0 .. 2 Radius
+// in order from 0.
+template <int Radius>
+inline void sumTaps(float* __restrict sum, const float* const* rows, const float* kernel, int n) {
+    constexpr int kTaps = 2 * Radius + 1;
+    float w[kTaps];
+    for (int k = 0; k < kTaps; ++k) w[k] = kernel[k];
+    int x = 0;
+    for (; x + 8 <= n; x += 8) {
+        float acc[8] = {};
+        for (int k = 0; k < kTaps; ++k) {
+            for (int j = 0; j < 8; ++j) acc[j] += w[k] * rows[k][x + j];
+        }
+        for (int j = 0; j < 8; ++j) sum[x + j] = acc[j];
+    }
+    for (; x < n; ++x) {
+        float acc = 0.0f;
+        for (int k = 0; k < kTaps; ++k) acc += w[k] * rows[k][x];
+        sum[x] = acc;
+    }
+}
+
+}  // namespace separable
+
+// convolveSeparable for two kernels of 2 Radius + 1 taps.
+template <int Radius>
+void convolveSeparableRadius(const uint8_t* src, ptrdiff_t srcStride, uint8_t* dst, ptrdiff_t dstStride,
+                             int width, int height, const float* kernelX, const float* kernelY,
+                             Rounding rounding, int srcStep, int dstStep) {
+    constexpr int kTaps = 2 * Radius + 1;
+    const int ringSize = std::min(kTaps, height);
+
+    std::vector<float> ring(static_cast<size_t>(ringSize) * width);
+    std::vector<float> line(width + 2 * Radius);
+    std::vector<float> acc(std::min(width, separable::kColumnBlock));
+    const float* shifted[kTaps];
+    for (int k = 0; k < kTaps; ++k) shifted[k] = line.data() + k;
+
+    int nextRow = 0;
+    for (int y = 0; y < height; ++y) {
+        for (int last = std::min(y + Radius, height - 1); nextRow <= last; ++nextRow) {
+            const uint8_t* row = src + nextRow * srcStride;
+            for (int p = 0; p < width + 2 * Radius; ++p) line[p] = row[separable::clampIndex(p - Radius, width - 1) * srcStep];
+            separable::sumTaps<Radius>(&ring[static_cast<size_t>(nextRow % ringSize) * width], shifted, kernelX, width);
+        }
+
+        uint8_t* out = dst + y * dstStride;
+        for (int x0 = 0; x0 < width; x0 += separable::kColumnBlock) {
+            int n = std::min(separable::kColumnBlock, width - x0);
+            const float* taps[kTaps];
+            for (int k = 0; k < kTaps; ++k) {
+                int r = separable::clampIndex(y + k - Radius, height - 1);
+                taps[k] = &ring[static_cast<size_t>(r % ringSize) * width + x0];
+            }
+            separable::sumTaps<Radius>(acc.data(), taps, kernelY, n);
+            for (int x = 0; x < n; ++x) out[(x0 + x) * dstStep] = separable::toByte(acc[x], rounding);
+        }
+    }
+}
+
+// Convolves with kernelX along rows, then kernelY along columns. Both kernels
+// must have odd length; borders replicate the edge pixel. Strides may be
+// negative; srcStep/dstStep are the byte distances between neighbouring
+// pixels, so a channel of an interleaved image can be read and written as is.
+inline void convolveSeparable(const uint8_t* src, ptrdiff_t srcStride, uint8_t* dst, ptrdiff_t dstStride,
+                              int width, int height,
+                              const std::vector<float>& kernelX, const std::vector<float>& kernelY,
+                              Rounding rounding = Rounding::Nearest, int srcStep = 1, int dstStep = 1) {
+    if (width <= 0 || height <= 0) return;
+
+    if (kernelX.size() == kernelY.size()) {
+        switch (kernelX.size()) {
+            case 3: return convolveSeparableRadius<1>(src, srcStride, dst, dstStride, width, height, kernelX.data(),
+                                                      kernelY.data(), rounding, srcStep, dstStep);
+            case 5: return convolveSeparableRadius<2>(src, srcStride, dst, dstStride, width, height, kernelX.data(),
+                                                      kernelY.data(), rounding, srcStep, dstStep);
+            case 7: return convolveSeparableRadius<3>(src, srcStride, dst, dstStride, width, height, kernelX.data(),
+                                                      kernelY.data(), rounding, srcStep, dstStep);
+        }
+    }
+
+    const int radiusX = static_cast<int>(kernelX.size()) / 2;
+    const int radiusY = static_cast<int>(kernelY.size()) / 2;
+    const int ringSize = std::min(2 * radiusY + 1, height);
+
+    // ring[r % ringSize] holds the horizontally filtered source row r.
+    std::vector<float> ring(static_cast<size_t>(ringSize) * width);
+    std::vector<float> line(width + 2 * radiusX);
+    std::vector<float> acc(std::min(width, separable::kColumnBlock));
+    std::vector<const float*> taps(kernelY.size());
+
+    int nextRow = 0;
+    auto fillUpTo = [&](int last) {
+        for (; nextRow <= last; ++nextRow) {
+            float* out = &ring[static_cast<size_t>(nextRow % ringSize) * width];
+            separable::horizontalRow(src + nextRow * srcStride, srcStep, out, line.data(), width, kernelX);
+        }
+    };
+
+    for (int y = 0; y < height; ++y) {
+        fillUpTo(std::min(y + radiusY, height - 1));
+        for (int k = 0; k < static_cast<int>(kernelY.size()); ++k) {
+            int r = separable::clampIndex(y + k - radiusY, height - 1);
+            taps[k] = &ring[static_cast<size_t>(r % ringSize) * width];
+        }
+
+        uint8_t* out = dst + y * dstStride;
+        for (int x0 = 0; x0 < width; x0 += separable::kColumnBlock) {
+            int n = std::min(separable::kColumnBlock, width - x0);
+            std::fill(acc.begin(), acc.begin() + n, 0.0f);
+            for (int k = 0; k < static_cast<int>(kernelY.size()); ++k) {
+                const float w = kernelY[k];
+                const float* in = taps[k] + x0;
+                for (int x = 0; x < n; ++x) acc[x] += w * in[x];
+            }
+            for (int x = 0; x < n; ++x) out[(x0 + x) * dstStep] = separable::toByte(acc[x], rounding);
+        }
+    }
+}
+
+// convolveSeparable with one kernel for both passes on packed float planes,
+// without rounding: sweeps chain blurs, since the Gaussian of sigma a blurred
+// by that of sigma b is the Gaussian of sqrt(a^2 + b^2), and rounding between
+// the steps would add up. src and dst may be the same plane.
+inline void convolveSeparableFloat(const float* src, float* dst, int width, int height, const std::vector<float>& kernel) {
+    if (width <= 0 || height <= 0) return;
+    const int radius = static_cast<int>(kernel.size()) / 2;
+    std::vector<float> rows(static_cast<size_t>(width) * height);
+    std::vector<float> line(width + 2 * radius);
+    for (int y = 0; y < height; ++y) {
+        const float* row = src + static_cast<size_t>(y) * width;
+        for (int p = 0; p < width + 2 * radius; ++p) line[p] = row[separable::clampIndex(p - radius, width - 1)];
+        float* out = &rows[static_cast<size_t>(y) * width];
+        std::fill(out, out + width, 0.0f);
+        for (int k = 0; k < static_cast<int>(kernel.size()); ++k) {
+            const float w = kernel[k];
+            const float* in = line.data() + k;
+            for (int x = 0; x < width; ++x) out[x] += w * in[x];
+        }
+    }
+    for (int y = 0; y < height; ++y) {
+        float* out = dst + static_cast<size_t>(y) * width;
+        std::fill(out, out + width, 0.0f);
+        for (int k = 0; k < static_cast<int>(kernel.size()); ++k) {
+            const float w = kernel[k];
+            const float* in = &rows[static_cast<size_t>(separable::clampIndex(y + k - radius, height - 1)) * width];
+            for (int x = 0; x < width; ++x) out[x] += w * in[x];
+        }
+    }
+}
+
+// Splits a 2D kernel into kernelY * kernelX^T when it is rank one (every
+// isotropic Gaussian is). Returns false for kernels that are not separable,
+// in which case callers keep the full 2D convolution.
+template <typename T>
+bool factorSeparable(const std::vector<std::vector<T>>& kernel, std::vector<float>& kernelX, std::vector<float>& kernelY) {
+    int size = static_cast<int>(kernel.size());
+    if (size == 0 || size % 2 == 0) return false;
+    int c = size / 2;
+    double pivot = kernel[c][c];
+    if (pivot <= 0) return false;
+
+    double peak = 0;
+    for (const auto& row : kernel) {
+        if (static_cast<int>(row.size()) != size) return false;
+        for (T v : row) peak = std::max(peak, std::fabs(static_cast<double>(v)));
+    }
+    for (int y = 0; y < size; ++y) {
+        for (int x = 0; x < size; ++x) {
+            double expected = static_cast<double>(kernel[y][c]) * kernel[c][x] / pivot;
+            if (std::fabs(expected - kernel[y][x]) > 1e-5 * peak) return false;
+        }
+    }
+
+    double scale = std::sqrt(pivot);
+    kernelX.resize(size);
+    kernelY.resize(size);
+    for (int i = 0; i < size; ++i) {
+        kernelX[i] = static_cast<float>(kernel[c][i] / scale);
+        kernelY[i] = static_cast<float>(kernel[i][c] / scale);
+    }
+    return true;
+}
+
+inline void gaussianFilterSeparable(const uint8_t* src, ptrdiff_t srcStride, uint8_t* dst, ptrdiff_t dstStride,
+                                    int width, int height, int kernelSize, float sigma,
+                                    Rounding rounding = Rounding::Nearest, int srcStep = 1, int dstStep = 1) {
+    std::vector<float> kernel = generateGaussianKernel1D(kernelSize, sigma);
+    convolveSeparable(src, srcStride, dst, dstStride, width, height, kernel, kernel, rounding, srcStep, dstStep);
+}
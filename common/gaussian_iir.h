@@ -0,0 +1,305 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <complex>
+#include <algorithm>
+#include <cstddef>
+
+#include "thread_pool.h"
+
+// Recursive (IIR) Gaussian smoothing whose cost per pixel does not depend on
+// sigma. Two approximations are offered, selected by `order`:
+//
+//   3 - Young & van Vliet (1995): 3rd-order causal + anti-causal cascade.
+//       Cheapest (3 feedback taps per direction); a few percent peak error
+//       at small sigma, ~1.5% at sigma 20.
+//   4 - Deriche (1993): 4th-order causal + anti-causal sum. About twice the
+//       arithmetic, ~0.1% peak error.
+//
+// Both passes run along rows and then along columns; the column pass walks
+// whole rows at a time so memory is accessed sequentially.
+
+// Above this sigma the recursive filter beats the separable FIR path on
+// typical inputs (see `gaussian_filter.exe --bench`).
+const float kIIRSigmaThreshold = 4.0f;
+
+inline bool preferIIR(float sigma) {
+    return sigma >= kIIRSigmaThreshold;
+}
+
+namespace iir {
+
+struct YoungVanVliet {
+    float B, b1, b2, b3;  // feedback taps already divided by b0
+    float M[3][3];        // right-edge state of the anti-causal pass, see below
+};
+
+// Triggs & Sdika (2006): with the line extended by its last sample u, the
+// anti-causal pass state just past the end is u + M * (w[N-1] - u, w[N-2] - u,
+// w[N-3] - u). Starting from w[N-1] instead leaves visible bands along the
+// right and bottom edges. M is found by running the filter on each unit
+// deviation until it has decayed.
+inline void youngVanVlietBoundary(YoungVanVliet& c) {
+    const double B = c.B, b1 = c.b1, b2 = c.b2, b3 = c.b3;
+    for (int j = 0; j < 3; ++j) {
+        std::vector<double> w = {0, 0, 0};  // w[N-3], w[N-2], w[N-1]
+        w[2 - j] = 1.0;
+        while (w.size() < 100000) {
+            size_t n = w.size();
+            double v = b1 * w[n - 1] + b2 * w[n - 2] + b3 * w[n - 3];
+            w.push_back(v);
+            if (n > 64 && std::fabs(v) + std::fabs(w[n - 1]) + std::fabs(w[n - 2]) < 1e-12) break;
+        }
+        double y1 = 0, y2 = 0, y3 = 0;
+        for (size_t n = w.size() - 1; n >= 3; --n) {
+            double v = B * w[n] + b1 * y1 + b2 * y2 + b3 * y3;
+            y3 = y2;
+            y2 = y1;
+            y1 = v;
+        }
+        // y1, y2, y3 now hold the anti-causal outputs at N, N+1, N+2.
+        c.M[0][j] = static_cast<float>(y1);
+        c.M[1][j] = static_cast<float>(y2);
+        c.M[2][j] = static_cast<float>(y3);
+    }
+}
+
+inline YoungVanVliet youngVanVlietCoefficients(float sigma) {
+    double q = sigma >= 2.5 ? 0.98711 * sigma - 0.96330
+                            : 3.97156 - 4.14554 * std::sqrt(1.0 - 0.26891 * std::max(sigma, 0.5f));
+    double q2 = q * q, q3 = q2 * q;
+    double b0 = 1.57825 + 2.44413 * q + 1.4281 * q2 + 0.422205 * q3;
+    double b1 = 2.44413 * q + 2.85619 * q2 + 1.26661 * q3;
+    double b2 = -(1.4281 * q2 + 1.26661 * q3);
+    double b3 = 0.422205 * q3;
+    YoungVanVliet c;
+    c.b1 = static_cast<float>(b1 / b0);
+    c.b2 = static_cast<float>(b2 / b0);
+    c.b3 = static_cast<float>(b3 / b0);
+    c.B = 1.0f - (c.b1 + c.b2 + c.b3);
+    youngVanVlietBoundary(c);
+    return c;
+}
+
+struct Deriche {
+    float n[4];  // causal feed-forward, x[i] .. x[i-3]
+    float m[4];  // anti-causal feed-forward, x[i+1] .. x[i+4]
+    float d[4];  // shared feedback, y[i-1] .. y[i-4]
+};
+
+// Deriche's fit g(x) ~ sum_k (a_k cos(w_k x / s) + c_k sin(w_k x / s)) exp(-b_k x / s),
+// rewritten as four complex exponentials and expanded into difference-equation
+// coefficients, then normalized to unit DC gain.
+inline Deriche dericheCoefficients(float sigma) {
+    typedef std::complex<double> C;
+    const double a[2] = {1.680, -0.6803};
+    const double c[2] = {3.735, -0.2598};
+    const double w[2] = {0.6318, 1.997};
+    const double b[2] = {1.783, 1.723};
+
+    C pole[4], residue[4];
+    for (int k = 0; k < 2; ++k) {
+        C p = std::exp(C(-b[k], w[k]) / static_cast<double>(sigma));
+        pole[2 * k] = p;
+        pole[2 * k + 1] = std::conj(p);
+        residue[2 * k] = C(a[k], -c[k]) / 2.0;
+        residue[2 * k + 1] = C(a[k], c[k]) / 2.0;
+    }
+
+    // Polynomials in z^-1, lowest power first.
+    auto multiply = [](const std::vector<C>& p, C root) {
+        std::vector<C> out(p.size() + 1, C(0));
+        for (size_t i = 0; i < p.size(); ++i) {
+            out[i] += p[i];
+            out[i + 1] -= p[i] * root;
+        }
+        return out;
+    };
+
+    std::vector<C> denom(1, C(1));
+    for (int k = 0; k < 4; ++k) denom = multiply(denom, pole[k]);
+
+    std::vector<C> causal(4, C(0)), anti(5, C(0));
+    for (int k = 0; k < 4; ++k) {
+        std::vector<C> rest(1, C(1));
+        for (int j = 0; j < 4; ++j) {
+            if (j != k) rest = multiply(rest, pole[j]);
+        }
+        for (int i = 0; i < 4; ++i) {
+            causal[i] += residue[k] * rest[i];
+            anti[i + 1] += residue[k] * pole[k] * rest[i];
+        }
+    }
+
+    Deriche out;
+    double sumN = 0, sumM = 0, sumD = 0;
+    for (int i = 0; i < 4; ++i) {
+        // 1 + sum(d) is tiny for large sigma, so take it from the float taps
+        // that will actually run or the DC gain drifts.
+        out.d[i] = static_cast<float>(denom[i + 1].real());
+        sumN += causal[i].real();
+        sumM += anti[i + 1].real();
+        sumD += out.d[i];
+    }
+    double gain = (sumN + sumM) / (1.0 + sumD);
+    for (int i = 0; i < 4; ++i) {
+        out.n[i] = static_cast<float>(causal[i].real() / gain);
+        out.m[i] = static_cast<float>(anti[i + 1].real() / gain);
+    }
+    return out;
+}
+
+// In-place filtering of `count` lines of length `length`. Element i of line
+// l lives at data[i * step + l * lane]: rows use (step 1, lane width), the
+// column pass uses (step width, lane 1) and so sweeps each row contiguously.
+inline void youngVanVlietLines(float* data, int length, int count, int step, int lane, const YoungVanVliet& c) {
+    std::vector<float> w1(count), w2(count), w3(count), last(count);
+    auto at = [&](int i, int l) -> float& { return data[static_cast<size_t>(i) * step + static_cast<size_t>(l) * lane]; };
+
+    // Causal pass, edges replicated (steady state of a constant input is the input).
+    for (int l = 0; l < count; ++l) {
+        w1[l] = w2[l] = w3[l] = at(0, l);
+        last[l] = at(length - 1, l);
+    }
+    for (int i = 0; i < length; ++i) {
+        for (int l = 0; l < count; ++l) {
+            float v = c.B * at(i, l) + c.b1 * w1[l] + c.b2 * w2[l] + c.b3 * w3[l];
+            w3[l] = w2[l];
+            w2[l] = w1[l];
+            w1[l] = v;
+            at(i, l) = v;
+        }
+    }
+    // Anti-causal pass.
+    for (int l = 0; l < count; ++l) {
+        float u = last[l];
+        float e0 = w1[l] - u, e1 = w2[l] - u, e2 = w3[l] - u;
+        w1[l] = u + c.M[0][0] * e0 + c.M[0][1] * e1 + c.M[0][2] * e2;
+        w2[l] = u + c.M[1][0] * e0 + c.M[1][1] * e1 + c.M[1][2] * e2;
+        w3[l] = u + c.M[2][0] * e0 + c.M[2][1] * e1 + c.M[2][2] * e2;
+    }
+    for (int i = length - 1; i >= 0; --i) {
+        for (int l = 0; l < count; ++l) {
+            float v = c.B * at(i, l) + c.b1 * w1[l] + c.b2 * w2[l] + c.b3 * w3[l];
+            w3[l] = w2[l];
+            w2[l] = w1[l];
+            w1[l] = v;
+            at(i, l) = v;
+        }
+    }
+}
+
+inline void dericheLines(float* data, int length, int count, int step, int lane, const Deriche& c) {
+    auto at = [&](int i, int l) -> float& { return data[static_cast<size_t>(i) * step + static_cast<size_t>(l) * lane]; };
+    const double sumD = 1.0 + static_cast<double>(c.d[0]) + c.d[1] + c.d[2] + c.d[3];
+    const float steadyN = static_cast<float>((static_cast<double>(c.n[0]) + c.n[1] + c.n[2] + c.n[3]) / sumD);
+    const float steadyM = static_cast<float>((static_cast<double>(c.m[0]) + c.m[1] + c.m[2] + c.m[3]) / sumD);
+
+    // x history (x[i-1..i-3]) and y history (y[i-1..i-4]) per line.
+    std::vector<float> xh(static_cast<size_t>(count) * 4), yh(static_cast<size_t>(count) * 4);
+    std::vector<float> causal(static_cast<size_t>(length) * count);
+
+    for (int l = 0; l < count; ++l) {
+        float x0 = at(0, l);
+        for (int j = 0; j < 4; ++j) {
+            xh[l * 4 + j] = x0;
+            yh[l * 4 + j] = steadyN * x0;
+        }
+    }
+    for (int i = 0; i < length; ++i) {
+        for (int l = 0; l < count; ++l) {
+            float* x = &xh[l * 4];
+            float* y = &yh[l * 4];
+            float xi = at(i, l);
+            float v = c.n[0] * xi + c.n[1] * x[0] + c.n[2] * x[1] + c.n[3] * x[2]
+                    - c.d[0] * y[0] - c.d[1] * y[1] - c.d[2] * y[2] - c.d[3] * y[3];
+            x[2] = x[1]; x[1] = x[0]; x[0] = xi;
+            y[3] = y[2]; y[2] = y[1]; y[1] = y[0]; y[0] = v;
+            causal[static_cast<size_t>(i) * count + l] = v;
+        }
+    }
+
+    // Anti-causal: x history is x[i+1..i+4], y history y[i+1..i+4].
+    for (int l = 0; l < count; ++l) {
+        float xn = at(length - 1, l);
+        for (int j = 0; j < 4; ++j) {
+            xh[l * 4 + j] = xn;
+            yh[l * 4 + j] = steadyM * xn;
+        }
+    }
+    for (int i = length - 1; i >= 0; --i) {
+        for (int l = 0; l < count; ++l) {
+            float* x = &xh[l * 4];
+            float* y = &yh[l * 4];
+            float v = c.m[0] * x[0] + c.m[1] * x[1] + c.m[2] * x[2] + c.m[3] * x[3]
+                    - c.d[0] * y[0] - c.d[1] * y[1] - c.d[2] * y[2] - c.d[3] * y[3];
+            float xi = at(i, l);
+            x[3] = x[2]; x[2] = x[1]; x[1] = x[0]; x[0] = xi;
+            y[3] = y[2]; y[2] = y[1]; y[1] = y[0]; y[0] = v;
+            at(i, l) = causal[static_cast<size_t>(i) * count + l] + v;
+        }
+    }
+}
+
+}  // namespace iir
+
+// Smooths an 8-bit plane with a recursive Gaussian of the given sigma.
+// order is 3 (Young-van Vliet) or 4 (Deriche). truncate selects
+// static_cast<uint8_t>(sum) instead of rounding to nearest. srcStep/dstStep
+// are the byte distances between neighbouring pixels, as in convolveSeparable.
+// src and dst may be the same buffer. With a pool, rows and blocks of columns
+// are filtered in parallel; every line is still one uninterrupted recursion,
+// so the output is the same.
+inline void gaussianFilterIIR(const uint8_t* src, ptrdiff_t srcStride, uint8_t* dst, ptrdiff_t dstStride,
+                              int width, int height, float sigma, int order = 4, bool truncate = false,
+                              int srcStep = 1, int dstStep = 1, ThreadPool* pool = nullptr) {
+    if (width <= 0 || height <= 0) return;
+
+    const int rowBlock = 16;
+    const int columnBlock = 64;
+    const int rowBlocks = (height + rowBlock - 1) / rowBlock;
+    const int columnBlocks = (width + columnBlock - 1) / columnBlock;
+
+    std::vector<float> plane(static_cast<size_t>(width) * height);
+    iir::Deriche deriche;
+    iir::YoungVanVliet youngVanVliet;
+    if (order == 4) {
+        deriche = iir::dericheCoefficients(sigma);
+    } else {
+        youngVanVliet = iir::youngVanVlietCoefficients(sigma);
+    }
+    auto filterLines = [&](float* data, int length, int count, int step, int lane) {
+        if (order == 4) {
+            iir::dericheLines(data, length, count, step, lane, deriche);
+        } else {
+            iir::youngVanVlietLines(data, length, count, step, lane, youngVanVliet);
+        }
+    };
+
+    parallelFor(pool, rowBlocks, [&](int block) {
+        int end = std::min(height, (block + 1) * rowBlock);
+        for (int y = block * rowBlock; y < end; ++y) {
+            const uint8_t* row = src + y * srcStride;
+            float* out = &plane[static_cast<size_t>(y) * width];
+            for (int x = 0; x < width; ++x) out[x] = row[x * srcStep];
+            filterLines(out, width, 1, 1, 0);
+        }
+    });
+    parallelFor(pool, columnBlocks, [&](int block) {
+        int x0 = block * columnBlock;
+        filterLines(plane.data() + x0, height, std::min(columnBlock, width - x0), width, 1);
+    });
+    parallelFor(pool, rowBlocks, [&](int block) {
+        int end = std::min(height, (block + 1) * rowBlock);
+        for (int y = block * rowBlock; y < end; ++y) {
+            const float* in = &plane[static_cast<size_t>(y) * width];
+            uint8_t* out = dst + y * dstStride;
+            for (int x = 0; x < width; ++x) {
+                int v = truncate ? static_cast<int>(in[x]) : static_cast<int>(in[x] + 0.5f);
+                out[x * dstStep] = static_cast<uint8_t>(v < 0 ? 0 : (v > 255 ? 255 : v));
+            }
+        }
+    });
+}
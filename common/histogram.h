@@ -0,0 +1,174 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+
+#include "bmp_io.h"
+#include "thread_pool.h"
+#include "tone_curve.h"
+
+// Histograms of 8-bit images and the remaps built from them.
+//
+// The image is cut into bands of rows and every band is counted by one task
+// into its own sub-histograms, so threads never share a counter. Within a
+// band, consecutive pixels go to four separate sets of counters in turn:
+// runs of equal values (flat areas, clipped highlights) would otherwise
+// increment the same counter back to back and wait for each store to reach
+// the next load. The band histograms are then summed by a second parallel
+// pass, one slice of bins per task.
+//
+// Intensity remaps (histogram equalization of (B + G + R) / 3 and the like)
+// scale all three channels of a pixel by new / old intensity. That factor
+// only depends on the sum B + G + R, so it is tabulated once for the 766
+// possible sums as a fixed-point gain and the remap is a multiply and a shift
+// per subpixel.
+
+struct Histogram {
+    uint64_t bins[256] = {};
+
+    uint64_t total() const {
+        uint64_t sum = 0;
+        for (uint64_t count : bins) sum += count;
+        return sum;
+    }
+
+    // Smallest and largest value with a non-zero count, -1 if empty.
+    int minValue() const {
+        for (int v = 0; v < 256; ++v) {
+            if (bins[v]) return v;
+        }
+        return -1;
+    }
+
+    int maxValue() const {
+        for (int v = 255; v >= 0; --v) {
+            if (bins[v]) return v;
+        }
+        return -1;
+    }
+
+    // Sum of all values counted.
+    double valueSum() const {
+        double sum = 0;
+        for (int v = 0; v < 256; ++v) sum += static_cast<double>(bins[v]) * v;
+        return sum;
+    }
+};
+
+// Counts the N values values(pixel, out) gives for every pixel of image into
+// histograms[0 .. N - 1].
+template <int N, typename Values>
+void computeHistograms(const ConstImageView& image, Values values, Histogram* histograms, ThreadPool* pool = nullptr) {
+    const int rowBlock = 64;
+    const int bands = (image.height + rowBlock - 1) / rowBlock;
+    std::vector<uint32_t> partial(static_cast<size_t>(bands) * N * 256);
+
+    parallelFor(pool, bands, [&](int band) {
+        uint32_t counters[N][4][256] = {};
+        int end = std::min(image.height, (band + 1) * rowBlock);
+        for (int y = band * rowBlock; y < end; ++y) {
+            const uint8_t* p = image.row(y);
+            for (int x = 0; x < image.width; ++x, p += image.channels) {
+                uint8_t v[N];
+                values(p, v);
+                for (int i = 0; i < N; ++i) ++counters[i][x & 3][v[i]];
+            }
+        }
+        uint32_t* out = partial.data() + static_cast<size_t>(band) * N * 256;
+        for (int i = 0; i < N; ++i) {
+            for (int v = 0; v < 256; ++v) {
+                out[i * 256 + v] = counters[i][0][v] + counters[i][1][v] + counters[i][2][v] + counters[i][3][v];
+            }
+        }
+    });
+
+    const int slice = 32;
+    parallelFor(pool, N * 256 / slice, [&](int task) {
+        for (int bin = task * slice; bin < (task + 1) * slice; ++bin) {
+            uint64_t sum = 0;
+            for (int band = 0; band < bands; ++band) sum += partial[static_cast<size_t>(band) * N * 256 + bin];
+            histograms[bin / 256].bins[bin % 256] = sum;
+        }
+    });
+}
+
+// Histogram of the intensity (B + G + R) / 3, rounded down.
+inline Histogram intensityHistogram(const ConstImageView& image, ThreadPool* pool = nullptr) {
+    Histogram histogram;
+    computeHistograms<1>(image, [](const uint8_t* p, uint8_t* v) {
+        v[0] = static_cast<uint8_t>((p[0] + p[1] + p[2]) / 3);
+    }, &histogram, pool);
+    return histogram;
+}
+
+// One histogram per colour channel (0 = blue, 1 = green, 2 = red), in one pass.
+inline void channelHistograms(const ConstImageView& image, Histogram histograms[3], ThreadPool* pool = nullptr) {
+    computeHistograms<3>(image, [](const uint8_t* p, uint8_t* v) {
+        v[0] = p[0];
+        v[1] = p[1];
+        v[2] = p[2];
+    }, histograms, pool);
+}
+
+// Classic equalization: v -> (cdf(v) - cdf(min)) * 255 / (total - cdf(min)),
+// where cdf(min) is the count of the smallest value present. An image of a
+// single value is left as it is.
+inline ToneCurve equalizationCurve(const Histogram& histogram) {
+    uint64_t cdf[256];
+    uint64_t running = 0;
+    for (int v = 0; v < 256; ++v) {
+        running += histogram.bins[v];
+        cdf[v] = running;
+    }
+    const uint64_t total = running;
+    const int minValue = histogram.minValue();
+    if (minValue < 0 || cdf[minValue] == total) return ToneCurve::identity();
+
+    const uint64_t minCdf = cdf[minValue];
+    ToneCurve curve;
+    for (int v = 0; v < 256; ++v) {
+        curve.table[v] = cdf[v] < minCdf ? 0 : static_cast<uint8_t>((cdf[v] - minCdf) * 255 / (total - minCdf));
+    }
+    return curve;
+}
+
+// The factor curve(intensity) / ((B + G + R) / 3) per sum B + G + R, as
+// gain >> kShift, rounded up so the remap gives the exact quotient rounded
+// down: for a subpixel c <= sum, c * gain >> kShift == c * 3 * new / sum.
+// kShift = 18 is enough for that since 2^18 > 255 * 765, and keeps c * gain
+// within 32 bits.
+struct IntensityGains {
+    static const int kShift = 18;
+    static const int kSums = 3 * 255 + 1;
+    uint32_t gain[kSums];
+};
+
+inline IntensityGains intensityGains(const ToneCurve& curve) {
+    IntensityGains gains;
+    gains.gain[0] = 0;
+    for (int sum = 1; sum < IntensityGains::kSums; ++sum) {
+        uint64_t scaled = static_cast<uint64_t>(3 * curve(static_cast<uint8_t>(sum / 3))) << IntensityGains::kShift;
+        gains.gain[sum] = static_cast<uint32_t>((scaled + sum - 1) / sum);
+    }
+    return gains;
+}
+
+// Scales the colour channels of every pixel in place by the gain of its
+// B + G + R, clamped to 255, a block of rows per task.
+inline void applyIntensityGains(const ImageView& image, const IntensityGains& gains, ThreadPool* pool = nullptr) {
+    const int rowBlock = 16;
+    parallelFor(pool, (image.height + rowBlock - 1) / rowBlock, [&](int block) {
+        int end = std::min(image.height, (block + 1) * rowBlock);
+        for (int y = block * rowBlock; y < end; ++y) {
+            uint8_t* p = image.row(y);
+            for (int x = 0; x < image.width; ++x, p += image.channels) {
+                uint32_t gain = gains.gain[p[0] + p[1] + p[2]];
+                for (int c = 0; c < 3; ++c) {
+                    p[c] = static_cast<uint8_t>(std::min<uint32_t>((p[c] * gain) >> IntensityGains::kShift, 255));
+                }
+            }
+        }
+    });
+}
@@ -0,0 +1,456 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+#include "bmp_io.h"
+#include "thread_pool.h"
+#include "aligned_image.h"
+
+// Full-reference image quality: MSE, PSNR, SSIM and MS-SSIM.
+//
+// The metrics run on float planes: one colour channel, or the luma of the
+// image as OpenCV's BGR2GRAY computes it (so a luma score matches what
+// ssim_cal.py got from cv2.imread(..., IMREAD_GRAYSCALE)).
+//
+// SSIM compares local means, variances and the covariance of two planes over
+// a window around every pixel and averages the per-pixel index over the
+// pixels whose window lies inside the image, as scikit-image does. Two
+// windows are available:
+//   - Box: the 7 x 7 uniform window with sample covariance, scikit-image's
+//     default and so the value ssim_cal.py printed. The five window sums
+//     (a, b, a^2, b^2, ab) come from running column sums and a prefix sum
+//     along each row, an integral image kept one row at a time, so the cost
+//     per pixel does not depend on the window size. The sums are exact.
+//   - Gaussian: the 11-tap, sigma 1.5 window of Wang et al., as two 1D passes
+//     over the five products. MS-SSIM always uses it.
+// Both feed one per-pixel pass that computes the index for 8 pixels at a time.
+// Everything after loading the samples is in double, so the score is the
+// definition evaluated window by window to within 1e-9 (tests/
+// image_quality_check.cpp); float means were up to 1e-6 off on photos.
+//
+// Work is split into bands of a fixed number of rows that run in parallel;
+// the band sums are added in order, so the scores do not depend on the
+// number of threads.
+
+enum class SsimWindow {
+    Box,
+    Gaussian,
+};
+
+struct SsimOptions {
+    SsimWindow window = SsimWindow::Box;
+    int boxSize = 7;             // odd
+    double dataRange = 255.0;    // L in C1 = (0.01 L)^2, C2 = (0.03 L)^2
+};
+
+// Means over the valid pixels of the SSIM index and of its contrast-structure
+// term 2 cov + C2 / (var_a + var_b + C2), the factor MS-SSIM takes at every
+// scale but the last.
+struct SsimResult {
+    double ssim = 0.0;
+    double contrastStructure = 0.0;
+};
+
+// One plane of float samples; stride in floats, rows 64-byte aligned.
+struct MetricPlane {
+    AlignedVector<float> pixels;
+    int width = 0;
+    int height = 0;
+    size_t stride = 0;
+
+    void resize(int w, int h) {
+        width = w;
+        height = h;
+        stride = alignedRowBytes(static_cast<size_t>(w) * sizeof(float)) / sizeof(float);
+        pixels.assign(stride * h, 0.0f);
+    }
+    float* row(int y) { return pixels.data() + y * stride; }
+    const float* row(int y) const { return pixels.data() + y * stride; }
+};
+
+// Channel 0 = blue, 1 = green, 2 = red.
+inline void loadChannel(const ConstImageView& view, int channel, MetricPlane& out) {
+    out.resize(view.width, view.height);
+    for (int y = 0; y < view.height; ++y) {
+        const uint8_t* in = view.row(y) + channel;
+        float* row = out.row(y);
+        for (int x = 0; x < view.width; ++x) row[x] = in[x * view.channels];
+    }
+}
+
+// OpenCV's integer BGR2GRAY: round((1868 B + 9617 G + 4899 R) / 2^14).
+inline void loadLuma(const ConstImageView& view, MetricPlane& out) {
+    out.resize(view.width, view.height);
+    for (int y = 0; y < view.height; ++y) {
+        const uint8_t* in = view.row(y);
+        float* row = out.row(y);
+        for (int x = 0; x < view.width; ++x, in += view.channels) {
+            row[x] = static_cast<float>((1868 * in[0] + 9617 * in[1] + 4899 * in[2] + (1 << 13)) >> 14);
+        }
+    }
+}
+
+// The 2 x 2 box average, dropping an odd last row or column; the step
+// between MS-SSIM scales.
+inline void downsample2x(const MetricPlane& in, MetricPlane& out) {
+    out.resize(in.width / 2, in.height / 2);
+    for (int y = 0; y < out.height; ++y) {
+        const float* top = in.row(2 * y);
+        const float* bottom = in.row(2 * y + 1);
+        float* row = out.row(y);
+        for (int x = 0; x < out.width; ++x) {
+            row[x] = 0.25f * (top[2 * x] + top[2 * x + 1] + bottom[2 * x] + bottom[2 * x + 1]);
+        }
+    }
+}
+
+namespace quality {
+
+// Rows of output (or of the plane, for MSE) per parallel task.
+const int kBandRows = 64;
+
+// Samples are centred on this before the products are formed, so a variance
+// is the difference of two numbers of the size of the variance itself rather
+// than of the squared mean; variances and covariance do not change.
+const double kCentre = 128.0;
+
+// Gaussian window of Wang et al.: sigma 1.5, truncated at 3.5 sigma.
+const int kGaussianRadius = 5;
+const double kGaussianSigma = 1.5;
+
+// The normalized 1D taps of the Gaussian window.
+inline std::vector<double> gaussianWindow() {
+    std::vector<double> taps;
+    double sum = 0.0;
+    for (int i = -kGaussianRadius; i <= kGaussianRadius; ++i) {
+        taps.push_back(std::exp(-(i * i) / (2 * kGaussianSigma * kGaussianSigma)));
+        sum += taps.back();
+    }
+    for (double& tap : taps) tap /= sum;
+    return taps;
+}
+
+// Window means of the centred a, b, a^2, b^2, ab for one row of output.
+struct MomentRows {
+    std::vector<double> a, b, aa, bb, ab;
+
+    void resize(int n) {
+        for (std::vector<double>* row : {&a, &b, &aa, &bb, &ab}) row->resize(n);
+    }
+};
+
+// Adds the SSIM index and contrast-structure term of n pixels to the sums.
+// covNorm scales the variances and covariance (N / (N - 1) for sample
+// covariance).
+inline void ssimRow(const MomentRows& m, int n, double covNorm, double c1, double c2, double& ssimSum, double& csSum) {
+    double ssimAcc[8] = {};
+    double csAcc[8] = {};
+    int x = 0;
+    for (; x + 8 <= n; x += 8) {
+        for (int j = 0; j < 8; ++j) {
+            double ma = m.a[x + j], mb = m.b[x + j];
+            double ua = ma + kCentre, ub = mb + kCentre;
+            double va = covNorm * (m.aa[x + j] - ma * ma);
+            double vb = covNorm * (m.bb[x + j] - mb * mb);
+            double vab = covNorm * (m.ab[x + j] - ma * mb);
+            double cs = (2.0 * vab + c2) / (va + vb + c2);
+            double l = (2.0 * ua * ub + c1) / (ua * ua + ub * ub + c1);
+            ssimAcc[j] += l * cs;
+            csAcc[j] += cs;
+        }
+    }
+    for (; x < n; ++x) {
+        double ma = m.a[x], mb = m.b[x];
+        double ua = ma + kCentre, ub = mb + kCentre;
+        double va = covNorm * (m.aa[x] - ma * ma);
+        double vb = covNorm * (m.bb[x] - mb * mb);
+        double vab = covNorm * (m.ab[x] - ma * mb);
+        double cs = (2.0 * vab + c2) / (va + vb + c2);
+        double l = (2.0 * ua * ub + c1) / (ua * ua + ub * ub + c1);
+        ssimAcc[0] += l * cs;
+        csAcc[0] += cs;
+    }
+    for (int j = 0; j < 8; ++j) {
+        ssimSum += ssimAcc[j];
+        csSum += csAcc[j];
+    }
+}
+
+// The centred a, b and their products for one row of the planes.
+inline void productRows(const float* a, const float* b, int width, MomentRows& out) {
+    for (int x = 0; x < width; ++x) {
+        double ca = a[x] - kCentre, cb = b[x] - kCentre;
+        out.a[x] = ca;
+        out.b[x] = cb;
+        out.aa[x] = ca * ca;
+        out.bb[x] = cb * cb;
+        out.ab[x] = ca * cb;
+    }
+}
+
+// sum[x] = sum over k of kernel[k] * rows[k][x], for x < n, k in order from 0;
+// separable::sumTaps in double.
+template <int Radius>
+inline void sumTaps(double* __restrict sum, const double* const* rows, const double* kernel, int n) {
+    constexpr int kTaps = 2 * Radius + 1;
+    double w[kTaps];
+    for (int k = 0; k < kTaps; ++k) w[k] = kernel[k];
+    int x = 0;
+    for (; x + 8 <= n; x += 8) {
+        double acc[8] = {};
+        for (int k = 0; k < kTaps; ++k) {
+            for (int j = 0; j < 8; ++j) acc[j] += w[k] * rows[k][x + j];
+        }
+        for (int j = 0; j < 8; ++j) sum[x + j] = acc[j];
+    }
+    for (; x < n; ++x) {
+        double acc = 0.0;
+        for (int k = 0; k < kTaps; ++k) acc += w[k] * rows[k][x];
+        sum[x] = acc;
+    }
+}
+
+// Output rows [y0, y1) with the box window; output row y is centred on plane
+// row y + size / 2.
+inline void ssimBandBox(const MetricPlane& a, const MetricPlane& b, int size, int y0, int y1,
+                        double c1, double c2, double& ssimSum, double& csSum) {
+    const int width = a.width;
+    const int outWidth = width - size + 1;
+    const double area = static_cast<double>(size) * size;
+
+    // columns[m][x]: sum of moment m of column x over the window's rows.
+    std::vector<double> columns[5];
+    for (std::vector<double>& column : columns) column.assign(width, 0.0);
+    std::vector<double> prefix(width + 1);
+    MomentRows products, means;
+    products.resize(width);
+    means.resize(outWidth);
+    std::vector<double>* productRow[5] = {&products.a, &products.b, &products.aa, &products.bb, &products.ab};
+    std::vector<double>* meanRow[5] = {&means.a, &means.b, &means.aa, &means.bb, &means.ab};
+
+    auto addRow = [&](int y, double sign) {
+        productRows(a.row(y), b.row(y), width, products);
+        for (int m = 0; m < 5; ++m) {
+            const double* in = productRow[m]->data();
+            double* column = columns[m].data();
+            for (int x = 0; x < width; ++x) column[x] += sign * in[x];
+        }
+    };
+
+    for (int y = y0; y < y0 + size - 1; ++y) addRow(y, 1.0);
+    for (int y = y0; y < y1; ++y) {
+        addRow(y + size - 1, 1.0);
+        for (int m = 0; m < 5; ++m) {
+            const double* column = columns[m].data();
+            prefix[0] = 0.0;
+            for (int x = 0; x < width; ++x) prefix[x + 1] = prefix[x] + column[x];
+            double* out = meanRow[m]->data();
+            for (int x = 0; x < outWidth; ++x) out[x] = (prefix[x + size] - prefix[x]) / area;
+        }
+        ssimRow(means, outWidth, area / (area - 1.0), c1, c2, ssimSum, csSum);
+        addRow(y, -1.0);
+    }
+}
+
+// Output rows [y0, y1) with the Gaussian window; output row y is centred on
+// plane row y + kGaussianRadius.
+inline void ssimBandGaussian(const MetricPlane& a, const MetricPlane& b, int y0, int y1,
+                             double c1, double c2, double& ssimSum, double& csSum) {
+    constexpr int kTaps = 2 * kGaussianRadius + 1;
+    const std::vector<double> kernel = gaussianWindow();
+    const int width = a.width;
+    const int outWidth = width - kTaps + 1;
+
+    // ring[m][r]: moment m of plane row r, filtered along the row; kTaps rows.
+    std::vector<double> ring[5];
+    for (std::vector<double>& rows : ring) rows.resize(static_cast<size_t>(kTaps) * outWidth);
+    MomentRows products, means;
+    products.resize(width);
+    means.resize(outWidth);
+    std::vector<double>* productRow[5] = {&products.a, &products.b, &products.aa, &products.bb, &products.ab};
+    std::vector<double>* meanRow[5] = {&means.a, &means.b, &means.aa, &means.bb, &means.ab};
+
+    int nextRow = y0;
+    for (int y = y0; y < y1; ++y) {
+        for (; nextRow < y + kTaps; ++nextRow) {
+            productRows(a.row(nextRow), b.row(nextRow), width, products);
+            for (int m = 0; m < 5; ++m) {
+                const double* in = productRow[m]->data();
+                const double* shifted[kTaps];
+                for (int k = 0; k < kTaps; ++k) shifted[k] = in + k;
+                double* out = &ring[m][static_cast<size_t>(nextRow % kTaps) * outWidth];
+                sumTaps<kGaussianRadius>(out, shifted, kernel.data(), outWidth);
+            }
+        }
+        for (int m = 0; m < 5; ++m) {
+            const double* taps[kTaps];
+            for (int k = 0; k < kTaps; ++k) taps[k] = &ring[m][static_cast<size_t>((y + k) % kTaps) * outWidth];
+            sumTaps<kGaussianRadius>(meanRow[m]->data(), taps, kernel.data(), outWidth);
+        }
+        ssimRow(means, outWidth, 1.0, c1, c2, ssimSum, csSum);
+    }
+}
+
+}  // namespace quality
+
+// SSIM of two planes of the same size; false if the window does not fit in
+// them.
+inline bool structuralSimilarity(const MetricPlane& a, const MetricPlane& b, const SsimOptions& options,
+                                 ThreadPool* pool, SsimResult& result) {
+    const int size = options.window == SsimWindow::Box ? options.boxSize : 2 * quality::kGaussianRadius + 1;
+    const int outWidth = a.width - size + 1;
+    const int outHeight = a.height - size + 1;
+    if (a.width != b.width || a.height != b.height || outWidth <= 0 || outHeight <= 0) return false;
+
+    const double c1 = (0.01 * options.dataRange) * (0.01 * options.dataRange);
+    const double c2 = (0.03 * options.dataRange) * (0.03 * options.dataRange);
+    const int bands = (outHeight + quality::kBandRows - 1) / quality::kBandRows;
+    std::vector<double> ssimSums(bands), csSums(bands);
+    parallelFor(pool, bands, [&](int band) {
+        int y0 = band * quality::kBandRows;
+        int y1 = std::min(outHeight, y0 + quality::kBandRows);
+        if (options.window == SsimWindow::Box) {
+            quality::ssimBandBox(a, b, size, y0, y1, c1, c2, ssimSums[band], csSums[band]);
+        } else {
+            quality::ssimBandGaussian(a, b, y0, y1, c1, c2, ssimSums[band], csSums[band]);
+        }
+    });
+
+    double ssimSum = 0.0, csSum = 0.0;
+    for (int band = 0; band < bands; ++band) {
+        ssimSum += ssimSums[band];
+        csSum += csSums[band];
+    }
+    const double count = static_cast<double>(outWidth) * outHeight;
+    result.ssim = ssimSum / count;
+    result.contrastStructure = csSum / count;
+    return true;
+}
+
+// Scales of MS-SSIM and their exponents (Wang, Simoncelli and Bovik 2003).
+const int kMsSsimScales = 5;
+const double kMsSsimWeights[kMsSsimScales] = {0.0448, 0.2856, 0.3001, 0.2363, 0.1333};
+
+// Smallest side MS-SSIM takes: the Gaussian window has to fit at the
+// coarsest scale.
+inline int msSsimMinSide() {
+    return (2 * quality::kGaussianRadius + 1) << (kMsSsimScales - 1);
+}
+
+// MS-SSIM with the Gaussian window: the product over scales of the mean
+// contrast-structure term, and at the coarsest scale the mean SSIM, each to
+// its weight. Negative terms count as 0. false if a side is shorter than
+// msSsimMinSide().
+inline bool multiScaleSsim(const MetricPlane& a, const MetricPlane& b, double dataRange, ThreadPool* pool, double& value) {
+    if (a.width != b.width || a.height != b.height || std::min(a.width, a.height) < msSsimMinSide()) return false;
+
+    SsimOptions options;
+    options.window = SsimWindow::Gaussian;
+    options.dataRange = dataRange;
+    MetricPlane scaledA, scaledB, nextA, nextB;
+    const MetricPlane* pa = &a;
+    const MetricPlane* pb = &b;
+    value = 1.0;
+    for (int scale = 0; scale < kMsSsimScales; ++scale) {
+        SsimResult result;
+        if (!structuralSimilarity(*pa, *pb, options, pool, result)) return false;
+        const bool last = scale == kMsSsimScales - 1;
+        value *= std::pow(std::max(0.0, last ? result.ssim : result.contrastStructure), kMsSsimWeights[scale]);
+        if (last) break;
+        downsample2x(*pa, nextA);
+        downsample2x(*pb, nextB);
+        std::swap(scaledA, nextA);
+        std::swap(scaledB, nextB);
+        pa = &scaledA;
+        pb = &scaledB;
+    }
+    return true;
+}
+
+// Mean of (a - b)^2 over two planes of the same size.
+inline double meanSquaredError(const MetricPlane& a, const MetricPlane& b, ThreadPool* pool) {
+    const int bands = (a.height + quality::kBandRows - 1) / quality::kBandRows;
+    std::vector<double> sums(bands);
+    parallelFor(pool, bands, [&](int band) {
+        int y1 = std::min(a.height, (band + 1) * quality::kBandRows);
+        double acc[8] = {};
+        for (int y = band * quality::kBandRows; y < y1; ++y) {
+            const float* ra = a.row(y);
+            const float* rb = b.row(y);
+            int x = 0;
+            for (; x + 8 <= a.width; x += 8) {
+                for (int j = 0; j < 8; ++j) {
+                    float d = ra[x + j] - rb[x + j];
+                    acc[j] += d * d;
+                }
+            }
+            for (; x < a.width; ++x) acc[0] += (ra[x] - rb[x]) * (ra[x] - rb[x]);
+        }
+        for (int j = 0; j < 8; ++j) sums[band] += acc[j];
+    });
+    double sum = 0.0;
+    for (double s : sums) sum += s;
+    return sum / (static_cast<double>(a.width) * a.height);
+}
+
+// In dB; infinite for identical images.
+inline double psnrFromMse(double mse, double dataRange = 255.0) {
+    if (mse <= 0.0) return std::numeric_limits<double>::infinity();
+    return 10.0 * std::log10(dataRange * dataRange / mse);
+}
+
+enum QualityMetric : unsigned {
+    MetricMse = 1,
+    MetricPsnr = 2,
+    MetricSsim = 4,
+    MetricMsSsim = 8,
+    MetricAll = 15,
+};
+
+// Scores of one plane pair; a metric not asked for, or MS-SSIM on a plane
+// too small for it, is NaN. PSNR brings the MSE it is computed from along.
+struct QualityScores {
+    double mse = std::numeric_limits<double>::quiet_NaN();
+    double psnr = std::numeric_limits<double>::quiet_NaN();
+    double ssim = std::numeric_limits<double>::quiet_NaN();
+    double msSsim = std::numeric_limits<double>::quiet_NaN();
+};
+
+inline QualityScores measureQuality(const MetricPlane& reference, const MetricPlane& test, unsigned metrics,
+                                    const SsimOptions& options, ThreadPool* pool) {
+    QualityScores scores;
+    if (metrics & (MetricMse | MetricPsnr)) {
+        scores.mse = meanSquaredError(reference, test, pool);
+        if (metrics & MetricPsnr) scores.psnr = psnrFromMse(scores.mse, options.dataRange);
+    }
+    SsimResult result;
+    if ((metrics & MetricSsim) && structuralSimilarity(reference, test, options, pool, result)) {
+        scores.ssim = result.ssim;
+    }
+    double value;
+    if ((metrics & MetricMsSsim) && multiScaleSsim(reference, test, options.dataRange, pool, value)) {
+        scores.msSsim = value;
+    }
+    return scores;
+}
+
+// The scores of the three colour channels combined: MSE and the SSIMs
+// averaged, PSNR from the mean MSE.
+inline QualityScores averageScores(const QualityScores* channels, int count, unsigned metrics, double dataRange = 255.0) {
+    QualityScores mean;
+    double mse = 0.0, ssim = 0.0, msSsim = 0.0;
+    for (int c = 0; c < count; ++c) {
+        mse += channels[c].mse;
+        ssim += channels[c].ssim;
+        msSsim += channels[c].msSsim;
+    }
+    if (metrics & (MetricMse | MetricPsnr)) mean.mse = mse / count;
+    if (metrics & MetricPsnr) mean.psnr = psnrFromMse(mse / count, dataRange);
+    if (metrics & MetricSsim) mean.ssim = ssim / count;
+    if (metrics & MetricMsSsim) mean.msSsim = msSsim / count;
+    return mean;
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <cstddef>
+
+// Constant-time median filter for 8-bit planes (Perreault & Hebert, 2007).
+//
+// Every column keeps a histogram of the (2r+1) pixels above and below the
+// current row, split into 16 coarse bins and 256 fine bins. The kernel
+// histogram is the sum of 2r+1 column histograms; sliding right adds one
+// column and removes another. Only the coarse level is kept up to date on
+// every step, the fine level of a coarse bin is refreshed lazily when the
+// median falls into it. Borders replicate the edge pixel exactly like
+// clamp(x + kx, 0, width - 1), so the result matches the sort-based filter.
+
+namespace ctmf {
+
+inline int clampIndex(int value, int maxValue) {
+    return value < 0 ? 0 : (value > maxValue ? maxValue : value);
+}
+
+inline void addCoarse(uint32_t* dst, const uint16_t* src) {
+    for (int i = 0; i < 16; ++i) dst[i] += src[i];
+}
+
+inline void subCoarse(uint32_t* dst, const uint16_t* src) {
+    for (int i = 0; i < 16; ++i) dst[i] -= src[i];
+}
+
+// Column histograms: coarse[16] and fine[256] per column. The fine bins of
+// coarse bin b live at fine[16 * b .. 16 * b + 15].
+struct ColumnHistograms {
+    std::vector<uint16_t> coarse;
+    std::vector<uint16_t> fine;
+
+    explicit ColumnHistograms(int width) : coarse(static_cast<size_t>(width) * 16, 0), fine(static_cast<size_t>(width) * 256, 0) {}
+
+    // Adds (sign 1) or removes (sign -1) one row of pixels.
+    void update(const uint8_t* row, int srcStep, int width, int sign) {
+        for (int x = 0; x < width; ++x) {
+            uint8_t v = row[x * srcStep];
+            coarse[x * 16 + (v >> 4)] += sign;
+            fine[x * 256 + v] += sign;
+        }
+    }
+};
+
+// One output row from column histograms that each cover the 2 radius + 1
+// rows around it.
+inline void medianRow(const ColumnHistograms& columns, int width, int radius, uint8_t* out, int dstStep) {
+    const int diameter = 2 * radius + 1;
+    const uint32_t rank = static_cast<uint32_t>(diameter) * diameter / 2;
+    const int lastCol = width - 1;
+    const uint16_t* colCoarse = columns.coarse.data();
+    const uint16_t* colFine = columns.fine.data();
+
+    uint32_t coarse[16] = {};
+    uint32_t fine[16][16];
+    int lastUpdated[16];
+    for (int kx = -radius; kx <= radius; ++kx) {
+        addCoarse(coarse, &colCoarse[clampIndex(kx, lastCol) * 16]);
+    }
+    for (int b = 0; b < 16; ++b) lastUpdated[b] = -diameter - 1;
+
+    for (int x = 0; x < width; ++x) {
+        if (x > 0) {
+            addCoarse(coarse, &colCoarse[clampIndex(x + radius, lastCol) * 16]);
+            subCoarse(coarse, &colCoarse[clampIndex(x - radius - 1, lastCol) * 16]);
+        }
+
+        // Locate the coarse bin holding the median.
+        uint32_t count = 0;
+        int b = 0;
+        while (count + coarse[b] <= rank) {
+            count += coarse[b];
+            ++b;
+        }
+
+        // Bring the fine histogram of that bin up to date with column x.
+        uint32_t* segment = fine[b];
+        if (x - lastUpdated[b] > diameter) {
+            std::memset(segment, 0, sizeof(fine[b]));
+            for (int kx = x - radius; kx <= x + radius; ++kx) {
+                const uint16_t* col = &colFine[clampIndex(kx, lastCol) * 256 + 16 * b];
+                for (int i = 0; i < 16; ++i) segment[i] += col[i];
+            }
+        } else {
+            for (int cx = lastUpdated[b] + 1; cx <= x; ++cx) {
+                const uint16_t* in = &colFine[clampIndex(cx + radius, lastCol) * 256 + 16 * b];
+                const uint16_t* outCol = &colFine[clampIndex(cx - radius - 1, lastCol) * 256 + 16 * b];
+                for (int i = 0; i < 16; ++i) segment[i] += in[i] - outCol[i];
+            }
+        }
+        lastUpdated[b] = x;
+
+        int i = 0;
+        while (count + segment[i] <= rank) {
+            count += segment[i];
+            ++i;
+        }
+        out[x * dstStep] = static_cast<uint8_t>(16 * b + i);
+    }
+}
+
+}  // namespace ctmf
+
+// src/dst are row-major planes; strides are in bytes and may be negative.
+// srcStep/dstStep are the byte distances between neighbouring pixels, so one
+// channel of an interleaved image (e.g. a mapped BGR file) can be filtered in
+// place of a deinterleaved plane.
+inline void medianFilterHistogram(const uint8_t* src, ptrdiff_t srcStride,
+                                  uint8_t* dst, ptrdiff_t dstStride,
+                                  int width, int height, int radius,
+                                  int srcStep = 1, int dstStep = 1) {
+    if (width <= 0 || height <= 0) return;
+    const int lastRow = height - 1;
+    ctmf::ColumnHistograms columns(width);
+
+    // Prime the column histograms with rows clamp(-r-1 .. r-1) so the first
+    // update below moves them to clamp(-r .. r).
+    for (int ky = -radius - 1; ky < radius; ++ky) {
+        columns.update(src + ctmf::clampIndex(ky, lastRow) * srcStride, srcStep, width, 1);
+    }
+
+    for (int y = 0; y < height; ++y) {
+        columns.update(src + ctmf::clampIndex(y - radius - 1, lastRow) * srcStride, srcStep, width, -1);
+        columns.update(src + ctmf::clampIndex(y + radius, lastRow) * srcStride, srcStep, width, 1);
+        ctmf::medianRow(columns, width, radius, dst + y * dstStride, dstStep);
+    }
+}
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+#include <utility>
+#include <algorithm>
+
+// 3x3 and 5x5 median filters for 8-bit planes built from sorting networks.
+//
+// A compare-exchange puts the min of two values in one slot and the max in the
+// other without branching, so a fixed list of them runs over a whole block of
+// pixels at once, one min and one max per vector of 16 or 32 bytes. Each
+// window column is sorted first (3 or 9 exchanges) and shared by the 3 or 5
+// windows it belongs to. A selection network then takes the median of the
+// sorted columns: 10 exchanges for 3x3 (max of the minima, median of the
+// middles, min of the maxima, and the median of those three), and for 5x5
+// Batcher's odd-even merge sort of 25 values with every exchange dropped that
+// never swaps when the columns are sorted, then every output not on the path
+// to the median. Both were checked on all 0-1 inputs with sorted columns,
+// which by the 0-1 principle covers all inputs.
+//
+// The window radius is a template parameter and every exchange is
+// instantiated with constant slots, so the block loops have a fixed length
+// and no aliasing to check, and GCC vectorizes them at -O2. Borders
+// replicate the edge pixel like clamp(x + kx, 0, width - 1), so the output
+// equals the sort and histogram filters' byte for byte.
+
+namespace mednet {
+
+enum Keep : uint8_t {
+    Min = 1,   // only the lower slot is read later
+    Max = 2,   // only the upper slot is read later
+    Both = 3,
+};
+
+struct Exchange {
+    uint8_t low;   // receives the min
+    uint8_t high;  // receives the max
+    uint8_t keep;
+};
+
+// Pixels per block: one vector of slots per exchange.
+const int kBlock = 32;
+
+constexpr Exchange kSort3[] = {{0, 1, Both}, {0, 2, Both}, {1, 2, Both}};
+
+constexpr Exchange kSort5[] = {
+    {0, 1, Both}, {2, 3, Both}, {0, 2, Both}, {1, 3, Both}, {1, 2, Both},
+    {0, 4, Both}, {2, 4, Both}, {1, 2, Both}, {3, 4, Both},
+};
+
+// Slot c * 3 + k holds row k of sorted column c; the median ends in slot 4.
+constexpr Exchange kMedian9[] = {
+    {0, 3, Max}, {3, 6, Max},                // max of the minima -> 6
+    {5, 8, Min}, {2, 5, Min},                // min of the maxima -> 2
+    {1, 4, Both}, {4, 7, Min}, {1, 4, Max},  // median of the middles -> 4
+    {2, 4, Both}, {4, 6, Min}, {2, 4, Max},  // median of 2, 4, 6 -> 4
+};
+
+// Slot c * 5 + k holds row k of sorted column c; the median ends in slot 12.
+constexpr Exchange kMedian25[] = {
+    {4, 5, Both}, {14, 15, Both}, {5, 7, Both}, {8, 10, Both}, {9, 11, Both}, {12, 14, Both},
+    {5, 6, Both}, {9, 10, Both}, {13, 14, Both}, {0, 4, Both}, {1, 5, Both}, {2, 6, Both},
+    {8, 12, Both}, {10, 14, Both}, {11, 15, Both}, {16, 20, Both}, {17, 21, Both}, {18, 22, Both},
+    {19, 23, Both}, {2, 4, Both}, {3, 5, Both}, {10, 12, Both}, {11, 13, Both}, {18, 20, Both},
+    {19, 21, Both}, {1, 2, Both}, {3, 4, Both}, {5, 6, Both}, {9, 10, Both}, {11, 12, Both},
+    {13, 14, Both}, {17, 18, Both}, {19, 20, Both}, {21, 22, Both}, {0, 8, Both}, {1, 9, Both},
+    {2, 10, Both}, {3, 11, Both}, {4, 12, Both}, {5, 13, Both}, {6, 14, Both}, {7, 15, Min},
+    {4, 8, Both}, {5, 9, Both}, {6, 10, Both}, {7, 11, Both}, {20, 24, Both}, {2, 4, Both},
+    {3, 5, Both}, {6, 8, Both}, {7, 9, Both}, {10, 12, Both}, {11, 13, Both}, {22, 24, Both},
+    {1, 2, Both}, {3, 4, Both}, {5, 6, Both}, {7, 8, Both}, {9, 10, Both}, {11, 12, Both},
+    {13, 14, Min}, {21, 22, Both}, {23, 24, Both}, {0, 16, Max}, {1, 17, Max}, {2, 18, Max},
+    {3, 19, Max}, {4, 20, Max}, {5, 21, Max}, {6, 22, Min}, {7, 23, Min}, {8, 24, Min},
+    {8, 16, Max}, {9, 17, Max}, {10, 18, Min}, {11, 19, Min}, {12, 20, Min}, {13, 21, Min},
+    {6, 10, Max}, {7, 11, Max}, {12, 16, Min}, {13, 17, Min}, {10, 12, Max}, {11, 13, Min},
+    {11, 12, Max},
+};
+
+template <int Low, int High, int Kept>
+inline void exchange(uint8_t (*slots)[kBlock]) {
+    for (int x = 0; x < kBlock; ++x) {
+        uint8_t a = slots[Low][x], b = slots[High][x];
+        if (Kept & Min) slots[Low][x] = a < b ? a : b;
+        if (Kept & Max) slots[High][x] = a < b ? b : a;
+    }
+}
+
+template <size_t N, const Exchange (&Network)[N], size_t... I>
+inline void applyNetwork(uint8_t (*slots)[kBlock], std::index_sequence<I...>) {
+    (exchange<Network[I].low, Network[I].high, Network[I].keep>(slots), ...);
+}
+
+template <size_t N, const Exchange (&Network)[N]>
+inline void applyNetwork(uint8_t (*slots)[kBlock]) {
+    applyNetwork<N, Network>(slots, std::make_index_sequence<N>());
+}
+
+template <int Radius> struct Networks;
+
+template <> struct Networks<1> {
+    static void sortColumns(uint8_t (*slots)[kBlock]) { applyNetwork<3, kSort3>(slots); }
+    static void selectMedian(uint8_t (*slots)[kBlock]) { applyNetwork<10, kMedian9>(slots); }
+};
+
+template <> struct Networks<2> {
+    static void sortColumns(uint8_t (*slots)[kBlock]) { applyNetwork<9, kSort5>(slots); }
+    static void selectMedian(uint8_t (*slots)[kBlock]) { applyNetwork<85, kMedian25>(slots); }
+};
+
+inline int clampIndex(int value, int maxValue) {
+    return value < 0 ? 0 : (value > maxValue ? maxValue : value);
+}
+
+}  // namespace mednet
+
+// Median of the (2 Radius + 1)^2 window, Radius 1 or 2. Strides and steps as
+// in medianFilterHistogram.
+template <int Radius>
+void medianFilterNetwork(const uint8_t* src, ptrdiff_t srcStride, uint8_t* dst, ptrdiff_t dstStride,
+                         int width, int height, int srcStep = 1, int dstStep = 1) {
+    using mednet::kBlock;
+    constexpr int kDiameter = 2 * Radius + 1;
+    if (width <= 0 || height <= 0) return;
+
+    // columns[k][p]: row k of the window's column at x = p - Radius, sorted
+    // over k. One block more than the output blocks, for the windows of the
+    // last one; the extra columns never reach the output.
+    const int padded = width + 2 * Radius;
+    const int blocks = (width + kBlock - 1) / kBlock + 1;
+    std::vector<uint8_t> columns(static_cast<size_t>(kDiameter) * blocks * kBlock);
+    auto column = [&](int k) { return &columns[static_cast<size_t>(k) * blocks * kBlock]; };
+
+    alignas(32) uint8_t slots[kDiameter * kDiameter][kBlock];
+
+    for (int y = 0; y < height; ++y) {
+        for (int k = 0; k < kDiameter; ++k) {
+            const uint8_t* row = src + mednet::clampIndex(y + k - Radius, height - 1) * srcStride;
+            uint8_t* out = column(k);
+            for (int p = 0; p < padded; ++p) out[p] = row[mednet::clampIndex(p - Radius, width - 1) * srcStep];
+        }
+        for (int b = 0; b < blocks; ++b) {
+            for (int k = 0; k < kDiameter; ++k) std::memcpy(slots[k], column(k) + b * kBlock, kBlock);
+            mednet::Networks<Radius>::sortColumns(slots);
+            for (int k = 0; k < kDiameter; ++k) std::memcpy(column(k) + b * kBlock, slots[k], kBlock);
+        }
+
+        uint8_t* out = dst + y * dstStride;
+        for (int x0 = 0; x0 < width; x0 += kBlock) {
+            for (int c = 0; c < kDiameter; ++c) {
+                for (int k = 0; k < kDiameter; ++k) std::memcpy(slots[c * kDiameter + k], column(k) + x0 + c, kBlock);
+            }
+            mednet::Networks<Radius>::selectMedian(slots);
+            const uint8_t* median = slots[kDiameter * kDiameter / 2];
+            int n = std::min(kBlock, width - x0);
+            for (int x = 0; x < n; ++x) out[(x0 + x) * dstStep] = median[x];
+        }
+    }
+}
+
+// The network filter for the radii it exists for; false otherwise, and the
+// caller falls back to the histogram or sort filter.
+inline bool medianFilterSmall(const uint8_t* src, ptrdiff_t srcStride, uint8_t* dst, ptrdiff_t dstStride,
+                              int width, int height, int radius, int srcStep = 1, int dstStep = 1) {
+    switch (radius) {
+        case 1: medianFilterNetwork<1>(src, srcStride, dst, dstStride, width, height, srcStep, dstStep); return true;
+        case 2: medianFilterNetwork<2>(src, srcStride, dst, dstStride, width, height, srcStep, dstStep); return true;
+        default: return false;
+    }
+}
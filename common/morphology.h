@@ -0,0 +1,201 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <cstddef>
+
+// Separable max / min / midpoint filters using the van Herk / Gil-Werman
+// algorithm. A square k x k window is a horizontal pass followed by a vertical
+// pass; each 1D pass splits the (edge-replicated) line into blocks of k,
+// computes running maxima forward and backward inside every block, and takes
+// one more comparison per output. That is ~3 comparisons per pixel per pass,
+// independent of k. Borders replicate the edge pixel exactly like
+// clamp(x + kx, 0, width - 1), so the results match the brute-force filters.
+// Strides are in bytes and may be negative; srcStep/dstStep are the byte
+// distances between neighbouring pixels, so one channel of an interleaved
+// image can be filtered directly.
+
+namespace vhgw {
+
+struct MaxOp {
+    using T = uint8_t;
+    static T lift(uint8_t v) { return v; }
+    static T combine(T a, T b) { return a > b ? a : b; }
+};
+
+struct MinOp {
+    using T = uint8_t;
+    static T lift(uint8_t v) { return v; }
+    static T combine(T a, T b) { return a < b ? a : b; }
+};
+
+// Min and max carried together so the midpoint filter needs one pass.
+struct MinMaxOp {
+    struct T {
+        uint8_t lo;
+        uint8_t hi;
+    };
+    static T lift(uint8_t v) { return {v, v}; }
+    static T combine(T a, T b) {
+        return {a.lo < b.lo ? a.lo : b.lo, a.hi > b.hi ? a.hi : b.hi};
+    }
+};
+
+inline int clampIndex(int value, int maxValue) {
+    return value < 0 ? 0 : (value > maxValue ? maxValue : value);
+}
+
+// Horizontal pass: one row at a time through a padded line buffer.
+template <typename Op>
+void filterRows(const uint8_t* src, ptrdiff_t srcStride, int srcStep, typename Op::T* dst, int width, int height, int radius) {
+    using T = typename Op::T;
+    const int k = 2 * radius + 1;
+    const int padded = width + 2 * radius;
+    std::vector<T> line(padded), prefix(padded), suffix(padded);
+
+    for (int y = 0; y < height; ++y) {
+        const uint8_t* row = src + y * srcStride;
+        for (int p = 0; p < padded; ++p) {
+            line[p] = Op::lift(row[clampIndex(p - radius, width - 1) * srcStep]);
+        }
+
+        for (int start = 0; start < padded; start += k) {
+            int end = std::min(start + k, padded);
+            prefix[start] = line[start];
+            for (int p = start + 1; p < end; ++p) prefix[p] = Op::combine(prefix[p - 1], line[p]);
+            suffix[end - 1] = line[end - 1];
+            for (int p = end - 2; p >= start; --p) suffix[p] = Op::combine(suffix[p + 1], line[p]);
+        }
+
+        T* out = dst + static_cast<size_t>(y) * width;
+        for (int x = 0; x < width; ++x) {
+            out[x] = Op::combine(suffix[x], prefix[x + k - 1]);
+        }
+    }
+}
+
+// Vertical pass: works on whole rows so every access is sequential. Only the
+// suffix rows of the current block and the prefix rows of the next block are
+// kept, i.e. 2k rows of scratch.
+template <typename Op>
+void filterColumns(const typename Op::T* src, typename Op::T* dst, int width, int height, int radius) {
+    using T = typename Op::T;
+    const int k = 2 * radius + 1;
+    const int padded = height + 2 * radius;
+    std::vector<T> suffix(static_cast<size_t>(k) * width), prefix(static_cast<size_t>(k) * width);
+
+    auto paddedRow = [&](int p) {
+        return src + static_cast<size_t>(clampIndex(p - radius, height - 1)) * width;
+    };
+
+    // Backward running combine over block rows [start, end).
+    auto buildSuffix = [&](int start, int end) {
+        T* last = &suffix[static_cast<size_t>(end - 1 - start) * width];
+        std::copy(paddedRow(end - 1), paddedRow(end - 1) + width, last);
+        for (int p = end - 2; p >= start; --p) {
+            T* cur = &suffix[static_cast<size_t>(p - start) * width];
+            const T* next = cur + width;
+            const T* row = paddedRow(p);
+            for (int x = 0; x < width; ++x) cur[x] = Op::combine(next[x], row[x]);
+        }
+    };
+    auto buildPrefix = [&](int start, int end) {
+        std::copy(paddedRow(start), paddedRow(start) + width, prefix.begin());
+        for (int p = start + 1; p < end; ++p) {
+            T* cur = &prefix[static_cast<size_t>(p - start) * width];
+            const T* prev = cur - width;
+            const T* row = paddedRow(p);
+            for (int x = 0; x < width; ++x) cur[x] = Op::combine(prev[x], row[x]);
+        }
+    };
+
+    buildSuffix(0, std::min(k, padded));
+    for (int start = 0; start < height; start += k) {
+        int nextStart = start + k;
+        int nextEnd = std::min(nextStart + k, padded);
+        if (nextStart < padded) buildPrefix(nextStart, nextEnd);
+
+        int stop = std::min(start + k, height);
+        for (int y = start; y < stop; ++y) {
+            int j = y - start;
+            const T* h = &suffix[static_cast<size_t>(j) * width];
+            T* out = dst + static_cast<size_t>(y) * width;
+            if (j == 0) {
+                std::copy(h, h + width, out);
+            } else {
+                const T* g = &prefix[static_cast<size_t>(j - 1) * width];
+                for (int x = 0; x < width; ++x) out[x] = Op::combine(h[x], g[x]);
+            }
+        }
+
+        if (nextStart < padded) buildSuffix(nextStart, nextEnd);
+    }
+}
+
+template <typename Op>
+void filter2D(const uint8_t* src, ptrdiff_t srcStride, int srcStep, typename Op::T* dst, int width, int height, int radius) {
+    std::vector<typename Op::T> rows(static_cast<size_t>(width) * height);
+    filterRows<Op>(src, srcStride, srcStep, rows.data(), width, height, radius);
+    filterColumns<Op>(rows.data(), dst, width, height, radius);
+}
+
+// The filter of radius + 1 from the packed result of radius: its 3 x 3
+// filter, since the clamped windows of x - 1, x and x + 1 together cover the
+// clamped window of x one wider. A sweep over kernel sizes steps from one
+// size to the next this way, at 2 comparisons per pixel and pass.
+template <typename Op>
+void growRadius(const typename Op::T* src, typename Op::T* dst, int width, int height) {
+    using T = typename Op::T;
+    std::vector<T> rows(static_cast<size_t>(width) * height);
+    for (int y = 0; y < height; ++y) {
+        const T* in = src + static_cast<size_t>(y) * width;
+        T* out = &rows[static_cast<size_t>(y) * width];
+        for (int x = 0; x < width; ++x) {
+            out[x] = Op::combine(Op::combine(in[clampIndex(x - 1, width - 1)], in[x]), in[clampIndex(x + 1, width - 1)]);
+        }
+    }
+    for (int y = 0; y < height; ++y) {
+        const T* above = &rows[static_cast<size_t>(clampIndex(y - 1, height - 1)) * width];
+        const T* centre = &rows[static_cast<size_t>(y) * width];
+        const T* below = &rows[static_cast<size_t>(clampIndex(y + 1, height - 1)) * width];
+        T* out = dst + static_cast<size_t>(y) * width;
+        for (int x = 0; x < width; ++x) out[x] = Op::combine(Op::combine(above[x], centre[x]), below[x]);
+    }
+}
+
+inline void copyToStrided(const uint8_t* packed, uint8_t* dst, ptrdiff_t dstStride, int dstStep, int width, int height) {
+    for (int y = 0; y < height; ++y) {
+        const uint8_t* in = packed + static_cast<size_t>(y) * width;
+        uint8_t* row = dst + y * dstStride;
+        for (int x = 0; x < width; ++x) row[x * dstStep] = in[x];
+    }
+}
+
+}  // namespace vhgw
+
+inline void maxFilterVHGW(const uint8_t* src, ptrdiff_t srcStride, uint8_t* dst, ptrdiff_t dstStride,
+                          int width, int height, int radius, int srcStep = 1, int dstStep = 1) {
+    std::vector<uint8_t> out(static_cast<size_t>(width) * height);
+    vhgw::filter2D<vhgw::MaxOp>(src, srcStride, srcStep, out.data(), width, height, radius);
+    vhgw::copyToStrided(out.data(), dst, dstStride, dstStep, width, height);
+}
+
+inline void minFilterVHGW(const uint8_t* src, ptrdiff_t srcStride, uint8_t* dst, ptrdiff_t dstStride,
+                          int width, int height, int radius, int srcStep = 1, int dstStep = 1) {
+    std::vector<uint8_t> out(static_cast<size_t>(width) * height);
+    vhgw::filter2D<vhgw::MinOp>(src, srcStride, srcStep, out.data(), width, height, radius);
+    vhgw::copyToStrided(out.data(), dst, dstStride, dstStep, width, height);
+}
+
+// (min + max) / 2 over the window, with min and max found in the same pass.
+inline void midpointFilterVHGW(const uint8_t* src, ptrdiff_t srcStride, uint8_t* dst, ptrdiff_t dstStride,
+                               int width, int height, int radius, int srcStep = 1, int dstStep = 1) {
+    std::vector<vhgw::MinMaxOp::T> out(static_cast<size_t>(width) * height);
+    vhgw::filter2D<vhgw::MinMaxOp>(src, srcStride, srcStep, out.data(), width, height, radius);
+    for (int y = 0; y < height; ++y) {
+        const vhgw::MinMaxOp::T* in = &out[static_cast<size_t>(y) * width];
+        uint8_t* row = dst + y * dstStride;
+        for (int x = 0; x < width; ++x) row[x * dstStep] = static_cast<uint8_t>((in[x].lo + in[x].hi) / 2);
+    }
+}
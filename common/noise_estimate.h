@@ -0,0 +1,211 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+
+#include "bmp_io.h"
+#include "thread_pool.h"
+
+// Blind estimates of the noise in an 8-bit image, per colour channel.
+//
+// Wavelet (Donoho and Johnstone; what skimage's estimate_sigma computes):
+// the finest diagonal detail band HH of a one-level db2 transform holds
+// almost nothing but noise on natural images, so its median absolute value
+// over 0.6745 (the median of |N(0, 1)|) estimates the noise sigma, and the
+// median ignores the few large coefficients edges leave behind. The median is
+// taken from a histogram of |HH| in steps of 1/32, interpolated inside the
+// step that holds it, so the pass keeps no coefficients: every band of rows
+// is read once and counted into its own histogram, and the histograms are
+// summed afterwards.
+//
+// Laplacian (Immerkaer 1996): the 3x3 operator [1 -2 1; -2 4 -2; 1 -2 1] is
+// the difference of two Laplacians and cancels locally linear image content;
+// the mean of its absolute response is sqrt(2 / pi) * 6 sigma on Gaussian
+// noise. Integer arithmetic only and a little faster than the wavelet
+// estimate, but biased upwards more by texture.
+//
+// Both also count impulse (salt-and-pepper) pixels: subpixels at 0 or 255
+// whose four neighbours are all at least kImpulseContrast away from them.
+// Gaussian-noise estimates are meaningless on such images, and a median
+// filter is the remedy rather than a smoothing one.
+//
+// Borders are skipped rather than extended, so only complete neighbourhoods
+// are counted.
+
+enum class NoiseEstimator {
+    Wavelet,
+    Laplacian,
+};
+
+struct NoiseEstimate {
+    double sigma[3] = {};           // blue, green, red
+    double impulseFraction[3] = {};
+
+    double meanSigma() const { return (sigma[0] + sigma[1] + sigma[2]) / 3; }
+    double meanImpulseFraction() const { return (impulseFraction[0] + impulseFraction[1] + impulseFraction[2]) / 3; }
+};
+
+namespace noise {
+
+// Rows per parallel task.
+const int kBandRows = 64;
+
+// |HH| histogram: steps of 1 / kBinsPerUnit up to kMaxCoefficient, larger
+// values in the last bin. |HH| <= 255 * (sum |h|)^2 < 900 for db2.
+const int kBinsPerUnit = 32;
+const int kMaxCoefficient = 1024;
+const int kBins = kBinsPerUnit * kMaxCoefficient;
+
+// Median of |N(0, 1)|.
+const double kMadScale = 0.6744897501960817;
+
+const int kImpulseContrast = 64;
+
+// db2 high-pass decomposition filter, as in PyWavelets.
+const float kHighPass[4] = {-0.48296291314469025f, 0.836516303737469f, -0.22414386804185735f, -0.12940952255092145f};
+
+inline bool isImpulse(const ConstImageView& view, int x, int y, int channel) {
+    const int v = view.pixel(x, y)[channel];
+    if (v != 0 && v != 255) return false;
+    const int neighbours[4] = {view.pixel(x - 1, y)[channel], view.pixel(x + 1, y)[channel],
+                               view.pixel(x, y - 1)[channel], view.pixel(x, y + 1)[channel]};
+    for (int n : neighbours) {
+        if (std::abs(n - v) < kImpulseContrast) return false;
+    }
+    return true;
+}
+
+// Impulse subpixels of rows [y0, y1) away from the border.
+inline uint64_t countImpulses(const ConstImageView& view, int channel, int y0, int y1) {
+    uint64_t count = 0;
+    for (int y = std::max(1, y0); y < std::min(view.height - 1, y1); ++y) {
+        for (int x = 1; x < view.width - 1; ++x) count += isImpulse(view, x, y, channel);
+    }
+    return count;
+}
+
+// Median of the values counted in histogram (bins of 1 / kBinsPerUnit),
+// linear inside its bin.
+inline double histogramMedian(const std::vector<uint64_t>& histogram) {
+    uint64_t total = 0;
+    for (uint64_t count : histogram) total += count;
+    if (total == 0) return 0.0;
+    const double half = total / 2.0;
+    uint64_t below = 0;
+    for (size_t bin = 0; bin < histogram.size(); ++bin) {
+        if (below + histogram[bin] >= half) {
+            return (bin + (half - below) / histogram[bin]) / kBinsPerUnit;
+        }
+        below += histogram[bin];
+    }
+    return static_cast<double>(kMaxCoefficient);
+}
+
+}  // namespace noise
+
+// Wavelet estimate of one channel (0 = blue, 1 = green, 2 = red).
+inline void estimateNoiseWavelet(const ConstImageView& view, int channel, ThreadPool* pool,
+                                 double& sigma, double& impulseFraction) {
+    using namespace noise;
+    // HH(i, j) = sum over k, l of h[k] h[l] x(2j + l, 2i + k), for the i, j
+    // whose 4x4 support lies in the image.
+    const int rowsOut = (view.height - 2) / 2;
+    const int columnsOut = (view.width - 2) / 2;
+    sigma = 0.0;
+    impulseFraction = 0.0;
+    if (rowsOut <= 0 || columnsOut <= 0) return;
+
+    const int bands = (rowsOut + kBandRows - 1) / kBandRows;
+    std::vector<std::vector<uint64_t>> histograms(bands);
+    std::vector<uint64_t> impulses(bands);
+    parallelFor(pool, bands, [&](int band) {
+        std::vector<uint64_t>& histogram = histograms[band];
+        histogram.assign(kBins, 0);
+        std::vector<float> detail(static_cast<size_t>(4) * columnsOut);
+        const int i1 = std::min(rowsOut, (band + 1) * kBandRows);
+        for (int i = band * kBandRows; i < i1; ++i) {
+            // High-pass along each of the four rows, then across them.
+            for (int k = 0; k < 4; ++k) {
+                const uint8_t* row = view.row(2 * i + k) + channel;
+                float* out = &detail[static_cast<size_t>(k) * columnsOut];
+                for (int j = 0; j < columnsOut; ++j) {
+                    const uint8_t* p = row + 2 * j * view.channels;
+                    out[j] = kHighPass[0] * p[0] + kHighPass[1] * p[view.channels] +
+                             kHighPass[2] * p[2 * view.channels] + kHighPass[3] * p[3 * view.channels];
+                }
+            }
+            for (int j = 0; j < columnsOut; ++j) {
+                float hh = kHighPass[0] * detail[j] + kHighPass[1] * detail[columnsOut + j] +
+                           kHighPass[2] * detail[2 * columnsOut + j] + kHighPass[3] * detail[3 * columnsOut + j];
+                int bin = static_cast<int>(std::fabs(hh) * kBinsPerUnit);
+                ++histogram[std::min(bin, kBins - 1)];
+            }
+        }
+        impulses[band] = countImpulses(view, channel, 2 * band * kBandRows, i1 == rowsOut ? view.height : 2 * i1);
+    });
+
+    std::vector<uint64_t> histogram(kBins, 0);
+    uint64_t impulseCount = 0;
+    for (int band = 0; band < bands; ++band) {
+        for (int bin = 0; bin < kBins; ++bin) histogram[bin] += histograms[band][bin];
+        impulseCount += impulses[band];
+    }
+    sigma = histogramMedian(histogram) / kMadScale;
+    impulseFraction = static_cast<double>(impulseCount) / (static_cast<double>(view.width - 2) * (view.height - 2));
+}
+
+// Laplacian estimate of one channel.
+inline void estimateNoiseLaplacian(const ConstImageView& view, int channel, ThreadPool* pool,
+                                   double& sigma, double& impulseFraction) {
+    using namespace noise;
+    sigma = 0.0;
+    impulseFraction = 0.0;
+    if (view.width < 3 || view.height < 3) return;
+
+    const int rows = view.height - 2;
+    const int bands = (rows + kBandRows - 1) / kBandRows;
+    std::vector<uint64_t> sums(bands), impulses(bands);
+    parallelFor(pool, bands, [&](int band) {
+        const int step = view.channels;
+        const int y1 = std::min(rows, (band + 1) * kBandRows) + 1;
+        uint64_t sum = 0;
+        for (int y = band * kBandRows + 1; y < y1; ++y) {
+            const uint8_t* above = view.row(y - 1) + channel;
+            const uint8_t* centre = view.row(y) + channel;
+            const uint8_t* below = view.row(y + 1) + channel;
+            for (int x = 1; x < view.width - 1; ++x) {
+                const int l = (x - 1) * step, c = x * step, r = (x + 1) * step;
+                int response = above[l] - 2 * above[c] + above[r] - 2 * (centre[l] - 2 * centre[c] + centre[r]) +
+                               below[l] - 2 * below[c] + below[r];
+                sum += static_cast<uint64_t>(std::abs(response));
+            }
+        }
+        sums[band] = sum;
+        impulses[band] = countImpulses(view, channel, band * kBandRows + 1, y1);
+    });
+
+    uint64_t sum = 0, impulseCount = 0;
+    for (int band = 0; band < bands; ++band) {
+        sum += sums[band];
+        impulseCount += impulses[band];
+    }
+    const double pixels = static_cast<double>(view.width - 2) * rows;
+    sigma = std::sqrt(M_PI / 2) * sum / (6.0 * pixels);
+    impulseFraction = impulseCount / pixels;
+}
+
+// All three channels, each split into bands on the pool.
+inline NoiseEstimate estimateNoise(const ConstImageView& view, NoiseEstimator estimator, ThreadPool* pool) {
+    NoiseEstimate estimate;
+    for (int channel = 0; channel < 3; ++channel) {
+        if (estimator == NoiseEstimator::Wavelet) {
+            estimateNoiseWavelet(view, channel, pool, estimate.sigma[channel], estimate.impulseFraction[channel]);
+        } else {
+            estimateNoiseLaplacian(view, channel, pool, estimate.sigma[channel], estimate.impulseFraction[channel]);
+        }
+    }
+    return estimate;
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+
+#include "bmp_io.h"
+#include "aligned_image.h"
+
+// One 8-bit channel with a pre-filled border apron.
+//
+// The plane keeps `border` extra pixels on every side, filled according to a
+// BorderMode, so a k x k window with radius <= border can be read at any
+// interior pixel without bounds checks: row(y + ky)[x + kx] is valid for
+// -border <= ky, kx <= border. The plane is one aligned block (see
+// aligned_image.h); rows start on a kImageAlign-byte boundary at their first
+// interior pixel and stride is a multiple of kImageAlign. With border 0 it is
+// simply a contiguous aligned plane.
+
+enum class BorderMode {
+    Replicate,  // aaa|abcd|ddd, like clamp(x, 0, width - 1)
+    Reflect,    // cb|abcd|cb, mirrored about the edge pixel
+    Constant,   // 000|abcd|000
+};
+
+inline const char* borderModeName(BorderMode mode) {
+    switch (mode) {
+        case BorderMode::Reflect: return "reflect";
+        case BorderMode::Constant: return "constant";
+        default: return "replicate";
+    }
+}
+
+inline bool parseBorderMode(const std::string& name, BorderMode& mode) {
+    for (BorderMode candidate : {BorderMode::Replicate, BorderMode::Reflect, BorderMode::Constant}) {
+        if (name == borderModeName(candidate)) {
+            mode = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+// The index inside [0, size) that position i reads, or -1 for the constant
+// border.
+inline int borderIndex(int i, int size, BorderMode mode) {
+    if (i >= 0 && i < size) return i;
+    switch (mode) {
+        case BorderMode::Replicate:
+            return i < 0 ? 0 : size - 1;
+        case BorderMode::Reflect: {
+            if (size == 1) return 0;
+            int period = 2 * size - 2;
+            i %= period;
+            if (i < 0) i += period;
+            return i < size ? i : period - i;
+        }
+        default:
+            return -1;
+    }
+}
+
+struct PaddedPlane {
+    int width = 0;
+    int height = 0;
+    int border = 0;
+    ptrdiff_t stride = 0;
+    AlignedVector<uint8_t> storage;
+    uint8_t* origin = nullptr;  // pixel (0, 0)
+
+    PaddedPlane() = default;
+    PaddedPlane(int w, int h, int b) { resize(w, h, b); }
+
+    // Copying would leave origin pointing into the other plane's storage.
+    PaddedPlane(const PaddedPlane&) = delete;
+    PaddedPlane& operator=(const PaddedPlane&) = delete;
+
+    // Contents are unspecified afterwards; storage is reused when it is big
+    // enough, so one plane can serve many tiles.
+    void resize(int newWidth, int newHeight, int newBorder) {
+        width = newWidth;
+        height = newHeight;
+        border = newBorder;
+        size_t left = alignedRowBytes(border);
+        stride = static_cast<ptrdiff_t>(alignedRowBytes(left + width + border));
+        size_t bytes = static_cast<size_t>(stride) * (height + 2 * border);
+        if (storage.size() < bytes) storage.resize(bytes);
+        origin = storage.data() + static_cast<size_t>(stride) * border + left;
+    }
+
+    // Valid for -border <= y < height + border.
+    uint8_t* row(int y) { return origin + y * stride; }
+    const uint8_t* row(int y) const { return origin + y * stride; }
+
+    // Fills the apron from the interior.
+    void fillBorder(BorderMode mode) {
+        for (int y = 0; y < height; ++y) {
+            uint8_t* r = row(y);
+            for (int x = -border; x < 0; ++x) {
+                int i = borderIndex(x, width, mode);
+                r[x] = i < 0 ? 0 : r[i];
+            }
+            for (int x = width; x < width + border; ++x) {
+                int i = borderIndex(x, width, mode);
+                r[x] = i < 0 ? 0 : r[i];
+            }
+        }
+        for (int y = -border; y < height + border; ++y) {
+            if (y >= 0 && y < height) continue;
+            int i = borderIndex(y, height, mode);
+            if (i < 0) {
+                std::memset(row(y) - border, 0, width + 2 * border);
+            } else {
+                std::memcpy(row(y) - border, row(i) - border, width + 2 * border);
+            }
+        }
+    }
+
+    // One channel of a view into the interior, then the apron.
+    void load(const ConstImageView& src, int channel, int newBorder, BorderMode mode) {
+        resize(src.width, src.height, newBorder);
+        for (int y = 0; y < height; ++y) {
+            const uint8_t* p = src.row(y) + channel;
+            uint8_t* out = row(y);
+            for (int x = 0; x < width; ++x, p += src.channels) out[x] = *p;
+        }
+        fillBorder(mode);
+    }
+
+    // The interior back into one channel of a view of the same size.
+    void store(const ImageView& dst, int channel) const {
+        for (int y = 0; y < height; ++y) {
+            const uint8_t* in = row(y);
+            uint8_t* p = dst.row(y) + channel;
+            for (int x = 0; x < width; ++x, p += dst.channels) *p = in[x];
+        }
+    }
+};
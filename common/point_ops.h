@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstdint>
+#include <algorithm>
+#include <functional>
+
+#include "bmp_io.h"
+#include "thread_pool.h"
+#include "tone_curve.h"
+
+// Fused per-pixel operations on the colour channels.
+//
+// Every operation here maps one 8-bit value of one channel to another, so any
+// chain of them is itself a per-channel function of 256 inputs. PointOps keeps
+// that function as one 256-entry table per channel and folds every operation
+// added to the chain into the tables as it is built (table[v] = op(table[v])),
+// which gives exactly the bytes the operations would give one after another.
+// The image is then read and written once, three lookups per pixel, however
+// long the chain; alpha is left alone. When the three channels end up with the
+// same table (tone curves alone, say) the lookup runs on the vector path of
+// tone_curve.h.
+
+class PointOps {
+public:
+    PointOps() {
+        for (int channel = 0; channel < 3; ++channel) {
+            for (int v = 0; v < 256; ++v) tables[channel][v] = static_cast<uint8_t>(v);
+        }
+    }
+
+    // Appends f to the chain of one channel (0 = blue, 1 = green, 2 = red).
+    PointOps& map(int channel, const std::function<uint8_t(uint8_t)>& f) {
+        for (int v = 0; v < 256; ++v) tables[channel][v] = f(tables[channel][v]);
+        return *this;
+    }
+
+    // Appends f to the chain of all colour channels.
+    PointOps& map(const std::function<uint8_t(uint8_t)>& f) {
+        for (int channel = 0; channel < 3; ++channel) map(channel, f);
+        return *this;
+    }
+
+    PointOps& curve(int channel, const ToneCurve& curve) {
+        for (int v = 0; v < 256; ++v) tables[channel][v] = curve(tables[channel][v]);
+        return *this;
+    }
+
+    PointOps& curve(const ToneCurve& curve) {
+        for (int channel = 0; channel < 3; ++channel) this->curve(channel, curve);
+        return *this;
+    }
+
+    // v -> (v / 255)^gamma * 255, truncated.
+    PointOps& gamma(double gamma) {
+        return curve(ToneCurve::gamma(gamma));
+    }
+
+    // v -> v * factor, truncated and clamped to [0, 255].
+    PointOps& gain(int channel, double factor) {
+        return map(channel, [factor](uint8_t v) {
+            return static_cast<uint8_t>(std::max(0, std::min(static_cast<int>(v * factor), 255)));
+        });
+    }
+
+    // v -> v & bits, e.g. 0xF0 keeps the top four bits.
+    PointOps& mask(uint8_t bits) {
+        return map([bits](uint8_t v) { return static_cast<uint8_t>(v & bits); });
+    }
+
+    const uint8_t* table(int channel) const { return tables[channel]; }
+
+    bool isIdentity() const {
+        for (int channel = 0; channel < 3; ++channel) {
+            for (int v = 0; v < 256; ++v) {
+                if (tables[channel][v] != v) return false;
+            }
+        }
+        return true;
+    }
+
+    // In place on one channel of image, e.g. of a tile that was just filtered.
+    void applyChannel(const ImageView& image, int channel) const {
+        const uint8_t* lut = tables[channel];
+        for (int y = 0; y < image.height; ++y) {
+            uint8_t* p = image.row(y) + channel;
+            for (int x = 0; x < image.width; ++x, p += image.channels) *p = lut[*p];
+        }
+    }
+
+    // In place on the colour channels of image, a block of rows per task.
+    void apply(const ImageView& image, ThreadPool* pool = nullptr, SimdPath path = detectSimdPath()) const {
+        if (std::equal(tables[0], tables[0] + 256, tables[1]) && std::equal(tables[0], tables[0] + 256, tables[2])) {
+            ToneCurve uniform;
+            std::copy(tables[0], tables[0] + 256, uniform.table);
+            applyToneCurve(image, uniform, path, pool);
+            return;
+        }
+        const int rowBlock = 16;
+        parallelFor(pool, (image.height + rowBlock - 1) / rowBlock, [&](int block) {
+            int end = std::min(image.height, (block + 1) * rowBlock);
+            for (int y = block * rowBlock; y < end; ++y) {
+                uint8_t* p = image.row(y);
+                for (int x = 0; x < image.width; ++x, p += image.channels) {
+                    p[0] = tables[0][p[0]];
+                    p[1] = tables[1][p[1]];
+                    p[2] = tables[2][p[2]];
+                }
+            }
+        });
+    }
+
+private:
+    uint8_t tables[3][256];
+};
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIMD_X86 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define SIMD_NEON 1
+#endif
+
+// Run-time choice between the vector instruction sets the kernels are written
+// for. The best path the CPU supports is picked at run time (AVX2 and SSE4.1
+// are compiled with target attributes, so no special build flags are
+// needed); any path can also be forced, e.g. for testing.
+
+enum class SimdPath {
+    Scalar,
+    SSE41,
+    AVX2,
+    NEON,
+};
+
+inline const char* simdPathName(SimdPath path) {
+    switch (path) {
+        case SimdPath::SSE41: return "sse4";
+        case SimdPath::AVX2: return "avx2";
+        case SimdPath::NEON: return "neon";
+        default: return "scalar";
+    }
+}
+
+inline bool simdPathSupported(SimdPath path) {
+    switch (path) {
+        case SimdPath::Scalar: return true;
+#if defined(SIMD_X86)
+        case SimdPath::SSE41: return __builtin_cpu_supports("sse4.1");
+        case SimdPath::AVX2: return __builtin_cpu_supports("avx2");
+#endif
+#if defined(SIMD_NEON)
+        case SimdPath::NEON: return true;
+#endif
+        default: return false;
+    }
+}
+
+// The widest path this CPU runs.
+inline SimdPath detectSimdPath() {
+    for (SimdPath path : {SimdPath::AVX2, SimdPath::NEON, SimdPath::SSE41}) {
+        if (simdPathSupported(path)) return path;
+    }
+    return SimdPath::Scalar;
+}
+
+// "auto", "avx2", "sse4", "neon" or "scalar"; false if the name is unknown or
+// the CPU cannot run that path.
+inline bool parseSimdPath(const std::string& name, SimdPath& path) {
+    if (name == "auto") {
+        path = detectSimdPath();
+        return true;
+    }
+    for (SimdPath candidate : {SimdPath::Scalar, SimdPath::SSE41, SimdPath::AVX2, SimdPath::NEON}) {
+        if (name == simdPathName(candidate)) {
+            path = candidate;
+            return simdPathSupported(candidate);
+        }
+    }
+    return false;
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <atomic>
+#include <algorithm>
+
+// Work-stealing thread pool.
+//
+// Every worker owns a deque of tasks. parallelFor deals its tasks round-robin
+// over the deques; a worker pops from the back of its own deque and, when that
+// is empty, steals from the front of the others, so threads that finish their
+// share early take work from the busy ones instead of idling. The thread that
+// calls parallelFor runs tasks too while it waits, which also makes nested
+// parallelFor calls safe. With one thread everything runs inline.
+
+class ThreadPool {
+public:
+    // threads counts the calling thread; 0 means one per hardware thread.
+    explicit ThreadPool(int threads = 0) {
+        if (threads <= 0) threads = std::max(1u, std::thread::hardware_concurrency());
+        threadCount = threads;
+        for (int i = 0; i < threads; ++i) queues.emplace_back(new Queue);
+        for (int i = 1; i < threads; ++i) workers.emplace_back([this, i] { workerLoop(i); });
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        sleepCondition.notify_all();
+        for (std::thread& worker : workers) worker.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int size() const { return threadCount; }
+
+    // Runs body(i) for every i in [0, count) and returns when all have finished.
+    void parallelFor(int count, const std::function<void(int)>& body) {
+        if (count <= 0) return;
+        if (threadCount == 1 || count == 1) {
+            for (int i = 0; i < count; ++i) body(i);
+            return;
+        }
+
+        Job job;
+        job.body = &body;
+        job.remaining = count;
+        for (int i = 0; i < count; ++i) {
+            Queue& queue = *queues[i % threadCount];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.tasks.push_back(Task{&job, i});
+        }
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            pending += count;
+        }
+        sleepCondition.notify_all();
+
+        // Help out until nothing is left to take, then wait for the stragglers.
+        Task task;
+        while (job.remaining.load() > 0 && tryPop(0, task)) run(task);
+        std::unique_lock<std::mutex> lock(job.mutex);
+        job.done.wait(lock, [&] { return job.finished; });
+    }
+
+private:
+    struct Job {
+        const std::function<void(int)>* body = nullptr;
+        std::atomic<int> remaining{0};
+        bool finished = false;  // set under mutex, so the job outlives the last notify
+        std::mutex mutex;
+        std::condition_variable done;
+    };
+
+    struct Task {
+        Job* job = nullptr;
+        int index = 0;
+    };
+
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    // Own deque first (newest task, still warm in cache), then the oldest task
+    // of every other deque.
+    bool tryPop(int self, Task& task) {
+        {
+            Queue& own = *queues[self];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty()) {
+                task = own.tasks.back();
+                own.tasks.pop_back();
+                --pending;
+                return true;
+            }
+        }
+        for (int offset = 1; offset < threadCount; ++offset) {
+            Queue& victim = *queues[(self + offset) % threadCount];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = victim.tasks.front();
+                victim.tasks.pop_front();
+                --pending;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static void run(const Task& task) {
+        Job& job = *task.job;
+        (*job.body)(task.index);
+        if (--job.remaining == 0) {
+            std::lock_guard<std::mutex> lock(job.mutex);
+            job.finished = true;
+            job.done.notify_all();
+        }
+    }
+
+    void workerLoop(int self) {
+        Task task;
+        for (;;) {
+            if (tryPop(self, task)) {
+                run(task);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            sleepCondition.wait(lock, [&] { return stopping || pending.load() > 0; });
+            if (stopping && pending.load() == 0) return;
+        }
+    }
+
+    int threadCount = 1;
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+
+    std::mutex sleepMutex;
+    std::condition_variable sleepCondition;
+    std::atomic<int> pending{0};  // tasks queued but not yet taken
+    bool stopping = false;
+};
+
+// parallelFor on the pool, or a plain loop when there is none.
+inline void parallelFor(ThreadPool* pool, int count, const std::function<void(int)>& body) {
+    if (pool) {
+        pool->parallelFor(count, body);
+    } else {
+        for (int i = 0; i < count; ++i) body(i);
+    }
+}
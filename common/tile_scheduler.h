@@ -0,0 +1,173 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <functional>
+
+#include "bmp_io.h"
+#include "thread_pool.h"
+#include "aligned_image.h"
+#include "padded_plane.h"
+
+// Parallel execution of neighbourhood filters over tiles.
+//
+// The image is cut into square tiles and every (tile, colour channel) pair is
+// one task on the thread pool. A task hands the filter the tile grown by
+// `halo` pixels on each side (clipped to the image) and keeps only the tile
+// itself from the result. As with the row bands of the streaming executor,
+// any filter that clamps at the image edges gives the same output on the
+// grown tile as on the whole image once halo covers its radius, so the result
+// does not depend on the tiling or on the number of threads.
+//
+// With a border mode other than Replicate, tiles at the image edge are not
+// clipped: the part of the grown tile outside the image is filled per the
+// mode, so the filters' own edge clamping only reaches pixels that are thrown
+// away. (Replicate needs no copy; clipping gives the same result.)
+//
+// Tiles start at kTileSize pixels, about what the filters here keep hot in
+// L2 cache for one channel, and are halved while there are too few tasks to
+// keep every thread busy, down to 4 * halo so a grown tile never covers more
+// than about twice the pixels of the tile.
+
+const int kTileSize = 256;
+
+struct Tile {
+    int x = 0;
+    int y = 0;
+    int width = 0;
+    int height = 0;
+};
+
+// filter(src, dst, channel) filters one channel of src into the same channel
+// of dst; both views have the same size.
+typedef std::function<void(const ConstImageView& src, const ImageView& dst, int channel)> ChannelFilter;
+
+// Upper bound on the memory a thread of filterTiles holds at once: the output
+// scratch of a grown tile, its border-filled input copy, plus the filter's own
+// buffers, given per pixel and per column of the grown tile.
+inline size_t tileScratchBytes(int halo, int channels, size_t bytesPerPixel, size_t bytesPerColumn) {
+    size_t side = std::max(kTileSize, 4 * halo) + 2 * static_cast<size_t>(halo);
+    return side * (2 * alignedRowBytes(side * channels) + side * bytesPerPixel + bytesPerColumn);
+}
+
+// Tiles of tileSize x tileSize covering the image, the last row and column
+// cut short.
+inline std::vector<Tile> makeTiles(int width, int height, int tileSize) {
+    std::vector<Tile> tiles;
+    for (int y = 0; y < height; y += tileSize) {
+        for (int x = 0; x < width; x += tileSize) {
+            Tile tile;
+            tile.x = x;
+            tile.y = y;
+            tile.width = std::min(tileSize, width - x);
+            tile.height = std::min(tileSize, height - y);
+            tiles.push_back(tile);
+        }
+    }
+    return tiles;
+}
+
+// The grown tile [x0, x0 + out.width) x [y0, y0 + out.height), which may
+// reach outside src, with the outside filled per mode.
+inline void copyWithBorder(const ConstImageView& src, int x0, int y0, const ImageView& out, BorderMode mode) {
+    for (int y = 0; y < out.height; ++y) {
+        int sy = borderIndex(y0 + y, src.height, mode);
+        uint8_t* row = out.row(y);
+        for (int x = 0; x < out.width; ++x, row += out.channels) {
+            int sx = borderIndex(x0 + x, src.width, mode);
+            if (sx < 0 || sy < 0) {
+                std::fill(row, row + out.channels, 0);
+            } else {
+                std::copy(src.pixel(sx, sy), src.pixel(sx, sy) + out.channels, row);
+            }
+        }
+    }
+}
+
+// Filters channels 0 .. channels - 1 of src into dst (same size, distinct
+// buffers). Filters that bin pixels into cells (the bilateral grid) pass the
+// cell size as align so every grown tile starts on a cell boundary of the
+// whole image. srcMargin says src can be read that many pixels beyond each
+// edge and already holds the border there (see borderImage); grown tiles
+// within it are filtered in place instead of copied.
+inline void filterTiles(ThreadPool& pool, const ConstImageView& src, const ImageView& dst, int channels,
+                        int halo, const ChannelFilter& filter, int align = 1,
+                        BorderMode border = BorderMode::Replicate, int srcMargin = 0) {
+    if (src.width <= 0 || src.height <= 0) return;
+    align = std::max(1, align);
+    halo = (halo + align - 1) / align * align;
+
+    const int minTile = std::max(align, 4 * halo);
+    int tileSize = std::max(kTileSize, minTile);
+    auto taskCount = [&](int size) {
+        return static_cast<long long>((src.width + size - 1) / size) * ((src.height + size - 1) / size) * channels;
+    };
+    while (tileSize / 2 >= minTile && taskCount(tileSize) < 4LL * pool.size()) tileSize /= 2;
+    tileSize = (tileSize + align - 1) / align * align;
+
+    const std::vector<Tile> tiles = makeTiles(src.width, src.height, tileSize);
+    pool.parallelFor(static_cast<int>(tiles.size()) * channels, [&](int task) {
+        const Tile& tile = tiles[task / channels];
+        const int channel = task % channels;
+        const bool clip = border == BorderMode::Replicate;
+        const int x0 = clip ? std::max(0, tile.x - halo) : tile.x - halo;
+        const int y0 = clip ? std::max(0, tile.y - halo) : tile.y - halo;
+        const int x1 = clip ? std::min(src.width, tile.x + tile.width + halo) : tile.x + tile.width + halo;
+        const int y1 = clip ? std::min(src.height, tile.y + tile.height + halo) : tile.y + tile.height + halo;
+
+        // Per-thread scratch for the grown tile's output, reused across tasks.
+        thread_local AlignedVector<uint8_t> scratch;
+        thread_local AlignedVector<uint8_t> padded;
+        const int grownWidth = x1 - x0;
+        const int grownHeight = y1 - y0;
+        const size_t rowBytes = alignedRowBytes(static_cast<size_t>(grownWidth) * src.channels);
+        scratch.resize(rowBytes * grownHeight);
+        ImageView out;
+        out.data = scratch.data();
+        out.width = grownWidth;
+        out.height = grownHeight;
+        out.channels = src.channels;
+        out.stride = static_cast<ptrdiff_t>(rowBytes);
+
+        if (x0 >= -srcMargin && y0 >= -srcMargin && x1 <= src.width + srcMargin && y1 <= src.height + srcMargin) {
+            filter(src.sub(x0, y0, grownWidth, grownHeight), out, channel);
+        } else {
+            padded.resize(scratch.size());
+            ImageView in = out;
+            in.data = padded.data();
+            copyWithBorder(src, x0, y0, in, border);
+            filter(in, out, channel);
+        }
+
+        for (int y = 0; y < tile.height; ++y) {
+            const uint8_t* in = out.pixel(tile.x - x0, tile.y - y0 + y) + channel;
+            uint8_t* row = dst.pixel(tile.x, tile.y + y) + channel;
+            for (int x = 0; x < tile.width; ++x) {
+                row[x * dst.channels] = in[x * out.channels];
+            }
+        }
+    });
+}
+
+// A copy of src with margin pixels of border around it, per mode, and the
+// view of the src part of it: filterTiles with srcMargin = margin then never
+// copies a tile. Worth it when several filters run over the same input.
+struct BorderedImage {
+    AlignedVector<uint8_t> pixels;
+    ConstImageView view;
+    int margin = 0;
+};
+
+inline void borderImage(const ConstImageView& src, int margin, BorderMode mode, BorderedImage& out) {
+    ImageView all;
+    all.width = src.width + 2 * margin;
+    all.height = src.height + 2 * margin;
+    all.channels = src.channels;
+    all.stride = static_cast<ptrdiff_t>(alignedRowBytes(static_cast<size_t>(all.width) * all.channels));
+    out.pixels.resize(static_cast<size_t>(all.stride) * all.height);
+    all.data = out.pixels.data();
+    copyWithBorder(src, -margin, -margin, all, mode);
+    out.view = all.sub(margin, margin, src.width, src.height);
+    out.margin = margin;
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <random>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+
+#include "../common/bmp_io.h"
+
+// Shared by the regression checks in this directory. Every check is a program
+// of its own that runs a fast engine and its reference path on the same input
+// and exits non-zero if any pair differs: on the colour channels of the sample
+// images and on random planes of the sizes where the borders meet (1 x 1,
+// single rows and columns, and a few small odd ones).
+
+namespace check {
+
+// One 8-bit plane, rows packed.
+struct Plane {
+    std::vector<uint8_t> pixels;
+    int width = 0;
+    int height = 0;
+
+    void resize(int w, int h) {
+        width = w;
+        height = h;
+        pixels.assign(static_cast<size_t>(w) * h, 0);
+    }
+    uint8_t* row(int y) { return pixels.data() + static_cast<size_t>(y) * width; }
+    const uint8_t* row(int y) const { return pixels.data() + static_cast<size_t>(y) * width; }
+};
+
+// Uniform values below levels (256 for any byte).
+inline Plane randomPlane(int width, int height, uint32_t seed, int levels = 256) {
+    std::mt19937 random(seed);
+    std::uniform_int_distribution<int> value(0, levels - 1);
+    Plane plane;
+    plane.resize(width, height);
+    for (uint8_t& pixel : plane.pixels) pixel = static_cast<uint8_t>(value(random));
+    return plane;
+}
+
+inline const std::vector<std::pair<int, int>>& edgeSizes() {
+    static const std::vector<std::pair<int, int>> sizes = {
+        {1, 1}, {1, 2}, {2, 1}, {1, 37}, {37, 1}, {2, 2}, {3, 5}, {5, 3}, {67, 45},
+    };
+    return sizes;
+}
+
+// Relative to this directory, where the checks are run.
+inline const std::vector<std::string>& sampleImages() {
+    static const std::vector<std::string> names = {
+        "../HW2/input1.bmp", "../HW2/input2.bmp", "../HW2/input3.bmp", "../HW2/input4.bmp",
+    };
+    return names;
+}
+
+// Blue, green and red of a sample image as planes; false (after readBMP has
+// printed why) if it cannot be read.
+inline bool loadSampleChannels(const std::string& name, std::vector<Plane>& channels) {
+    BMPImage image;
+    if (!readBMP(name, image)) return false;
+    ConstImageView view = image.view();
+    channels.assign(3, Plane());
+    for (int c = 0; c < 3; ++c) {
+        channels[c].resize(view.width, view.height);
+        for (int y = 0; y < view.height; ++y) {
+            const uint8_t* in = view.row(y) + c;
+            uint8_t* out = channels[c].row(y);
+            for (int x = 0; x < view.width; ++x) out[x] = in[x * view.channels];
+        }
+    }
+    return true;
+}
+
+// Counts the comparisons and prints the first few that fail.
+struct Report {
+    int checks = 0;
+    int failures = 0;
+
+    void expect(bool ok, const std::string& what) {
+        checks++;
+        if (ok) return;
+        if (failures++ < 20) std::cout << "FAIL: " << what << std::endl;
+    }
+
+    // The exit code of the check.
+    int finish(const std::string& name) const {
+        if (failures == 0) {
+            std::cout << name << ": all " << checks << " checks passed." << std::endl;
+            return 0;
+        }
+        std::cout << name << ": " << failures << " of " << checks << " checks failed." << std::endl;
+        return 1;
+    }
+};
+
+// Where two planes of the same size first differ, or "" if they are equal.
+inline std::string firstDifference(const Plane& expected, const Plane& actual) {
+    for (int y = 0; y < expected.height; ++y) {
+        for (int x = 0; x < expected.width; ++x) {
+            int a = expected.row(y)[x], b = actual.row(y)[x];
+            if (a != b) {
+                return "(" + std::to_string(x) + ", " + std::to_string(y) + "): expected " + std::to_string(a) +
+                       ", got " + std::to_string(b);
+            }
+        }
+    }
+    return "";
+}
+
+// The median of the (2 radius + 1)^2 window with clamped coordinates, as
+// applyMedianFilter of denoise and median_filter computes it.
+inline Plane sortMedian(const Plane& in, int radius) {
+    Plane out;
+    out.resize(in.width, in.height);
+    std::vector<uint8_t> window;
+    for (int y = 0; y < in.height; ++y) {
+        for (int x = 0; x < in.width; ++x) {
+            window.clear();
+            for (int ky = -radius; ky <= radius; ++ky) {
+                const uint8_t* row = in.row(std::min(std::max(y + ky, 0), in.height - 1));
+                for (int kx = -radius; kx <= radius; ++kx) window.push_back(row[std::min(std::max(x + kx, 0), in.width - 1)]);
+            }
+            std::nth_element(window.begin(), window.begin() + window.size() / 2, window.end());
+            out.row(y)[x] = window[window.size() / 2];
+        }
+    }
+    return out;
+}
+
+inline std::string sizeName(int width, int height) {
+    return std::to_string(width) + "x" + std::to_string(height);
+}
+
+}  // namespace check
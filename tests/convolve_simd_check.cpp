@@ -0,0 +1,142 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <random>
+#include <cstdint>
+#include <algorithm>
+
+#include "check.h"
+#include "../common/convolve_simd.h"
+
+// convolveKernel2D on every SIMD path this CPU runs against the scalar path,
+// and the scalar path against a direct loop over the clamped window, all
+// byte for byte: smoothing and sharpening kernels (negative weights, sums
+// beyond [0, 255]) of sizes 1 to 15, also larger than the plane.
+
+// The direct loop must round like the kernels: no fused multiply-add.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+using namespace std;
+
+// Random weights summing to about 1, with a negative ring when sharpen is set.
+vector<float> randomKernel(int size, bool sharpen, uint32_t seed) {
+    mt19937 random(seed);
+    uniform_real_distribution<float> weight(0.0f, 1.0f);
+    vector<float> kernel(size * size);
+    float sum = 0.0f;
+    for (float& w : kernel) sum += (w = weight(random));
+    for (float& w : kernel) w /= sum;
+    if (sharpen) {
+        for (float& w : kernel) w = -w;
+        kernel[kernel.size() / 2] += 2.0f;
+    }
+    return kernel;
+}
+
+// Sum in row-major tap order with a separate multiply and add, clamped and
+// truncated, as convolveKernel2D documents.
+check::Plane directConvolve(const check::Plane& in, const vector<float>& kernel, int size) {
+    const int radius = size / 2;
+    check::Plane out;
+    out.resize(in.width, in.height);
+    for (int y = 0; y < in.height; ++y) {
+        for (int x = 0; x < in.width; ++x) {
+            float sum = 0.0f;
+            for (int ky = 0; ky < size; ++ky) {
+                const uint8_t* row = in.row(min(max(y + ky - radius, 0), in.height - 1));
+                for (int kx = 0; kx < size; ++kx) {
+                    float pixel = row[min(max(x + kx - radius, 0), in.width - 1)];
+                    float product = pixel * kernel[ky * size + kx];
+                    sum = sum + product;
+                }
+            }
+            out.row(y)[x] = simd::toByte(sum);
+        }
+    }
+    return out;
+}
+
+check::Plane convolve(const check::Plane& in, const vector<float>& kernel, int size, SimdPath path) {
+    check::Plane out;
+    out.resize(in.width, in.height);
+    convolveKernel2D(in.row(0), in.width, out.row(0), out.width, in.width, in.height, kernel, size, path);
+    return out;
+}
+
+vector<SimdPath> vectorPaths() {
+    vector<SimdPath> paths;
+    for (SimdPath path : {SimdPath::SSE41, SimdPath::AVX2, SimdPath::NEON}) {
+        if (simdPathSupported(path)) paths.push_back(path);
+    }
+    return paths;
+}
+
+void checkPlane(check::Report& report, const check::Plane& in, const vector<int>& sizes, bool direct,
+                uint32_t& seed, const string& name) {
+    for (int size : sizes) {
+        for (bool sharpen : {false, true}) {
+            vector<float> kernel = randomKernel(size, sharpen, seed++);
+            string what = name + (sharpen ? " sharpen " : " smooth ") + to_string(size) + "x" + to_string(size);
+            check::Plane scalar = convolve(in, kernel, size, SimdPath::Scalar);
+            if (direct) {
+                string difference = check::firstDifference(directConvolve(in, kernel, size), scalar);
+                report.expect(difference.empty(), what + " scalar vs direct " + difference);
+            }
+            for (SimdPath path : vectorPaths()) {
+                string difference = check::firstDifference(scalar, convolve(in, kernel, size, path));
+                report.expect(difference.empty(), what + " " + simdPathName(path) + " vs scalar " + difference);
+            }
+        }
+    }
+}
+
+int main() {
+    check::Report report;
+    cout << "Vector paths:";
+    for (SimdPath path : vectorPaths()) cout << " " << simdPathName(path);
+    cout << (vectorPaths().empty() ? " none, only the direct loop is checked" : "") << endl;
+
+    uint32_t seed = 1;
+    for (const pair<int, int>& size : check::edgeSizes()) {
+        check::Plane plane = check::randomPlane(size.first, size.second, seed++);
+        checkPlane(report, plane, {1, 3, 5, 7, 9, 15}, true, seed, "random " + check::sizeName(size.first, size.second));
+    }
+
+    for (const string& name : check::sampleImages()) {
+        vector<check::Plane> channels;
+        if (!check::loadSampleChannels(name, channels)) return 1;
+        for (int c = 0; c < 3; ++c) {
+            checkPlane(report, channels[c], {3, 7}, c == 1, seed, name + " channel " + to_string(c));
+        }
+
+        // One channel of the interleaved file, walked top row first: step 3
+        // and a negative stride on both sides.
+        BMPImage image;
+        readBMP(name, image);
+        BMPImage output = image;
+        ConstImageView in = image.view();
+        ImageView out = output.view();
+        check::Plane flipped;
+        flipped.resize(in.width, in.height);
+        for (int y = 0; y < in.height; ++y) {
+            for (int x = 0; x < in.width; ++x) flipped.row(y)[x] = in.pixel(x, in.height - 1 - y)[2];
+        }
+        vector<float> kernel = randomKernel(5, true, seed++);
+        check::Plane expected = convolve(flipped, kernel, 5, SimdPath::Scalar);
+        for (SimdPath path : vectorPaths()) {
+            convolveKernel2D(in.row(in.height - 1) + 2, -in.stride, out.row(out.height - 1) + 2, -out.stride, in.width,
+                             in.height, kernel, 5, path, in.channels, out.channels);
+            check::Plane filtered;
+            filtered.resize(in.width, in.height);
+            for (int y = 0; y < in.height; ++y) {
+                for (int x = 0; x < in.width; ++x) filtered.row(y)[x] = out.pixel(x, in.height - 1 - y)[2];
+            }
+            string difference = check::firstDifference(expected, filtered);
+            report.expect(difference.empty(), name + " interleaved " + simdPathName(path) + " " + difference);
+        }
+    }
+
+    return report.finish("convolve_simd_check");
+}
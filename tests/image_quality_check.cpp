@@ -0,0 +1,164 @@
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+#include "check.h"
+#include "../common/image_quality.h"
+
+// SSIM (box and Gaussian windows) against the definition evaluated directly
+// in double, window by window, to 1e-9: on the luma and channels of the
+// sample images against noisy and shifted copies, on random planes just large
+// enough for the window, and on sizes it does not fit in.
+
+using namespace std;
+
+const double kTolerance = 1e-9;
+
+// The window weights, row-major, summing to 1.
+vector<double> windowWeights(const SsimOptions& options) {
+    if (options.window == SsimWindow::Box) {
+        int size = options.boxSize;
+        return vector<double>(size * size, 1.0 / (size * size));
+    }
+    const int radius = quality::kGaussianRadius;
+    const double sigma = quality::kGaussianSigma;
+    vector<double> taps;
+    double sum = 0.0;
+    for (int i = -radius; i <= radius; ++i) {
+        taps.push_back(exp(-(i * i) / (2 * sigma * sigma)));
+        sum += taps.back();
+    }
+    vector<double> weights;
+    for (double wy : taps) {
+        for (double wx : taps) weights.push_back(wy * wx / (sum * sum));
+    }
+    return weights;
+}
+
+// Mean over the windows inside the planes of
+// (2 ua ub + C1) (2 cov + C2) / ((ua^2 + ub^2 + C1) (va + vb + C2)),
+// with sample (co)variances for the box window as scikit-image has them.
+double referenceSsim(const MetricPlane& a, const MetricPlane& b, const SsimOptions& options) {
+    const vector<double> weights = windowWeights(options);
+    const int size = static_cast<int>(lround(sqrt(static_cast<double>(weights.size()))));
+    const double n = static_cast<double>(size) * size;
+    const double covNorm = options.window == SsimWindow::Box ? n / (n - 1) : 1.0;
+    const double c1 = (0.01 * options.dataRange) * (0.01 * options.dataRange);
+    const double c2 = (0.03 * options.dataRange) * (0.03 * options.dataRange);
+    double sum = 0.0;
+    for (int y = 0; y + size <= a.height; ++y) {
+        for (int x = 0; x + size <= a.width; ++x) {
+            double ua = 0, ub = 0, aa = 0, bb = 0, ab = 0;
+            for (int ky = 0; ky < size; ++ky) {
+                for (int kx = 0; kx < size; ++kx) {
+                    double w = weights[ky * size + kx];
+                    double va = a.row(y + ky)[x + kx], vb = b.row(y + ky)[x + kx];
+                    ua += w * va;
+                    ub += w * vb;
+                    aa += w * va * va;
+                    bb += w * vb * vb;
+                    ab += w * va * vb;
+                }
+            }
+            double varA = covNorm * (aa - ua * ua);
+            double varB = covNorm * (bb - ub * ub);
+            double cov = covNorm * (ab - ua * ub);
+            sum += (2 * ua * ub + c1) * (2 * cov + c2) / ((ua * ua + ub * ub + c1) * (varA + varB + c2));
+        }
+    }
+    return sum / ((a.width - size + 1.0) * (a.height - size + 1.0));
+}
+
+// Random bytes, and those with noise of the given amplitude, clamped.
+void randomPair(int width, int height, uint32_t seed, int noise, MetricPlane& a, MetricPlane& b) {
+    check::Plane plane = check::randomPlane(width, height, seed);
+    check::Plane offsets = check::randomPlane(width, height, seed + 1000, 2 * noise + 1);
+    a.resize(width, height);
+    b.resize(width, height);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            int value = plane.row(y)[x];
+            a.row(y)[x] = static_cast<float>(value);
+            b.row(y)[x] = static_cast<float>(min(255, max(0, value + offsets.row(y)[x] - noise)));
+        }
+    }
+}
+
+void checkPair(check::Report& report, const MetricPlane& a, const MetricPlane& b, ThreadPool* pool, const string& name) {
+    for (SsimWindow window : {SsimWindow::Box, SsimWindow::Gaussian}) {
+        SsimOptions options;
+        options.window = window;
+        SsimResult result;
+        string what = name + (window == SsimWindow::Box ? " box" : " gaussian");
+        if (!structuralSimilarity(a, b, options, pool, result)) {
+            report.expect(false, what + ": window does not fit");
+            continue;
+        }
+        double expected = referenceSsim(a, b, options);
+        double error = fabs(result.ssim - expected);
+        ostringstream message;
+        message << what << ": expected " << setprecision(15) << expected << ", got " << result.ssim << " (off by "
+                << error << ")";
+        report.expect(error <= kTolerance, message.str());
+    }
+}
+
+int main() {
+    check::Report report;
+    ThreadPool pool(4);
+
+    // No window fits: not computed.
+    for (const pair<int, int>& size :
+         {make_pair(1, 1), make_pair(1, 37), make_pair(37, 1), make_pair(6, 6), make_pair(10, 40)}) {
+        MetricPlane a, b;
+        randomPair(size.first, size.second, 1, 10, a, b);
+        SsimResult result;
+        SsimOptions options;
+        options.window = size.first < 7 ? SsimWindow::Box : SsimWindow::Gaussian;
+        report.expect(!structuralSimilarity(a, b, options, nullptr, result),
+                      check::sizeName(size.first, size.second) + " accepted");
+    }
+
+    uint32_t seed = 1;
+    for (const pair<int, int>& size : {make_pair(11, 11), make_pair(11, 80), make_pair(80, 11), make_pair(13, 17),
+                                        make_pair(150, 97)}) {
+        for (int noise : {0, 3, 40, 255}) {
+            MetricPlane a, b;
+            randomPair(size.first, size.second, seed++, noise, a, b);
+            checkPair(report, a, b, nullptr, "random " + check::sizeName(size.first, size.second) + " noise " +
+                                                 to_string(noise));
+        }
+    }
+
+    for (const string& name : check::sampleImages()) {
+        BMPImage image;
+        if (!readBMP(name, image)) return 1;
+        // A blurred and a shifted copy.
+        BMPImage blurred = image, shifted = image;
+        ConstImageView in = image.view();
+        ImageView blur = blurred.view(), shift = shifted.view();
+        for (int y = 0; y < in.height; ++y) {
+            for (int x = 0; x < in.width * in.channels; ++x) {
+                int left = max(0, x - in.channels), right = min(in.width * in.channels - 1, x + in.channels);
+                blur.row(y)[x] = static_cast<uint8_t>((in.row(y)[left] + 2 * in.row(y)[x] + in.row(y)[right] + 2) / 4);
+                shift.row(y)[x] = in.row(max(0, y - 1))[x];
+            }
+        }
+        MetricPlane reference, test;
+        loadLuma(in, reference);
+        loadLuma(blurred.view(), test);
+        checkPair(report, reference, test, &pool, name + " luma, blurred");
+        loadLuma(shifted.view(), test);
+        checkPair(report, reference, test, &pool, name + " luma, shifted");
+        loadChannel(in, 2, reference);
+        loadChannel(blurred.view(), 2, test);
+        checkPair(report, reference, test, &pool, name + " red, blurred");
+    }
+
+    return report.finish("image_quality_check");
+}
@@ -0,0 +1,68 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <algorithm>
+
+#include "check.h"
+#include "../common/median_histogram.h"
+
+// The histogram median against the sort median it replaced: the middle of
+// the (2r + 1)^2 window with clamped coordinates, for every radius up to 9 on
+// the edge sizes and 1, 3 and 7 on the sample images.
+
+using namespace std;
+
+check::Plane histogramMedian(const check::Plane& in, int radius) {
+    check::Plane out;
+    out.resize(in.width, in.height);
+    medianFilterHistogram(in.row(0), in.width, out.row(0), out.width, in.width, in.height, radius);
+    return out;
+}
+
+void checkPlane(check::Report& report, const check::Plane& in, const vector<int>& radii, const string& name) {
+    for (int radius : radii) {
+        string difference = check::firstDifference(check::sortMedian(in, radius), histogramMedian(in, radius));
+        report.expect(difference.empty(), name + " radius " + to_string(radius) + " " + difference);
+    }
+
+}
+
+int main() {
+    check::Report report;
+
+    uint32_t seed = 1;
+    for (const pair<int, int>& size : check::edgeSizes()) {
+        check::Plane plane = check::randomPlane(size.first, size.second, seed++);
+        checkPlane(report, plane, {1, 2, 3, 4, 5, 6, 7, 8, 9}, "random " + check::sizeName(size.first, size.second));
+        // Few levels, so windows hold many equal values.
+        check::Plane levels = check::randomPlane(size.first, size.second, seed++, 3);
+        checkPlane(report, levels, {1, 2, 5}, "3-level " + check::sizeName(size.first, size.second));
+    }
+
+    for (const string& name : check::sampleImages()) {
+        vector<check::Plane> channels;
+        if (!check::loadSampleChannels(name, channels)) return 1;
+        for (int c = 0; c < 3; ++c) checkPlane(report, channels[c], {1, 3, 7}, name + " channel " + to_string(c));
+
+        // The interleaved, bottom-up file layout the tools filter in place:
+        // step 3 between pixels and a negative stride.
+        BMPImage image;
+        readBMP(name, image);
+        ConstImageView view = image.view();
+        check::Plane out;
+        out.resize(view.width, view.height);
+        medianFilterHistogram(view.row(view.height - 1) + 1, -view.stride, out.row(0), out.width, view.width,
+                              view.height, 3, view.channels);
+        check::Plane flipped;
+        flipped.resize(view.width, view.height);
+        for (int y = 0; y < view.height; ++y) {
+            const uint8_t* in = channels[1].row(view.height - 1 - y);
+            copy(in, in + view.width, flipped.row(y));
+        }
+        string difference = check::firstDifference(check::sortMedian(flipped, 3), out);
+        report.expect(difference.empty(), name + " interleaved, negative stride " + difference);
+    }
+
+    return report.finish("median_histogram_check");
+}
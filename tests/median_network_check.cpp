@@ -0,0 +1,108 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <algorithm>
+
+#include "check.h"
+#include "../common/median_network.h"
+
+// The 3x3 and 5x5 sorting-network medians against the sort median: on every
+// 0-1 window (2^9 and 2^25 of them; by the 0-1 principle a network that
+// takes the median of all of them does so for any values), on the edge sizes
+// and on the sample images.
+
+using namespace std;
+
+check::Plane networkMedian(const check::Plane& in, int radius) {
+    check::Plane out;
+    out.resize(in.width, in.height);
+    medianFilterSmall(in.row(0), in.width, out.row(0), out.width, in.width, in.height, radius);
+    return out;
+}
+
+// Every 0-1 window of the given radius side by side in planes of one window
+// height: the window centred on column (2r + 1) k + r of the middle row is
+// pattern k of the batch exactly, without border pixels, so its median is 1
+// when more than half of the bits are set.
+void checkZeroOne(check::Report& report, int radius) {
+    const int diameter = 2 * radius + 1;
+    const int area = diameter * diameter;
+    const uint64_t patterns = uint64_t(1) << area;
+    const int batch = static_cast<int>(min<uint64_t>(patterns, 1 << 16));
+    check::Plane plane;
+    plane.resize(batch * diameter, diameter);
+    uint64_t wrong = 0, firstWrong = 0;
+    for (uint64_t first = 0; first < patterns; first += batch) {
+        for (int k = 0; k < batch; ++k) {
+            uint64_t pattern = first + k;
+            for (int bit = 0; bit < area; ++bit) {
+                plane.row(bit / diameter)[k * diameter + bit % diameter] = (pattern >> bit) & 1;
+            }
+        }
+        check::Plane out = networkMedian(plane, radius);
+        for (int k = 0; k < batch; ++k) {
+            uint64_t pattern = first + k;
+            int expected = __builtin_popcountll(pattern) > area / 2 ? 1 : 0;
+            if (out.row(radius)[k * diameter + radius] != expected && wrong++ == 0) firstWrong = pattern;
+        }
+    }
+    report.expect(wrong == 0, to_string(diameter) + "x" + to_string(diameter) + " 0-1 windows: " + to_string(wrong) +
+                                  " wrong, first pattern " + to_string(firstWrong));
+}
+
+void checkPlane(check::Report& report, const check::Plane& in, const string& name) {
+    for (int radius : {1, 2}) {
+        string difference = check::firstDifference(check::sortMedian(in, radius), networkMedian(in, radius));
+        report.expect(difference.empty(), name + " radius " + to_string(radius) + " " + difference);
+    }
+}
+
+int main() {
+    check::Report report;
+
+    checkZeroOne(report, 1);
+    checkZeroOne(report, 2);
+
+    // Only radii 1 and 2 have a network; the callers fall back otherwise.
+    uint8_t pixel = 0;
+    report.expect(!medianFilterSmall(&pixel, 1, &pixel, 1, 1, 1, 3), "radius 3 has no network");
+
+    uint32_t seed = 1;
+    for (const pair<int, int>& size : check::edgeSizes()) {
+        checkPlane(report, check::randomPlane(size.first, size.second, seed++), "random " + check::sizeName(size.first, size.second));
+        checkPlane(report, check::randomPlane(size.first, size.second, seed++, 3),
+                   "3-level " + check::sizeName(size.first, size.second));
+    }
+    // Widths around the 32-pixel blocks the networks run on.
+    for (int width : {31, 32, 33, 63, 64, 65}) {
+        checkPlane(report, check::randomPlane(width, 4, seed++), "random " + check::sizeName(width, 4));
+    }
+
+    for (const string& name : check::sampleImages()) {
+        vector<check::Plane> channels;
+        if (!check::loadSampleChannels(name, channels)) return 1;
+        for (int c = 0; c < 3; ++c) checkPlane(report, channels[c], name + " channel " + to_string(c));
+
+        // The interleaved, bottom-up file layout: step 3 and a negative
+        // stride.
+        BMPImage image;
+        readBMP(name, image);
+        ConstImageView view = image.view();
+        check::Plane flipped;
+        flipped.resize(view.width, view.height);
+        for (int y = 0; y < view.height; ++y) {
+            for (int x = 0; x < view.width; ++x) flipped.row(y)[x] = view.pixel(x, view.height - 1 - y)[0];
+        }
+        for (int radius : {1, 2}) {
+            check::Plane out;
+            out.resize(view.width, view.height);
+            medianFilterSmall(view.row(view.height - 1), -view.stride, out.row(0), out.width, view.width, view.height,
+                              radius, view.channels);
+            string difference = check::firstDifference(check::sortMedian(flipped, radius), out);
+            report.expect(difference.empty(), name + " interleaved radius " + to_string(radius) + " " + difference);
+        }
+    }
+
+    return report.finish("median_network_check");
+}
@@ -0,0 +1,126 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+#include "check.h"
+#include "../common/tone_curve.h"
+
+// Tone curves applied through their tables, on every SIMD path this CPU runs,
+// against pow evaluated per subpixel as gamma and enhance did before: gamma
+// and power-law curves and a chain of two, on 24-bit images and on 32-bit
+// ones whose alpha has to stay as it was.
+
+using namespace std;
+
+// The formula a curve stands for.
+struct Formula {
+    string name;
+    ToneCurve curve;
+    uint8_t (*apply)(uint8_t value, double parameter);
+    double parameter;
+};
+
+// gammaCorrection of gamma.cpp and enhance.cpp.
+uint8_t gammaPow(uint8_t value, double gamma) {
+    double normalized = static_cast<double>(value) / 255.0;
+    return static_cast<uint8_t>(pow(normalized, gamma) * 255);
+}
+
+// 1.4 (v / 255)^0.8 * 255, clamped.
+uint8_t brightenPow(uint8_t value, double) {
+    double result = 1.4 * pow(static_cast<double>(value) / 255.0, 0.8) * 255;
+    return static_cast<uint8_t>(max(0.0, min(result, 255.0)));
+}
+
+// Gamma 0.6 after gamma 1.5, two passes of gammaCorrection.
+uint8_t twoGammasPow(uint8_t value, double) {
+    return gammaPow(gammaPow(value, 1.5), 0.6);
+}
+
+vector<Formula> formulas() {
+    vector<Formula> list;
+    for (double gamma : {0.4, 0.6, 1.0, 1.5, 2.2}) {
+        list.push_back({"gamma " + to_string(gamma), ToneCurve::gamma(gamma), gammaPow, gamma});
+    }
+    list.push_back({"power law 1.4, 0.8", ToneCurve::powerLaw(1.4, 0.8), brightenPow, 0});
+    list.push_back({"gamma 1.5 then 0.6", ToneCurve::gamma(1.5).then(ToneCurve::gamma(0.6)), twoGammasPow, 0});
+    return list;
+}
+
+vector<SimdPath> allPaths() {
+    vector<SimdPath> paths;
+    for (SimdPath path : {SimdPath::Scalar, SimdPath::SSE41, SimdPath::AVX2, SimdPath::NEON}) {
+        if (simdPathSupported(path)) paths.push_back(path);
+    }
+    return paths;
+}
+
+// Random bytes in every pixel and in the row padding.
+BMPImage randomImage(int width, int height, int channels, uint32_t seed) {
+    BMPImage image;
+    image.channels = channels;
+    resizeBMP(image, width, height);
+    image.pixels = check::randomPlane(image.stride, height, seed).pixels;
+    return image;
+}
+
+// Applies the curve to a copy and compares every byte with the formula, or
+// with the input for alpha and row padding.
+void checkImage(check::Report& report, const BMPImage& image, ThreadPool* pool, const string& name) {
+    for (const Formula& formula : formulas()) {
+        for (SimdPath path : allPaths()) {
+            BMPImage output = image;
+            applyToneCurve(output.view(), formula.curve, path, pool);
+            string difference;
+            ConstImageView in = image.view(), out = output.view();
+            const int colourBytes = in.width * in.channels;
+            for (int y = 0; y < in.height && difference.empty(); ++y) {
+                for (int i = 0; i < image.stride; ++i) {
+                    uint8_t value = in.row(y)[i];
+                    bool colour = i < colourBytes && (in.channels != 4 || i % 4 != 3);
+                    uint8_t expected = colour ? formula.apply(value, formula.parameter) : value;
+                    if (out.row(y)[i] != expected) {
+                        difference = "row " + to_string(y) + " byte " + to_string(i) + ": " + to_string(value) +
+                                     " -> expected " + to_string(expected) + ", got " + to_string(out.row(y)[i]);
+                        break;
+                    }
+                }
+            }
+            report.expect(difference.empty(), name + " " + formula.name + " " + simdPathName(path) + " " + difference);
+        }
+    }
+}
+
+int main() {
+    check::Report report;
+    ThreadPool pool(4);
+
+    // Every input value through every table entry of every formula.
+    for (const Formula& formula : formulas()) {
+        for (int v = 0; v < 256; ++v) {
+            uint8_t value = static_cast<uint8_t>(v);
+            report.expect(formula.curve(value) == formula.apply(value, formula.parameter),
+                          formula.name + " table entry " + to_string(v));
+        }
+    }
+
+    uint32_t seed = 1;
+    for (const pair<int, int>& size : check::edgeSizes()) {
+        for (int channels : {3, 4}) {
+            BMPImage image = randomImage(size.first, size.second, channels, seed++);
+            checkImage(report, image, nullptr, "random " + check::sizeName(size.first, size.second) + " " +
+                                                   to_string(8 * channels) + "-bit");
+        }
+    }
+
+    for (const string& name : check::sampleImages()) {
+        BMPImage image;
+        if (!readBMP(name, image)) return 1;
+        checkImage(report, image, &pool, name);
+    }
+
+    return report.finish("tone_curve_check");
+}